@@ -0,0 +1,827 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+/*
+    ydotool_bench - end-to-end benchmark of ydotoold.
+
+    Starts a daemon on a private socket, sends key, mouse and mixed frames
+    through libydotool like any client, and reads them back from the evdev
+    node of the daemon's device. The node is grabbed, so the desktop doesn't
+    see any of it. With --simulate the daemon writes into a FIFO instead,
+    which needs no /dev/uinput.
+
+    Latency is per frame, from just before the client sends it to the
+    timestamp the input core gives its SYN_REPORT (with --simulate, the
+    time the daemon wrote it). Frames are matched in order, so after an
+    overflow of the evdev buffer the rest of a run has no latency samples.
+
+    System calls are counted with the raw_syscalls:sys_enter tracepoint if
+    perf can open it, for the daemon and the sending thread. Otherwise only
+    the read and write calls in /proc/PID/io are counted, which leave out
+    the socket calls.
+*/
+
+#define _GNU_SOURCE
+
+#include "libydotool.h"
+#include "protocol.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include <linux/input.h>
+#include <linux/perf_event.h>
+
+#ifndef YDOTOOLD_PATH
+#define YDOTOOLD_PATH "ydotoold"
+#endif
+
+#define DEVICE_NAME		"ydotoold virtual device"
+
+// Nodes of other daemons' devices that are told apart from ours
+#define OTHER_DEVICES_MAX	32
+
+// How long the daemon gets to come up, and udev to create the node
+#define STARTUP_WAIT_MS		5000
+
+// A run ends when nothing more arrives for this long after the daemon wrote everything
+#define DRAIN_WAIT_MS		1000
+
+enum workload {
+	WORKLOAD_KEY,
+	WORKLOAD_MOUSE,
+	WORKLOAD_MIXED,
+	WORKLOAD_COUNT,
+};
+
+static const char *workload_names[] = {"key", "mouse", "mixed"};
+
+static const char *opt_daemon = YDOTOOLD_PATH;
+static uint32_t opt_frames = 20000;
+static uint32_t opt_rate = 0;
+static bool opt_simulate = false;
+static bool opt_ring = false;
+static bool opt_verbose = false;
+static bool opt_workloads[WORKLOAD_COUNT] = {true, true, true};
+
+static char dir_path[] = "/tmp/ydotool_bench.XXXXXX";
+static char socket_path[PATH_MAX];
+static char seq_socket_path[sizeof(socket_path) + sizeof(YDOTOOL_SEQ_SOCKET_SUFFIX)];
+static char fifo_path[PATH_MAX];
+
+static pid_t daemon_pid = -1;
+
+static volatile sig_atomic_t stop = 0;
+
+struct reader {
+	int fd;
+	atomic_bool stop;
+	uint64_t *delivered;		// SYN_REPORT timestamps, in us
+	uint32_t capacity;
+	atomic_uint_fast32_t frames;
+	atomic_uint_fast64_t events;
+	uint32_t overflow_at;		// Frames read before the first SYN_DROPPED, UINT32_MAX if none
+	uint32_t overflows;
+};
+
+// System calls of the daemon and of this thread
+struct syscalls {
+	bool perf;
+	int fd_daemon;
+	int fd_client;
+	char io_daemon[64];
+	char io_client[64];
+};
+
+static void show_help() {
+	puts(
+		"Usage: ydotool_bench [OPTION]...\n"
+		"Start ydotoold on a private socket, send key, mouse and mixed frames through\n"
+		"libydotool, and read them back from the daemon's device. Reports events per\n"
+		"second, latency percentiles from sending a frame to its delivery, and system\n"
+		"calls per event.\n"
+		"\n"
+		"Options:\n"
+		"  -n, --frames=N             Frames per workload (default 20000)\n"
+		"  -r, --rate=HZ              Send HZ frames per second (default 0, as fast as\n"
+		"                               the daemon takes them)\n"
+		"  -w, --workload=NAME        key, mouse, mixed or all (default), can be repeated\n"
+		"  -s, --simulate             Let the daemon write into a FIFO instead of\n"
+		"                               uinput, for machines without /dev/uinput\n"
+		"  -R, --ring                 Send through a shared memory ring\n"
+		"  -d, --daemon=PATH          ydotoold to run (default " YDOTOOLD_PATH ")\n"
+		"  -v, --verbose              Show the output of the daemon\n"
+		"  -h, --help                 Display this help and exit\n"
+		"\n"
+		"Without --simulate this needs access to /dev/uinput and /dev/input."
+	);
+}
+
+static void handle_signal(int sig) {
+	stop = 1;
+}
+
+static uint64_t monotonic_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void cleanup() {
+	if (daemon_pid > 0) {
+		kill(daemon_pid, SIGTERM);
+		waitpid(daemon_pid, NULL, 0);
+		daemon_pid = -1;
+	}
+
+	unlink(seq_socket_path);
+	unlink(socket_path);
+	unlink(fifo_path);
+	rmdir(dir_path);
+}
+
+static bool daemon_alive() {
+	return daemon_pid > 0 && waitpid(daemon_pid, NULL, WNOHANG) == 0;
+}
+
+static int daemon_start() {
+	const char *argv[8];
+	int argc = 0;
+
+	argv[argc++] = "ydotoold";
+	argv[argc++] = "--socket-path";
+	argv[argc++] = socket_path;
+
+	if (opt_simulate) {
+		argv[argc++] = "--simulate";
+		argv[argc++] = fifo_path;
+	}
+
+	argv[argc] = NULL;
+
+	daemon_pid = fork();
+
+	if (daemon_pid < 0) {
+		perror("failed to fork");
+		return -1;
+	}
+
+	if (daemon_pid == 0) {
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+		if (!opt_verbose) {
+			int fd = open("/dev/null", O_WRONLY);
+
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+
+		execv(opt_daemon, (char **)argv);
+		fprintf(stderr, "failed to run %s: %s\n", opt_daemon, strerror(errno));
+		_exit(127);
+	}
+
+	return 0;
+}
+
+// Once the connection socket exists, the datagram one next to it does as well
+static struct ydotool *daemon_connect() {
+	struct stat sbuf;
+
+	for (int waited = 0; waited < STARTUP_WAIT_MS; waited += 10) {
+		if (stat(seq_socket_path, &sbuf) == 0) {
+			return ydotool_connect(socket_path);
+		}
+
+		if (!daemon_alive()) {
+			fputs("ydotoold exited, run with --verbose to see why\n", stderr);
+			errno = 0;
+			return NULL;
+		}
+
+		usleep(10 * 1000);
+	}
+
+	errno = ETIMEDOUT;
+	return NULL;
+}
+
+static bool device_is_ours(int fd) {
+	char name[256] = "";
+
+	return ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name) >= 0 && strcmp(name, DEVICE_NAME) == 0;
+}
+
+// Nodes of devices by our name, `skip' holds the ones that aren't
+static int devices_list(char others[][16], int *count, const char *skip, int skip_count, char *found) {
+	DIR *dir = opendir("/dev/input");
+
+	if (!dir) {
+		return -1;
+	}
+
+	struct dirent *de;
+
+	while ((de = readdir(dir))) {
+		if (strncmp(de->d_name, "event", 5) || strlen(de->d_name) >= 16) {
+			continue;
+		}
+
+		bool skipped = false;
+
+		for (int i=0; i<skip_count; i++) {
+			if (strcmp(skip + i * 16, de->d_name) == 0) {
+				skipped = true;
+			}
+		}
+
+		if (skipped) {
+			continue;
+		}
+
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "/dev/input/%s", de->d_name);
+
+		int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+		if (fd < 0) {
+			continue;
+		}
+
+		if (device_is_ours(fd)) {
+			if (found) {
+				strcpy(found, path);
+				close(fd);
+				closedir(dir);
+				return 1;
+			}
+
+			if (*count < OTHER_DEVICES_MAX) {
+				strcpy(others[(*count)++], de->d_name);
+			}
+		}
+
+		close(fd);
+	}
+
+	closedir(dir);
+
+	return 0;
+}
+
+static int device_open(const char *path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	int clock = CLOCK_MONOTONIC;
+
+	if (ioctl(fd, EVIOCSCLOCKID, &clock) < 0 || ioctl(fd, EVIOCGRAB, 1) < 0) {
+		fprintf(stderr, "failed to set up %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void *reader_main(void *arg) {
+	struct reader *r = arg;
+	struct pollfd pfd = {.fd = r->fd, .events = POLLIN};
+	struct input_event buf[64];
+	size_t have = 0;	// Bytes of an event cut in two, a FIFO doesn't keep writes whole
+
+	while (!atomic_load(&r->stop)) {
+		if (poll(&pfd, 1, 100) <= 0) {
+			continue;
+		}
+
+		ssize_t rc = read(r->fd, (uint8_t *)buf + have, sizeof(buf) - have);
+
+		if (rc <= 0) {
+			if (rc < 0 && (errno == EINTR || errno == EAGAIN)) {
+				continue;
+			}
+
+			break;
+		}
+
+		size_t count = (have + rc) / sizeof(buf[0]);
+
+		have = (have + rc) % sizeof(buf[0]);
+
+		for (size_t i=0; i<count; i++) {
+			uint32_t frames = atomic_load_explicit(&r->frames, memory_order_relaxed);
+
+			if (buf[i].type != EV_SYN) {
+				atomic_fetch_add_explicit(&r->events, 1, memory_order_relaxed);
+				continue;
+			}
+
+			if (buf[i].code == SYN_DROPPED) {
+				if (!r->overflows++) {
+					r->overflow_at = frames;
+				}
+			} else if (buf[i].code == SYN_REPORT && frames < r->capacity) {
+				r->delivered[frames] = (uint64_t)buf[i].input_event_sec * 1000000 + buf[i].input_event_usec;
+				atomic_fetch_add_explicit(&r->events, 1, memory_order_relaxed);
+				atomic_store_explicit(&r->frames, frames + 1, memory_order_release);
+			}
+		}
+
+		memmove(buf, &buf[count], have);
+	}
+
+	return NULL;
+}
+
+static int perf_tracepoint_id() {
+	static const char *paths[] = {
+		"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+		"/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+	};
+
+	for (int i=0; i<2; i++) {
+		FILE *fp = fopen(paths[i], "r");
+		int id;
+
+		if (fp) {
+			int n = fscanf(fp, "%d", &id);
+
+			fclose(fp);
+
+			if (n == 1) {
+				return id;
+			}
+		}
+	}
+
+	return -1;
+}
+
+static int perf_open(int id, pid_t pid) {
+	struct perf_event_attr attr = {
+		.type = PERF_TYPE_TRACEPOINT,
+		.size = sizeof(attr),
+		.config = id,
+	};
+
+	return syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Must be called by the thread that sends
+static void syscalls_setup(struct syscalls *s) {
+	int id = perf_tracepoint_id();
+
+	s->fd_daemon = s->fd_client = -1;
+
+	if (id >= 0) {
+		s->fd_daemon = perf_open(id, daemon_pid);
+		s->fd_client = perf_open(id, 0);
+	}
+
+	s->perf = s->fd_daemon >= 0 && s->fd_client >= 0;
+
+	snprintf(s->io_daemon, sizeof(s->io_daemon), "/proc/%d/io", (int)daemon_pid);
+	snprintf(s->io_client, sizeof(s->io_client), "/proc/self/task/%d/io", (int)syscall(SYS_gettid));
+}
+
+static uint64_t io_syscalls(const char *path) {
+	FILE *fp = fopen(path, "r");
+	char line[128];
+	uint64_t total = 0, n;
+
+	if (!fp) {
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "syscr: %" SCNu64, &n) == 1 || sscanf(line, "syscw: %" SCNu64, &n) == 1) {
+			total += n;
+		}
+	}
+
+	fclose(fp);
+
+	return total;
+}
+
+static void syscalls_sample(const struct syscalls *s, uint64_t *daemon, uint64_t *client) {
+	if (s->perf) {
+		if (read(s->fd_daemon, daemon, sizeof(*daemon)) != sizeof(*daemon)) {
+			*daemon = 0;
+		}
+
+		if (read(s->fd_client, client, sizeof(*client)) != sizeof(*client)) {
+			*client = 0;
+		}
+	} else {
+		*daemon = io_syscalls(s->io_daemon);
+		*client = io_syscalls(s->io_client);
+	}
+}
+
+// Sends frame i of a workload, returns its number of events
+static int frame_send(struct ydotool *yd, enum workload w, uint32_t i) {
+	int events;
+
+	switch (w) {
+		case WORKLOAD_KEY:
+			ydotool_frame_add(yd, EV_KEY, KEY_A, !(i & 1));
+			events = 1;
+			break;
+		case WORKLOAD_MOUSE:
+			// Zero motion wouldn't get through the input core
+			ydotool_frame_add(yd, EV_REL, REL_X, i & 1 ? -1 : 1);
+			ydotool_frame_add(yd, EV_REL, REL_Y, i & 1 ? -1 : 1);
+			events = 2;
+			break;
+		default:
+			return frame_send(yd, i & 1 ? WORKLOAD_MOUSE : WORKLOAD_KEY, i >> 1);
+	}
+
+	if (ydotool_frame_flush(yd)) {
+		return -1;
+	}
+
+	return events + 1;
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, uint32_t n, double p) {
+	uint32_t i = (uint32_t)(p / 100 * n);
+
+	return sorted[i < n ? i : n - 1];
+}
+
+static int workload_run(struct ydotool *yd, int fd_events, const struct syscalls *sc, enum workload w) {
+	uint64_t *sent = calloc(opt_frames, sizeof(uint64_t));
+	double *latency = calloc(opt_frames, sizeof(double));
+	struct reader r = {
+		.fd = fd_events,
+		.delivered = calloc(opt_frames, sizeof(uint64_t)),
+		.capacity = opt_frames,
+		.overflow_at = UINT32_MAX,
+	};
+	pthread_t thread;
+	int rc = -1;
+
+	if (!sent || !latency || !r.delivered) {
+		perror("failed to allocate memory");
+		goto out;
+	}
+
+	if ((errno = pthread_create(&thread, NULL, reader_main, &r))) {
+		perror("failed to start the reader");
+		goto out;
+	}
+
+	uint64_t sys_daemon[2], sys_client[2];
+	uint64_t events_sent = 0;
+	uint32_t frames_sent = 0;
+
+	syscalls_sample(sc, &sys_daemon[0], &sys_client[0]);
+	ydotool_pacing_restart(yd);
+
+	uint64_t t_start = monotonic_ns();
+
+	while (frames_sent < opt_frames && !stop) {
+		sent[frames_sent] = monotonic_ns();
+
+		int n = frame_send(yd, w, frames_sent);
+
+		if (n < 0) {
+			fprintf(stderr, "failed to send: %s\n", strerror(errno));
+			break;
+		}
+
+		events_sent += n;
+		frames_sent++;
+
+		if (opt_rate) {
+			ydotool_delay_us(yd, 1000000 / opt_rate);
+		}
+	}
+
+	if (ydotool_flush(yd, STARTUP_WAIT_MS)) {
+		fprintf(stderr, "failed to flush: %s\n", strerror(errno));
+	}
+
+	syscalls_sample(sc, &sys_daemon[1], &sys_client[1]);
+
+	// The daemon wrote everything, wait for the reader to catch up
+	uint32_t got = 0;
+
+	for (int idle = 0; idle < DRAIN_WAIT_MS && got < frames_sent; idle += 10) {
+		uint32_t now = atomic_load_explicit(&r.frames, memory_order_acquire);
+
+		if (now != got) {
+			got = now;
+			idle = 0;
+		}
+
+		if (got < frames_sent) {
+			usleep(10 * 1000);
+		}
+	}
+
+	atomic_store(&r.stop, true);
+	pthread_join(thread, NULL);
+
+	got = atomic_load_explicit(&r.frames, memory_order_acquire);
+
+	uint64_t events_got = atomic_load(&r.events);
+	uint32_t samples = got < r.overflow_at ? got : r.overflow_at;
+
+	for (uint32_t i=0; i<samples; i++) {
+		double us = (double)r.delivered[i] - sent[i] / 1000.0;
+
+		latency[i] = us > 0 ? us : 0;
+	}
+
+	qsort(latency, samples, sizeof(double), cmp_double);
+
+	double mean = 0;
+
+	for (uint32_t i=0; i<samples; i++) {
+		mean += latency[i] / samples;
+	}
+
+	double secs = got ? (r.delivered[got - 1] - t_start / 1000.0) / 1e6 : 0;
+
+	printf("%s: %" PRIu32 " frames, %" PRIu64 " events in %.3f s, %.0f events/s\n",
+	       workload_names[w], frames_sent, events_sent, secs, secs > 0 ? events_got / secs : 0.0);
+
+	if (samples) {
+		printf("  latency (us): mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+		       mean, percentile(latency, samples, 50), percentile(latency, samples, 90),
+		       percentile(latency, samples, 99), percentile(latency, samples, 99.9), latency[samples - 1]);
+	}
+
+	if (events_sent) {
+		printf("  %s per event: %.3f daemon, %.3f client\n",
+		       sc->perf ? "system calls" : "read/write calls",
+		       (double)(sys_daemon[1] - sys_daemon[0]) / events_sent,
+		       (double)(sys_client[1] - sys_client[0]) / events_sent);
+	}
+
+	if (got < frames_sent || r.overflows) {
+		printf("  %" PRIu32 " frames lost, %" PRIu32 " overflows of the read buffer", frames_sent - got, r.overflows);
+
+		if (samples < got) {
+			printf(", latency of the first %" PRIu32 " frames only", samples);
+		}
+
+		putchar('\n');
+	}
+
+	rc = 0;
+
+out:
+	free(sent);
+	free(latency);
+	free(r.delivered);
+
+	return rc;
+}
+
+int main(int argc, char **argv) {
+	bool workload_given = false;
+
+	while (1) {
+		static struct option long_options[] = {
+			{"frames", required_argument, 0, 'n'},
+			{"rate", required_argument, 0, 'r'},
+			{"workload", required_argument, 0, 'w'},
+			{"simulate", no_argument, 0, 's'},
+			{"ring", no_argument, 0, 'R'},
+			{"daemon", required_argument, 0, 'd'},
+			{"verbose", no_argument, 0, 'v'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+
+		int c = getopt_long(argc, argv, "n:r:w:sRd:vh", long_options, NULL);
+
+		if (c == -1) {
+			break;
+		}
+
+		switch (c) {
+			case 'n':
+				opt_frames = strtoul(optarg, NULL, 10);
+				break;
+			case 'r':
+				opt_rate = strtoul(optarg, NULL, 10);
+				break;
+			case 'w':
+				if (!workload_given) {
+					memset(opt_workloads, 0, sizeof(opt_workloads));
+					workload_given = true;
+				}
+
+				if (strcmp(optarg, "all") == 0) {
+					memset(opt_workloads, 1, sizeof(opt_workloads));
+					break;
+				}
+
+				for (int i=0; i<=WORKLOAD_COUNT; i++) {
+					if (i == WORKLOAD_COUNT) {
+						fprintf(stderr, "Unknown workload: %s\n", optarg);
+						return 1;
+					}
+
+					if (strcmp(optarg, workload_names[i]) == 0) {
+						opt_workloads[i] = true;
+						break;
+					}
+				}
+				break;
+			case 's':
+				opt_simulate = true;
+				break;
+			case 'R':
+				opt_ring = true;
+				break;
+			case 'd':
+				opt_daemon = optarg;
+				break;
+			case 'v':
+				opt_verbose = true;
+				break;
+			case 'h':
+				show_help();
+				return 0;
+			default:
+				return 1;
+		}
+	}
+
+	if (!opt_frames) {
+		fputs("Need at least one frame\n", stderr);
+		return 1;
+	}
+
+	if (!mkdtemp(dir_path)) {
+		perror("failed to create a directory for the socket");
+		return 2;
+	}
+
+	snprintf(socket_path, sizeof(socket_path), "%s/socket", dir_path);
+	snprintf(seq_socket_path, sizeof(seq_socket_path), "%s" YDOTOOL_SEQ_SOCKET_SUFFIX, socket_path);
+	snprintf(fifo_path, sizeof(fifo_path), "%s/device", dir_path);
+
+	atexit(cleanup);
+
+	struct sigaction sa = {
+		.sa_handler = handle_signal
+	};
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	int fd_events = -1;
+	char others[OTHER_DEVICES_MAX][16];
+	int others_count = 0;
+
+	if (opt_simulate) {
+		// Opened before the daemon, which waits for a reader
+		if (mkfifo(fifo_path, 0600) || (fd_events = open(fifo_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0) {
+			perror("failed to create the FIFO");
+			return 2;
+		}
+	} else if (devices_list(others, &others_count, NULL, 0, NULL)) {
+		perror("failed to list /dev/input");
+		return 2;
+	}
+
+	if (daemon_start()) {
+		return 2;
+	}
+
+	struct ydotool *yd = daemon_connect();
+
+	if (!yd) {
+		if (errno) {
+			perror("failed to connect to ydotoold");
+		}
+		return 2;
+	}
+
+	// Returns once the daemon is in its loop
+	if (ydotool_flush(yd, STARTUP_WAIT_MS)) {
+		perror("ydotoold didn't answer");
+		return 2;
+	}
+
+	if (opt_ring && ydotool_use_ring(yd, 0)) {
+		perror("failed to set up the shared memory ring");
+		return 2;
+	}
+
+	char node[PATH_MAX] = "";
+
+	if (!opt_simulate) {
+		for (int waited = 0; waited < STARTUP_WAIT_MS && !node[0]; waited += 10) {
+			if (devices_list(NULL, NULL, others[0], others_count, node) <= 0) {
+				usleep(10 * 1000);
+			}
+		}
+
+		if (!node[0]) {
+			fputs("The daemon's device didn't show up in /dev/input\n", stderr);
+			return 2;
+		}
+
+		if ((fd_events = device_open(node)) < 0) {
+			return 2;
+		}
+	}
+
+	struct syscalls sc;
+
+	syscalls_setup(&sc);
+
+	printf("Backend: %s, %s%s, %" PRIu32 " frames per workload, %s\n",
+	       opt_simulate ? "simulated" : "uinput", opt_simulate ? fifo_path : node,
+	       opt_ring ? " through a shared ring" : "", opt_frames, opt_rate ? "paced" : "as fast as possible");
+
+	if (opt_rate) {
+		printf("Rate: %" PRIu32 " frames/s\n", opt_rate);
+	}
+
+	if (!sc.perf) {
+		puts("System calls: the raw_syscalls tracepoint isn't available, counting reads and writes only");
+	}
+
+	for (int w=0; w<WORKLOAD_COUNT && !stop; w++) {
+		if (opt_workloads[w] && workload_run(yd, fd_events, &sc, w)) {
+			return 2;
+		}
+	}
+
+	ydotool_disconnect(yd);
+
+	return 0;
+}
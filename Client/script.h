@@ -0,0 +1,120 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <signal.h>
+
+#include "libydotool.h"
+
+/*
+    Input scripts, run by `ydotool run'.
+
+    A script is compiled to bytecode for a small stack machine with 64 bit
+    integers. The bytecode can be saved, so later runs skip the parser. A
+    saved file starts with a header (magic "YDSC", version, 3 reserved
+    bytes, then the number of variables, the code length and the string
+    pool length as 32 bit little endian numbers), followed by the code and
+    the string pool. Operands are little endian and unaligned.
+*/
+
+#define SCRIPT_MAGIC		"YDSC"
+#define SCRIPT_VERSION		1
+#define SCRIPT_HEADER_LEN	20
+
+#define SCRIPT_VARS_MAX		256
+#define SCRIPT_STACK_MAX	64
+#define SCRIPT_CHORD_MAX	8	// Keys in one chord
+
+enum script_op {
+	OP_HALT = 0,
+	OP_PUSH,	// i32 constant
+	OP_LOAD,	// u16 variable
+	OP_STORE,	// u16 variable, pops
+	OP_ADD,
+	OP_SUB,
+	OP_MUL,
+	OP_DIV,
+	OP_MOD,
+	OP_NEG,
+	OP_NOT,
+	OP_EQ,
+	OP_NE,
+	OP_LT,
+	OP_LE,
+	OP_GT,
+	OP_GE,
+	OP_AND,
+	OP_OR,
+	OP_JMP,		// u32 target
+	OP_JZ,		// u32 target, pops the condition
+	OP_KEY,		// u8 count, count u16 key codes: press them in order, release in reverse
+	OP_KEYDOWN,	// Same operands, press only
+	OP_KEYUP,	// Same operands, release only
+	OP_TYPE,	// u32 offset and u32 length of a string in the pool
+	OP_TYPE_NUM,	// Pops a number and types it
+	OP_CLICK,	// u8 button, pops the count
+	OP_MOVE,	// Pops y, then x
+	OP_MOVETO,	// Pops y, then x
+	OP_WHEEL,	// Pops vertical, then horizontal
+	OP_WAIT,	// Pops milliseconds
+	OP_TYPING,	// Pops the hold time, then the delay, in milliseconds
+	OP_COUNT
+};
+
+struct script {
+	uint8_t *code;
+	uint32_t code_len;
+	char *strings;
+	uint32_t strings_len;
+	uint32_t vars;
+};
+
+// Errors go to stderr as "path:line: message"
+extern int script_compile(const char *src, size_t len, const char *path, struct script *s);
+
+extern bool script_is_bytecode(const void *buf, size_t len);
+
+// Checks every instruction, so a damaged file can't make the interpreter misbehave
+extern int script_load(const void *buf, size_t len, struct script *s);
+extern int script_save(const struct script *s, const char *path);
+extern void script_free(struct script *s);
+
+// Runs until the end or until *stop is set, then releases the keys it holds down
+extern int script_run(const struct script *s, struct ydotool *yd, const volatile sig_atomic_t *stop);
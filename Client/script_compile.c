@@ -0,0 +1,873 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+/*
+    Compiler for input scripts.
+
+    One statement per line, '#' starts a comment:
+
+	x = EXPR			assign a variable
+	key CHORD...			e.g. key ctrl+alt+t enter
+	keydown CHORD, keyup CHORD	hold and release keys
+	type ITEM, ...			strings in double quotes, or numbers
+	click BUTTON [, COUNT]		left, right, middle, side, extra, forward, back, task
+	move X, Y			relative pointer motion
+	moveto X, Y			absolute position
+	wheel X, Y			horizontal and vertical scrolling
+	wait MS
+	typing DELAY, HOLD		key timing in milliseconds, default 20, 20
+	repeat COUNT ... end
+	while EXPR ... end
+	if EXPR ... [else ...] end
+
+    Expressions work on integers with the operators of C: || && == != < <=
+    > >= + - * / % and unary - and !, and parentheses. Chords are key names
+    or key codes joined by '+'.
+*/
+
+#include "script.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/input-event-codes.h>
+
+#define VAR_NAME_MAX	32
+#define BLOCKS_MAX	32
+
+// Unary operators and parentheses in a row, each of them recurses
+#define NESTING_MAX	64
+
+enum {
+	BLOCK_IF,
+	BLOCK_ELSE,
+	BLOCK_WHILE,
+	BLOCK_REPEAT,
+};
+
+struct block {
+	int kind;
+	int line;
+	uint32_t start;		// Where a loop jumps back to
+	uint32_t fixup;		// Jump target to patch at the end
+	uint16_t counter;	// Hidden variable of repeat
+};
+
+struct compiler {
+	const char *path;
+	int line;
+	const char *p;		// Position in the current line
+	const char *end;
+
+	uint8_t *code;
+	size_t code_len;
+	size_t code_cap;
+
+	char *strings;
+	size_t strings_len;
+	size_t strings_cap;
+
+	char names[SCRIPT_VARS_MAX][VAR_NAME_MAX];	// Empty for hidden ones
+	uint32_t vars;
+
+	struct block blocks[BLOCKS_MAX];
+	int depth;
+
+	int stack;		// Expression stack depth so far
+	int nesting;		// Of unary operators and parentheses
+};
+
+static const struct {
+	const char *name;
+	uint16_t code;
+} key_names[] = {
+	{"esc", KEY_ESC}, {"escape", KEY_ESC}, {"enter", KEY_ENTER}, {"return", KEY_ENTER},
+	{"tab", KEY_TAB}, {"space", KEY_SPACE}, {"backspace", KEY_BACKSPACE},
+	{"delete", KEY_DELETE}, {"del", KEY_DELETE}, {"insert", KEY_INSERT},
+	{"home", KEY_HOME}, {"end", KEY_END}, {"pageup", KEY_PAGEUP}, {"pagedown", KEY_PAGEDOWN},
+	{"up", KEY_UP}, {"down", KEY_DOWN}, {"left", KEY_LEFT}, {"right", KEY_RIGHT},
+	{"ctrl", KEY_LEFTCTRL}, {"control", KEY_LEFTCTRL}, {"rightctrl", KEY_RIGHTCTRL},
+	{"shift", KEY_LEFTSHIFT}, {"rightshift", KEY_RIGHTSHIFT},
+	{"alt", KEY_LEFTALT}, {"altgr", KEY_RIGHTALT},
+	{"super", KEY_LEFTMETA}, {"meta", KEY_LEFTMETA}, {"win", KEY_LEFTMETA},
+	{"capslock", KEY_CAPSLOCK}, {"menu", KEY_COMPOSE}, {"print", KEY_SYSRQ},
+	{"minus", KEY_MINUS}, {"equal", KEY_EQUAL}, {"comma", KEY_COMMA}, {"dot", KEY_DOT},
+	{"slash", KEY_SLASH}, {"backslash", KEY_BACKSLASH}, {"semicolon", KEY_SEMICOLON},
+	{"apostrophe", KEY_APOSTROPHE}, {"grave", KEY_GRAVE},
+	{"leftbrace", KEY_LEFTBRACE}, {"rightbrace", KEY_RIGHTBRACE},
+	{"f1", KEY_F1}, {"f2", KEY_F2}, {"f3", KEY_F3}, {"f4", KEY_F4}, {"f5", KEY_F5}, {"f6", KEY_F6},
+	{"f7", KEY_F7}, {"f8", KEY_F8}, {"f9", KEY_F9}, {"f10", KEY_F10}, {"f11", KEY_F11}, {"f12", KEY_F12},
+};
+
+static const char *button_names[] = {"left", "right", "middle", "side", "extra", "forward", "back", "task"};
+
+static int error(struct compiler *c, const char *fmt, ...) {
+	va_list ap;
+
+	fprintf(stderr, "%s:%d: ", c->path, c->line);
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+
+	fputc('\n', stderr);
+
+	return -1;
+}
+
+// Letters and digits, by their row on the keyboard
+static int key_char(char ch) {
+	static const char *rows[] = {"1234567890", "qwertyuiop", "asdfghjkl", "zxcvbnm"};
+	static const int first[] = {KEY_1, KEY_Q, KEY_A, KEY_Z};
+
+	for (int i=0; i<4; i++) {
+		const char *pos = strchr(rows[i], ch);
+
+		if (ch && pos) {
+			return first[i] + (pos - rows[i]);
+		}
+	}
+
+	return -1;
+}
+
+static int key_lookup(const char *name) {
+	if (isdigit((unsigned char)name[0]) && name[1]) {
+		char *end;
+		long code = strtol(name, &end, 0);
+
+		return *end || code <= 0 || code >= KEY_CNT ? -1 : code;
+	}
+
+	if (!name[1]) {
+		return key_char(tolower((unsigned char)name[0]));
+	}
+
+	for (size_t i=0; i<sizeof(key_names)/sizeof(key_names[0]); i++) {
+		if (strcasecmp(key_names[i].name, name) == 0) {
+			return key_names[i].code;
+		}
+	}
+
+	return -1;
+}
+
+static int code_reserve(struct compiler *c, size_t len) {
+	if (c->code_len + len > c->code_cap) {
+		size_t cap = c->code_cap ? c->code_cap * 2 : 256;
+
+		while (cap < c->code_len + len) {
+			cap *= 2;
+		}
+
+		if (cap > UINT32_MAX) {
+			return error(c, "script too long");
+		}
+
+		uint8_t *code = realloc(c->code, cap);
+
+		if (!code) {
+			return error(c, "%s", strerror(errno));
+		}
+
+		c->code = code;
+		c->code_cap = cap;
+	}
+
+	return 0;
+}
+
+static int emit_u8(struct compiler *c, uint8_t v) {
+	if (code_reserve(c, 1)) {
+		return -1;
+	}
+
+	c->code[c->code_len++] = v;
+
+	return 0;
+}
+
+static int emit_u16(struct compiler *c, uint16_t v) {
+	return emit_u8(c, v) || emit_u8(c, v >> 8) ? -1 : 0;
+}
+
+static int emit_u32(struct compiler *c, uint32_t v) {
+	return emit_u16(c, v) || emit_u16(c, v >> 16) ? -1 : 0;
+}
+
+static void patch_u32(struct compiler *c, uint32_t pos, uint32_t v) {
+	for (int i=0; i<4; i++) {
+		c->code[pos + i] = v >> (i * 8);
+	}
+}
+
+// Emit a jump, the position of its target is returned in *fixup
+static int emit_jump(struct compiler *c, uint8_t op, uint32_t target, uint32_t *fixup) {
+	if (emit_u8(c, op)) {
+		return -1;
+	}
+
+	if (fixup) {
+		*fixup = c->code_len;
+	}
+
+	return emit_u32(c, target);
+}
+
+static int stack_push(struct compiler *c) {
+	if (++c->stack > SCRIPT_STACK_MAX) {
+		return error(c, "expression too complex");
+	}
+
+	return 0;
+}
+
+static void skip_space(struct compiler *c) {
+	while (c->p < c->end && isspace((unsigned char)*c->p)) {
+		c->p++;
+	}
+}
+
+static bool at_end(struct compiler *c) {
+	skip_space(c);
+
+	return c->p == c->end || *c->p == '#';
+}
+
+static bool accept(struct compiler *c, const char *token) {
+	size_t len = strlen(token);
+
+	skip_space(c);
+
+	if (c->end - c->p >= len && memcmp(c->p, token, len) == 0) {
+		c->p += len;
+		return true;
+	}
+
+	return false;
+}
+
+// A word of letters, digits and underscores, 0 if there's none
+static size_t word(struct compiler *c, char *buf, size_t len) {
+	skip_space(c);
+
+	size_t n = 0;
+
+	while (c->p + n < c->end && (isalnum((unsigned char)c->p[n]) || c->p[n] == '_')) {
+		n++;
+	}
+
+	if (!n || n >= len || isdigit((unsigned char)c->p[0])) {
+		return 0;
+	}
+
+	memcpy(buf, c->p, n);
+	buf[n] = 0;
+	c->p += n;
+
+	return n;
+}
+
+static int var_find(struct compiler *c, const char *name) {
+	for (uint32_t i=0; i<c->vars; i++) {
+		if (strcmp(c->names[i], name) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static int var_add(struct compiler *c, const char *name) {
+	if (c->vars == SCRIPT_VARS_MAX) {
+		return error(c, "too many variables");
+	}
+
+	snprintf(c->names[c->vars], VAR_NAME_MAX, "%s", name);
+
+	return c->vars++;
+}
+
+static int expr(struct compiler *c);
+
+static int primary(struct compiler *c) {
+	skip_space(c);
+
+	if (accept(c, "(")) {
+		if (expr(c)) {
+			return -1;
+		}
+
+		return accept(c, ")") ? 0 : error(c, "missing `)'");
+	}
+
+	if (c->p < c->end && isdigit((unsigned char)*c->p)) {
+		char buf[32];
+		size_t n = 0;
+
+		while (c->p + n < c->end && isalnum((unsigned char)c->p[n]) && n < sizeof(buf) - 1) {
+			buf[n] = c->p[n];
+			n++;
+		}
+
+		buf[n] = 0;
+
+		char *end;
+		errno = 0;
+		long long v = strtoll(buf, &end, 0);
+
+		if (*end || errno || v > INT32_MAX) {
+			return error(c, "bad number `%s'", buf);
+		}
+
+		c->p += n;
+
+		return emit_u8(c, OP_PUSH) || emit_u32(c, v) || stack_push(c) ? -1 : 0;
+	}
+
+	char name[VAR_NAME_MAX];
+
+	if (!word(c, name, sizeof(name))) {
+		return error(c, "expected a number or a variable");
+	}
+
+	int var = var_find(c, name);
+
+	if (var < 0) {
+		return error(c, "`%s' is used before it is set", name);
+	}
+
+	return emit_u8(c, OP_LOAD) || emit_u16(c, var) || stack_push(c) ? -1 : 0;
+}
+
+static int unary(struct compiler *c) {
+	if (c->nesting == NESTING_MAX) {
+		return error(c, "expression nested too deep");
+	}
+
+	int rc;
+
+	c->nesting++;
+
+	if (accept(c, "-")) {
+		rc = unary(c) || emit_u8(c, OP_NEG) ? -1 : 0;
+	} else if (accept(c, "!")) {
+		// Not the start of !=, which can't begin an expression anyway
+		rc = unary(c) || emit_u8(c, OP_NOT) ? -1 : 0;
+	} else {
+		rc = primary(c);
+	}
+
+	c->nesting--;
+
+	return rc;
+}
+
+struct binop {
+	const char *token;
+	uint8_t op;
+};
+
+// One level of left associative operators, longer tokens first
+static int binary(struct compiler *c, int (*next)(struct compiler *), const struct binop *ops) {
+	if (next(c)) {
+		return -1;
+	}
+
+	while (1) {
+		const struct binop *o;
+
+		for (o = ops; o->token; o++) {
+			if (accept(c, o->token)) {
+				break;
+			}
+		}
+
+		if (!o->token) {
+			return 0;
+		}
+
+		if (next(c) || emit_u8(c, o->op)) {
+			return -1;
+		}
+
+		c->stack--;
+	}
+}
+
+static int mul_expr(struct compiler *c) {
+	static const struct binop ops[] = {{"*", OP_MUL}, {"/", OP_DIV}, {"%", OP_MOD}, {0}};
+
+	return binary(c, unary, ops);
+}
+
+static int add_expr(struct compiler *c) {
+	static const struct binop ops[] = {{"+", OP_ADD}, {"-", OP_SUB}, {0}};
+
+	return binary(c, mul_expr, ops);
+}
+
+static int cmp_expr(struct compiler *c) {
+	static const struct binop ops[] = {
+		{"==", OP_EQ}, {"!=", OP_NE}, {"<=", OP_LE}, {">=", OP_GE}, {"<", OP_LT}, {">", OP_GT}, {0}
+	};
+
+	return binary(c, add_expr, ops);
+}
+
+static int and_expr(struct compiler *c) {
+	static const struct binop ops[] = {{"&&", OP_AND}, {0}};
+
+	return binary(c, cmp_expr, ops);
+}
+
+static int expr(struct compiler *c) {
+	static const struct binop ops[] = {{"||", OP_OR}, {0}};
+
+	return binary(c, and_expr, ops);
+}
+
+// A complete expression as a statement argument, leaves its value on the stack
+static int arg(struct compiler *c) {
+	c->stack = 0;
+
+	return expr(c);
+}
+
+static int args(struct compiler *c, int count) {
+	for (int i=0; i<count; i++) {
+		if (i && !accept(c, ",")) {
+			return error(c, "expected %d arguments", count);
+		}
+
+		if (arg(c)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// CHORD, e.g. ctrl+shift+t
+static int chord(struct compiler *c, uint8_t op) {
+	uint16_t codes[SCRIPT_CHORD_MAX];
+	int count = 0;
+
+	while (1) {
+		char name[32];
+		size_t n = 0;
+
+		skip_space(c);
+
+		while (c->p + n < c->end && !isspace((unsigned char)c->p[n]) && c->p[n] != '+' && c->p[n] != ',' && n < sizeof(name) - 1) {
+			name[n] = c->p[n];
+			n++;
+		}
+
+		name[n] = 0;
+		c->p += n;
+
+		int code = n ? key_lookup(name) : -1;
+
+		if (code < 0) {
+			return error(c, n ? "unknown key `%s'" : "expected a key", name);
+		}
+
+		if (count == SCRIPT_CHORD_MAX) {
+			return error(c, "more than %d keys in a chord", SCRIPT_CHORD_MAX);
+		}
+
+		codes[count++] = code;
+
+		if (c->p == c->end || *c->p != '+') {
+			break;
+		}
+
+		c->p++;
+	}
+
+	if (emit_u8(c, op) || emit_u8(c, count)) {
+		return -1;
+	}
+
+	for (int i=0; i<count; i++) {
+		if (emit_u16(c, codes[i])) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int string_add(struct compiler *c, const char *s, size_t len, uint32_t *offset) {
+	if (c->strings_len + len > c->strings_cap) {
+		size_t cap = c->strings_cap ? c->strings_cap * 2 : 256;
+
+		while (cap < c->strings_len + len) {
+			cap *= 2;
+		}
+
+		if (cap > UINT32_MAX) {
+			return error(c, "script too long");
+		}
+
+		char *strings = realloc(c->strings, cap);
+
+		if (!strings) {
+			return error(c, "%s", strerror(errno));
+		}
+
+		c->strings = strings;
+		c->strings_cap = cap;
+	}
+
+	*offset = c->strings_len;
+	memcpy(c->strings + c->strings_len, s, len);
+	c->strings_len += len;
+
+	return 0;
+}
+
+// "..." with the escapes \n \t \\ and \"
+static int string(struct compiler *c) {
+	c->p++;
+
+	char *buf = malloc(c->end - c->p + 1);
+	size_t len = 0;
+
+	if (!buf) {
+		return error(c, "%s", strerror(errno));
+	}
+
+	while (c->p < c->end && *c->p != '"') {
+		char ch = *c->p++;
+
+		if (ch == '\\' && c->p < c->end) {
+			ch = *c->p++;
+
+			switch (ch) {
+				case 'n':
+					ch = '\n';
+					break;
+				case 't':
+					ch = '\t';
+					break;
+				case '\\':
+				case '"':
+					break;
+				default:
+					free(buf);
+					return error(c, "unknown escape `\\%c'", ch);
+			}
+		}
+
+		buf[len++] = ch;
+	}
+
+	if (c->p == c->end) {
+		free(buf);
+		return error(c, "missing `\"'");
+	}
+
+	c->p++;
+
+	uint32_t offset = 0;
+	int rc = string_add(c, buf, len, &offset) || emit_u8(c, OP_TYPE) || emit_u32(c, offset) || emit_u32(c, len) ? -1 : 0;
+
+	free(buf);
+
+	return rc;
+}
+
+static int block_open(struct compiler *c, int kind) {
+	if (c->depth == BLOCKS_MAX) {
+		return error(c, "blocks nested too deep");
+	}
+
+	c->blocks[c->depth++] = (struct block) {
+		.kind = kind,
+		.line = c->line,
+		.start = c->code_len
+	};
+
+	return 0;
+}
+
+static int stmt_repeat(struct compiler *c) {
+	int counter = var_add(c, "");
+
+	if (counter < 0 || arg(c) || emit_u8(c, OP_STORE) || emit_u16(c, counter) || block_open(c, BLOCK_REPEAT)) {
+		return -1;
+	}
+
+	struct block *b = &c->blocks[c->depth - 1];
+
+	b->counter = counter;
+
+	// while (counter > 0)
+	return emit_u8(c, OP_LOAD) || emit_u16(c, counter) || emit_u8(c, OP_PUSH) || emit_u32(c, 0)
+	       || emit_u8(c, OP_GT) || emit_jump(c, OP_JZ, 0, &b->fixup) ? -1 : 0;
+}
+
+static int stmt_end(struct compiler *c) {
+	if (!c->depth) {
+		return error(c, "`end' without a block");
+	}
+
+	struct block *b = &c->blocks[--c->depth];
+
+	if (b->kind == BLOCK_REPEAT) {
+		if (emit_u8(c, OP_LOAD) || emit_u16(c, b->counter) || emit_u8(c, OP_PUSH) || emit_u32(c, 1)
+		    || emit_u8(c, OP_SUB) || emit_u8(c, OP_STORE) || emit_u16(c, b->counter)) {
+			return -1;
+		}
+	}
+
+	if ((b->kind == BLOCK_REPEAT || b->kind == BLOCK_WHILE) && emit_jump(c, OP_JMP, b->start, NULL)) {
+		return -1;
+	}
+
+	patch_u32(c, b->fixup, c->code_len);
+
+	return 0;
+}
+
+static int statement(struct compiler *c) {
+	char name[VAR_NAME_MAX];
+
+	if (!word(c, name, sizeof(name))) {
+		return error(c, "expected a command");
+	}
+
+	if (strcmp(name, "key") == 0 || strcmp(name, "keydown") == 0 || strcmp(name, "keyup") == 0) {
+		uint8_t op = name[3] == 0 ? OP_KEY : name[3] == 'd' ? OP_KEYDOWN : OP_KEYUP;
+
+		do {
+			if (chord(c, op)) {
+				return -1;
+			}
+
+			accept(c, ",");
+		} while (!at_end(c));
+
+		return 0;
+	}
+
+	if (strcmp(name, "type") == 0) {
+		do {
+			skip_space(c);
+
+			if (c->p < c->end && *c->p == '"') {
+				if (string(c)) {
+					return -1;
+				}
+			} else if (arg(c) || emit_u8(c, OP_TYPE_NUM)) {
+				return -1;
+			}
+		} while (accept(c, ","));
+
+		return 0;
+	}
+
+	if (strcmp(name, "click") == 0) {
+		char button[16];
+		int idx = -1;
+
+		if (word(c, button, sizeof(button))) {
+			for (int i=0; i<sizeof(button_names)/sizeof(button_names[0]); i++) {
+				if (strcmp(button_names[i], button) == 0) {
+					idx = i;
+				}
+			}
+		}
+
+		if (idx < 0) {
+			return error(c, "expected a button: left, right, middle, side, extra, forward, back or task");
+		}
+
+		if (accept(c, ",")) {
+			if (arg(c)) {
+				return -1;
+			}
+		} else if (emit_u8(c, OP_PUSH) || emit_u32(c, 1)) {
+			return -1;
+		}
+
+		return emit_u8(c, OP_CLICK) || emit_u8(c, idx) ? -1 : 0;
+	}
+
+	static const struct {
+		const char *name;
+		int args;
+		uint8_t op;
+	} simple[] = {
+		{"move", 2, OP_MOVE},
+		{"moveto", 2, OP_MOVETO},
+		{"wheel", 2, OP_WHEEL},
+		{"wait", 1, OP_WAIT},
+		{"typing", 2, OP_TYPING},
+	};
+
+	for (int i=0; i<sizeof(simple)/sizeof(simple[0]); i++) {
+		if (strcmp(name, simple[i].name) == 0) {
+			return args(c, simple[i].args) || emit_u8(c, simple[i].op) ? -1 : 0;
+		}
+	}
+
+	if (strcmp(name, "repeat") == 0) {
+		return stmt_repeat(c);
+	}
+
+	if (strcmp(name, "while") == 0 || strcmp(name, "if") == 0) {
+		bool loop = name[0] == 'w';
+
+		if (block_open(c, loop ? BLOCK_WHILE : BLOCK_IF) || arg(c)) {
+			return -1;
+		}
+
+		return emit_jump(c, OP_JZ, 0, &c->blocks[c->depth - 1].fixup);
+	}
+
+	if (strcmp(name, "else") == 0) {
+		if (!c->depth || c->blocks[c->depth - 1].kind != BLOCK_IF) {
+			return error(c, "`else' without `if'");
+		}
+
+		struct block *b = &c->blocks[c->depth - 1];
+		uint32_t cond_fixup = b->fixup;
+
+		if (emit_jump(c, OP_JMP, 0, &b->fixup)) {
+			return -1;
+		}
+
+		patch_u32(c, cond_fixup, c->code_len);
+		b->kind = BLOCK_ELSE;
+
+		return 0;
+	}
+
+	if (strcmp(name, "end") == 0) {
+		return stmt_end(c);
+	}
+
+	// Assignment, but not a comparison
+	skip_space(c);
+
+	if (c->p < c->end && *c->p == '=' && (c->p + 1 == c->end || c->p[1] != '=')) {
+		c->p++;
+
+		if (arg(c)) {
+			return -1;
+		}
+
+		// Declared after its value, so `x = x' is an error the first time
+		int var = var_find(c, name);
+
+		if (var < 0 && (var = var_add(c, name)) < 0) {
+			return -1;
+		}
+
+		return emit_u8(c, OP_STORE) || emit_u16(c, var) ? -1 : 0;
+	}
+
+	return error(c, "unknown command `%s'", name);
+}
+
+int script_compile(const char *src, size_t len, const char *path, struct script *s) {
+	struct compiler *c = calloc(1, sizeof(struct compiler));
+
+	if (!c) {
+		return -1;
+	}
+
+	c->path = path;
+
+	const char *line = src;
+	const char *src_end = src + len;
+	int rc = 0;
+
+	while (line < src_end && !rc) {
+		const char *eol = memchr(line, '\n', src_end - line);
+
+		if (!eol) {
+			eol = src_end;
+		}
+
+		c->line++;
+		c->p = line;
+		c->end = eol;
+
+		if (!at_end(c)) {
+			rc = statement(c);
+
+			if (!rc && !at_end(c)) {
+				rc = error(c, "unexpected `%.*s'", (int)(c->end - c->p), c->p);
+			}
+		}
+
+		line = eol + 1;
+	}
+
+	if (!rc && c->depth) {
+		c->line = c->blocks[c->depth - 1].line;
+		rc = error(c, "block without `end'");
+	}
+
+	if (!rc) {
+		rc = emit_u8(c, OP_HALT);
+	}
+
+	if (rc) {
+		free(c->code);
+		free(c->strings);
+	} else {
+		*s = (struct script) {
+			.code = c->code,
+			.code_len = c->code_len,
+			.strings = c->strings,
+			.strings_len = c->strings_len,
+			.vars = c->vars
+		};
+	}
+
+	free(c);
+
+	return rc;
+}
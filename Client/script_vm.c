@@ -0,0 +1,543 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+/*
+    Bytecode files and the interpreter for input scripts.
+*/
+
+#include "script.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <linux/input-event-codes.h>
+
+#define DEFAULT_KEY_DELAY_MS	20
+#define DEFAULT_KEY_HOLD_MS	20
+
+static uint16_t get_u16(const uint8_t *p) {
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+	return get_u16(p) | (uint32_t)get_u16(p + 2) << 16;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+	for (int i=0; i<4; i++) {
+		p[i] = v >> (i * 8);
+	}
+}
+
+// Length of the instruction at pos with its operands, 0 if it doesn't fit or isn't one
+static uint32_t insn_len(const uint8_t *code, uint32_t len, uint32_t pos) {
+	uint32_t n;
+
+	switch (code[pos]) {
+		case OP_PUSH:
+		case OP_JMP:
+		case OP_JZ:
+			n = 5;
+			break;
+
+		case OP_LOAD:
+		case OP_STORE:
+			n = 3;
+			break;
+
+		case OP_KEY:
+		case OP_KEYDOWN:
+		case OP_KEYUP:
+			if (pos + 1 >= len) {
+				return 0;
+			}
+
+			n = 2 + 2 * code[pos + 1];
+			break;
+
+		case OP_TYPE:
+			n = 9;
+			break;
+
+		case OP_CLICK:
+			n = 2;
+			break;
+
+		default:
+			n = code[pos] < OP_COUNT ? 1 : 0;
+	}
+
+	return n && n <= len - pos ? n : 0;
+}
+
+bool script_is_bytecode(const void *buf, size_t len) {
+	return len >= 4 && memcmp(buf, SCRIPT_MAGIC, 4) == 0;
+}
+
+static int script_check(const struct script *s) {
+	uint8_t *starts = calloc(s->code_len / 8 + 1, 1);
+
+	if (!starts) {
+		return -1;
+	}
+
+	int rc = -1;
+
+	for (uint32_t pos = 0, n; pos < s->code_len; pos += n) {
+		if (!(n = insn_len(s->code, s->code_len, pos))) {
+			goto out;
+		}
+
+		starts[pos / 8] |= 1 << (pos % 8);
+	}
+
+	for (uint32_t pos = 0; pos < s->code_len; pos += insn_len(s->code, s->code_len, pos)) {
+		const uint8_t *arg = s->code + pos + 1;
+
+		switch (s->code[pos]) {
+			case OP_LOAD:
+			case OP_STORE:
+				if (get_u16(arg) >= s->vars) {
+					goto out;
+				}
+				break;
+
+			case OP_JMP:
+			case OP_JZ: {
+				uint32_t target = get_u32(arg);
+
+				if (target > s->code_len || (target < s->code_len && !(starts[target / 8] & (1 << (target % 8))))) {
+					goto out;
+				}
+				break;
+			}
+
+			case OP_KEY:
+			case OP_KEYDOWN:
+			case OP_KEYUP:
+				if (!arg[0] || arg[0] > SCRIPT_CHORD_MAX) {
+					goto out;
+				}
+
+				for (int i=0; i<arg[0]; i++) {
+					if (get_u16(arg + 1 + i * 2) >= KEY_CNT) {
+						goto out;
+					}
+				}
+				break;
+
+			case OP_TYPE:
+				if ((uint64_t)get_u32(arg) + get_u32(arg + 4) > s->strings_len) {
+					goto out;
+				}
+				break;
+
+			case OP_CLICK:
+				if (arg[0] > YDOTOOL_BUTTON_TASK) {
+					goto out;
+				}
+				break;
+		}
+	}
+
+	rc = 0;
+
+out:
+	free(starts);
+
+	return rc;
+}
+
+int script_load(const void *buf, size_t len, struct script *s) {
+	const uint8_t *p = buf;
+
+	if (len < SCRIPT_HEADER_LEN || !script_is_bytecode(buf, len) || p[4] != SCRIPT_VERSION) {
+		errno = EBADMSG;
+		return -1;
+	}
+
+	struct script ret = {
+		.vars = get_u32(p + 8),
+		.code_len = get_u32(p + 12),
+		.strings_len = get_u32(p + 16),
+	};
+
+	if (ret.vars > SCRIPT_VARS_MAX || (uint64_t)SCRIPT_HEADER_LEN + ret.code_len + ret.strings_len != len) {
+		errno = EBADMSG;
+		return -1;
+	}
+
+	ret.code = malloc(ret.code_len + 1);
+	ret.strings = malloc(ret.strings_len + 1);
+
+	if (!ret.code || !ret.strings) {
+		script_free(&ret);
+		return -1;
+	}
+
+	memcpy(ret.code, p + SCRIPT_HEADER_LEN, ret.code_len);
+	memcpy(ret.strings, p + SCRIPT_HEADER_LEN + ret.code_len, ret.strings_len);
+
+	if (script_check(&ret)) {
+		script_free(&ret);
+		errno = EBADMSG;
+		return -1;
+	}
+
+	*s = ret;
+
+	return 0;
+}
+
+// Written next to the target and renamed, a concurrent run never reads half a file
+int script_save(const struct script *s, const char *path) {
+	char tmp_path[PATH_MAX];
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >= sizeof(tmp_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	int fd = mkstemp(tmp_path);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	FILE *fp = fdopen(fd, "w");
+
+	if (!fp) {
+		close(fd);
+		unlink(tmp_path);
+		return -1;
+	}
+
+	uint8_t header[SCRIPT_HEADER_LEN] = {0};
+
+	memcpy(header, SCRIPT_MAGIC, 4);
+	header[4] = SCRIPT_VERSION;
+	put_u32(header + 8, s->vars);
+	put_u32(header + 12, s->code_len);
+	put_u32(header + 16, s->strings_len);
+
+	bool ok = fwrite(header, sizeof(header), 1, fp) == 1
+		  && fwrite(s->code, 1, s->code_len, fp) == s->code_len
+		  && fwrite(s->strings, 1, s->strings_len, fp) == s->strings_len;
+
+	if (fclose(fp) || !ok || chmod(tmp_path, 0644) || rename(tmp_path, path)) {
+		int err = errno;
+		unlink(tmp_path);
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+void script_free(struct script *s) {
+	free(s->code);
+	free(s->strings);
+
+	s->code = NULL;
+	s->strings = NULL;
+}
+
+static int32_t clamp32(int64_t v) {
+	return v > INT32_MAX ? INT32_MAX : v < INT32_MIN ? INT32_MIN : v;
+}
+
+static int delay_ms(int64_t v) {
+	return v < 0 ? 0 : v > INT_MAX ? INT_MAX : v;
+}
+
+struct vm {
+	struct ydotool *yd;
+	int64_t stack[SCRIPT_STACK_MAX];
+	int sp;
+	int key_delay_ms;
+	int key_hold_ms;
+	uint8_t keys_down[KEY_CNT / 8];
+};
+
+static int vm_keys(struct vm *vm, const uint8_t *arg, bool press, bool release) {
+	int count = arg[0];
+
+	if (press) {
+		for (int i=0; i<count; i++) {
+			uint16_t code = get_u16(arg + 1 + i * 2);
+
+			if (ydotool_key(vm->yd, code, 1)) {
+				return -1;
+			}
+
+			vm->keys_down[code / 8] |= 1 << (code % 8);
+		}
+	}
+
+	if (press && release) {
+		ydotool_delay_ms(vm->yd, vm->key_hold_ms);
+	}
+
+	if (release) {
+		for (int i=count-1; i>=0; i--) {
+			uint16_t code = get_u16(arg + 1 + i * 2);
+
+			if (ydotool_key(vm->yd, code, 0)) {
+				return -1;
+			}
+
+			vm->keys_down[code / 8] &= ~(1 << (code % 8));
+		}
+	}
+
+	return ydotool_delay_ms(vm->yd, vm->key_delay_ms);
+}
+
+static void vm_release_keys(struct vm *vm) {
+	for (int code=0; code<KEY_CNT; code++) {
+		if (vm->keys_down[code / 8] & (1 << (code % 8))) {
+			ydotool_key(vm->yd, code, 0);
+		}
+	}
+}
+
+// Plain C arithmetic on int64_t, except that it wraps instead of overflowing
+static int vm_arith(uint8_t op, int64_t a, int64_t b, int64_t *ret) {
+	switch (op) {
+		case OP_ADD: *ret = (int64_t)((uint64_t)a + (uint64_t)b); break;
+		case OP_SUB: *ret = (int64_t)((uint64_t)a - (uint64_t)b); break;
+		case OP_MUL: *ret = (int64_t)((uint64_t)a * (uint64_t)b); break;
+		case OP_DIV:
+		case OP_MOD:
+			if (!b) {
+				return -1;
+			}
+
+			if (b == -1) {
+				*ret = op == OP_DIV ? (int64_t)(0 - (uint64_t)a) : 0;
+			} else {
+				*ret = op == OP_DIV ? a / b : a % b;
+			}
+			break;
+		case OP_EQ: *ret = a == b; break;
+		case OP_NE: *ret = a != b; break;
+		case OP_LT: *ret = a < b; break;
+		case OP_LE: *ret = a <= b; break;
+		case OP_GT: *ret = a > b; break;
+		case OP_GE: *ret = a >= b; break;
+		case OP_AND: *ret = a && b; break;
+		case OP_OR: *ret = a || b; break;
+	}
+
+	return 0;
+}
+
+int script_run(const struct script *s, struct ydotool *yd, const volatile sig_atomic_t *stop) {
+	int64_t *vars = calloc(s->vars + 1, sizeof(int64_t));
+
+	if (!vars) {
+		perror("ydotool: run");
+		return -1;
+	}
+
+	struct vm *vm = calloc(1, sizeof(struct vm));
+
+	if (!vm) {
+		perror("ydotool: run");
+		free(vars);
+		return -1;
+	}
+
+	vm->yd = yd;
+	vm->key_delay_ms = DEFAULT_KEY_DELAY_MS;
+	vm->key_hold_ms = DEFAULT_KEY_HOLD_MS;
+
+	const char *fail = NULL;
+	uint32_t pc = 0;
+
+// A loaded script is checked, but nothing guarantees its stack use
+#define POP(v)	do { if (!vm->sp) { fail = "stack underflow"; goto out; } (v) = vm->stack[--vm->sp]; } while (0)
+#define PUSH(v)	do { if (vm->sp == SCRIPT_STACK_MAX) { fail = "stack overflow"; goto out; } vm->stack[vm->sp++] = (v); } while (0)
+
+	while (pc < s->code_len && !*stop) {
+		uint8_t op = s->code[pc];
+		const uint8_t *arg = s->code + pc + 1;
+		int64_t a, b, r = 0;
+		int rc = 0;
+
+		pc += insn_len(s->code, s->code_len, pc);
+
+		switch (op) {
+			case OP_HALT:
+				pc = s->code_len;
+				break;
+
+			case OP_PUSH:
+				PUSH((int32_t)get_u32(arg));
+				break;
+
+			case OP_LOAD:
+				PUSH(vars[get_u16(arg)]);
+				break;
+
+			case OP_STORE:
+				POP(vars[get_u16(arg)]);
+				break;
+
+			case OP_NEG:
+				POP(a);
+				PUSH((int64_t)(0 - (uint64_t)a));
+				break;
+
+			case OP_NOT:
+				POP(a);
+				PUSH(!a);
+				break;
+
+			case OP_JMP:
+				pc = get_u32(arg);
+				break;
+
+			case OP_JZ:
+				POP(a);
+
+				if (!a) {
+					pc = get_u32(arg);
+				}
+				break;
+
+			case OP_KEY:
+				rc = vm_keys(vm, arg, true, true);
+				break;
+
+			case OP_KEYDOWN:
+				rc = vm_keys(vm, arg, true, false);
+				break;
+
+			case OP_KEYUP:
+				rc = vm_keys(vm, arg, false, true);
+				break;
+
+			case OP_TYPE:
+				rc = ydotool_type_n(yd, s->strings + get_u32(arg), get_u32(arg + 4),
+						    vm->key_delay_ms, vm->key_hold_ms, NULL);
+				break;
+
+			case OP_TYPE_NUM: {
+				char buf[32];
+
+				POP(a);
+				snprintf(buf, sizeof(buf), "%" PRId64, a);
+
+				rc = ydotool_type(yd, buf, vm->key_delay_ms, vm->key_hold_ms);
+				break;
+			}
+
+			case OP_CLICK:
+				POP(a);
+
+				for (int64_t i=0; i<a && !rc && !*stop; i++) {
+					rc = ydotool_click(yd, arg[0], vm->key_hold_ms) || ydotool_delay_ms(yd, vm->key_delay_ms);
+				}
+				break;
+
+			case OP_MOVE:
+			case OP_MOVETO:
+			case OP_WHEEL:
+				POP(b);
+				POP(a);
+
+				if (op == OP_MOVE) {
+					rc = ydotool_mouse_move(yd, clamp32(a), clamp32(b));
+				} else if (op == OP_MOVETO) {
+					rc = ydotool_mouse_move_to(yd, clamp32(a), clamp32(b));
+				} else {
+					rc = ydotool_wheel(yd, clamp32(a), clamp32(b));
+				}
+				break;
+
+			case OP_WAIT:
+				POP(a);
+				rc = ydotool_delay_ms(yd, delay_ms(a));
+				break;
+
+			case OP_TYPING:
+				POP(b);
+				POP(a);
+				vm->key_delay_ms = delay_ms(a);
+				vm->key_hold_ms = delay_ms(b);
+				break;
+
+			default:
+				POP(b);
+				POP(a);
+
+				if (vm_arith(op, a, b, &r)) {
+					fail = "division by zero";
+					goto out;
+				}
+
+				PUSH(r);
+		}
+
+		if (rc) {
+			fail = strerror(errno);
+			goto out;
+		}
+	}
+
+#undef POP
+#undef PUSH
+
+out:
+	if (fail) {
+		fprintf(stderr, "ydotool: run: %s\n", fail);
+	}
+
+	vm_release_keys(vm);
+
+	free(vm);
+	free(vars);
+
+	return fail ? -1 : 0;
+}
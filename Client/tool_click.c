@@ -117,8 +117,7 @@ int tool_click(int argc, char **argv) {
 
 			case 'h':
 				show_help();
-				exit(0);
-				break;
+				return 0;
 
 			case '?':
 				/* getopt_long already printed an error message. */
@@ -139,17 +138,17 @@ int tool_click(int argc, char **argv) {
 				int keycode = (key & 0xf) | 0x110;
 
 				if (key & 0x40) {
-					uinput_emit(EV_KEY, keycode, 1, 1);
-					usleep(next_delay_ms * 1000);
+					ydotool_button(yd_conn, key & 0xf, 1);
+					ydotool_delay_ms(yd_conn, next_delay_ms);
 				}
 
 				if (key & 0x80) {
-					uinput_emit(EV_KEY, keycode, 0, 1);
-					usleep(next_delay_ms * 1000);
+					ydotool_button(yd_conn, key & 0xf, 0);
+					ydotool_delay_ms(yd_conn, next_delay_ms);
 				}
 
 				if ((key & 0xc0) == 0) {
-					usleep(next_delay_ms * 1000);
+					ydotool_delay_ms(yd_conn, next_delay_ms);
 				}
 
 				printf("%x %x\n", key, keycode);
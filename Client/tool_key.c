@@ -108,8 +108,7 @@ int tool_key(int argc, char **argv) {
 
 			case 'h':
 				show_help();
-				exit(0);
-				break;
+				return 0;
 
 			case '?':
 				/* getopt_long already printed an error message. */
@@ -136,13 +135,13 @@ int tool_key(int argc, char **argv) {
 				char cen = pstr[slen-1];
 
 				if (cen == '0') {
-					uinput_emit(EV_KEY, kc, 0, 1);
+					ydotool_key(yd_conn, kc, 0);
 				} else {
-					uinput_emit(EV_KEY, kc, 1, 1);
+					ydotool_key(yd_conn, kc, 1);
 				}
 			}
 
-			usleep(key_delay * 1000);
+			ydotool_delay_ms(yd_conn, key_delay);
 		}
 	} else {
 		show_help();
@@ -0,0 +1,230 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+#include "ydotool.h"
+#include "protocol.h"
+
+#include <string.h>
+#include <inttypes.h>
+
+static void show_help() {
+	puts(
+		"Usage: latency save FILE\n"
+		"       latency json FILE\n"
+		"Get the latency trace of ydotoold's last frames, and convert it for a viewer.\n"
+		"\n"
+		"save writes the trace of a ydotoold started with --trace to FILE. json prints a\n"
+		"saved trace in the Chrome trace event format, for chrome://tracing or Perfetto:\n"
+		"a row per client, with the time a frame spent in the socket, in the queue, and\n"
+		"in the write() to uinput. The socket only shows for clients that stamp their\n"
+		"frames, run them with YDOTOOL_TRACE=1 in the environment.\n"
+		"\n"
+		"Options:\n"
+		"  -h, --help                 Display this help and exit"
+	);
+}
+
+static int latency_save(const char *path) {
+	daemon_connect();
+
+	FILE *fp = fopen(path, "w");
+
+	if (!fp) {
+		fprintf(stderr, "ydotool: latency: %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	int rc = ydotool_latency_trace(yd_conn, fp);
+	int err = errno;
+
+	if (fclose(fp) && !rc) {
+		rc = -1;
+		err = errno;
+	}
+
+	if (rc) {
+		if (err == ENOTSUP) {
+			fputs("ydotool: latency: the daemon doesn't trace, start it with --trace\n", stderr);
+		} else {
+			fprintf(stderr, "ydotool: latency: %s: %s\n", path, strerror(err));
+		}
+
+		return 1;
+	}
+
+	return 0;
+}
+
+static void span(const char *name, uint16_t client, uint64_t start, uint64_t end, uint64_t base,
+		 const struct ydotool_trace_record *r) {
+	printf(",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+	       "\"args\":{\"frame\":%" PRIu32 ",\"events\":%u}}",
+	       name, client, (start - base) / 1000.0, (end - start) / 1000.0, r->seq, r->events);
+}
+
+static int latency_json(const char *path) {
+	FILE *fp = fopen(path, "r");
+
+	if (!fp) {
+		fprintf(stderr, "ydotool: latency: %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	struct ydotool_trace_header hdr;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != YDOTOOL_TRACE_MAGIC
+	    || hdr.version != YDOTOOL_TRACE_VERSION || hdr.record_size < sizeof(struct ydotool_trace_record)) {
+		fprintf(stderr, "ydotool: latency: %s: not a latency trace\n", path);
+		fclose(fp);
+		return 1;
+	}
+
+	struct ydotool_trace_record *recs = calloc(hdr.count ? hdr.count : 1, sizeof(*recs));
+	uint32_t count = 0;
+
+	if (!recs) {
+		perror("ydotool: latency");
+		fclose(fp);
+		return 1;
+	}
+
+	// Later versions may make the records longer
+	for (; count < hdr.count; count++) {
+		if (fread(&recs[count], sizeof(*recs), 1, fp) != 1
+		    || fseek(fp, hdr.record_size - sizeof(*recs), SEEK_CUR)) {
+			break;
+		}
+	}
+
+	fclose(fp);
+
+	uint64_t base = UINT64_MAX;
+	bool seen[UINT16_MAX + 1] = {false};
+
+	for (uint32_t i=0; i<count; i++) {
+		const struct ydotool_trace_record *r = &recs[i];
+		uint64_t first = r->sent_ns && r->sent_ns < r->received_ns ? r->sent_ns : r->received_ns;
+
+		if (first < base) {
+			base = first;
+		}
+	}
+
+	printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+	       "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"ydotoold\"}}");
+
+	for (uint32_t i=0; i<count; i++) {
+		const struct ydotool_trace_record *r = &recs[i];
+
+		if (!seen[r->client]) {
+			seen[r->client] = true;
+
+			printf(",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", r->client);
+
+			if (r->client == 0) {
+				printf("\"datagram socket\"}}");
+			} else {
+				printf("\"client %u\"}}", r->client);
+			}
+		}
+
+		// A stamp from a clock the daemon doesn't share would come out negative
+		if (r->sent_ns && r->sent_ns <= r->received_ns) {
+			span("socket", r->client, r->sent_ns, r->received_ns, base, r);
+		}
+
+		if (r->write_ns) {
+			span("queue", r->client, r->received_ns, r->write_ns, base, r);
+			span("uinput write", r->client, r->write_ns, r->write_ns + r->write_dur_ns, base, r);
+		}
+	}
+
+	puts("\n]}");
+
+	free(recs);
+
+	return 0;
+}
+
+int tool_latency(int argc, char **argv) {
+	while (1) {
+		int c;
+
+		static struct option long_options[] = {
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		/* getopt_long stores the option index here. */
+		int option_index = 0;
+
+		c = getopt_long (argc, argv, "h",
+				 long_options, &option_index);
+
+		/* Detect the end of the options. */
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'h':
+				show_help();
+				return 0;
+
+			case '?':
+				/* getopt_long already printed an error message. */
+				break;
+
+			default:
+				abort();
+		}
+	}
+
+	if (argc - optind != 2) {
+		show_help();
+		return 1;
+	}
+
+	const char *cmd = argv[optind];
+	const char *path = argv[optind + 1];
+
+	if (strcmp(cmd, "save") == 0) {
+		return latency_save(path);
+	} else if (strcmp(cmd, "json") == 0) {
+		return latency_json(path);
+	}
+
+	fprintf(stderr, "ydotool: latency: unknown subcommand: %s\n", cmd);
+
+	return 1;
+}
@@ -0,0 +1,189 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+#include "ydotool.h"
+
+#include <string.h>
+
+static void show_help() {
+	puts(
+		"Usage: macro define NAME COMMAND [ARGS]...\n"
+		"       macro play NAME...\n"
+		"       macro delete NAME\n"
+		"Keep event sequences in ydotoold and play them by name.\n"
+		"\n"
+		"define runs a ydotool command, e.g. `type', `key' or `shell -f FILE', and stores\n"
+		"the events it makes and their timing in ydotoold under NAME instead of playing\n"
+		"them. play sends just the name, and ydotoold plays the macro with the original\n"
+		"timing, after the macros played before it. Names are up to 31 bytes.\n"
+		"\n"
+		"Options:\n"
+		"  -h, --help                 Display this help and exit\n"
+		"\n"
+		"Start ydotoold with --macros=FILE to keep macros across restarts."
+	);
+}
+
+static int macro_define(int argc, char **argv) {
+	if (argc < 3) {
+		show_help();
+		return 1;
+	}
+
+	tool_main_fn tool_main = tool_find(argv[2]);
+
+	if (!tool_main) {
+		fprintf(stderr, "ydotool: macro: unknown command: %s\n", argv[2]);
+		return 1;
+	}
+
+	if (tool_main == tool_macro || tool_main == tool_stdin || tool_main == tool_record) {
+		fprintf(stderr, "ydotool: macro: %s can't be stored in a macro\n", argv[2]);
+		return 1;
+	}
+
+	if (ydotool_macro_begin(yd_conn, argv[1])) {
+		fprintf(stderr, "ydotool: macro: %s: %s\n", argv[1],
+			errno == EBUSY ? "can't be used with --ring" : strerror(errno));
+		return 1;
+	}
+
+	// Reinitialize getopt for the command
+	optind = 0;
+
+	int rc = tool_main(argc - 2, argv + 2);
+
+	if (ydotool_macro_end(yd_conn)) {
+		if (errno == ENOTSUP) {
+			fputs("ydotool: macro: the daemon doesn't keep macros, please update ydotoold\n", stderr);
+		} else {
+			fprintf(stderr, "ydotool: macro: %s: %s\n", argv[1], strerror(errno));
+		}
+
+		return 1;
+	}
+
+	return rc;
+}
+
+static int macro_play(int argc, char **argv) {
+	for (int i=1; i<argc; i++) {
+		if (ydotool_macro_play(yd_conn, argv[i])) {
+			if (errno == ENOTSUP) {
+				fputs("ydotool: macro: the daemon doesn't keep macros, please update ydotoold\n", stderr);
+			} else {
+				fprintf(stderr, "ydotool: macro: %s: %s\n", argv[i],
+					errno == ENOENT ? "no such macro" : strerror(errno));
+			}
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Defining a macro without events deletes it
+static int macro_delete(int argc, char **argv) {
+	if (argc != 2) {
+		show_help();
+		return 1;
+	}
+
+	if (ydotool_macro_begin(yd_conn, argv[1]) || ydotool_macro_end(yd_conn)) {
+		fprintf(stderr, "ydotool: macro: %s: %s\n", argv[1],
+			errno == ENOENT ? "no such macro" : strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+int tool_macro(int argc, char **argv) {
+	while (1) {
+		int c;
+
+		static struct option long_options[] = {
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		/* getopt_long stores the option index here. */
+		int option_index = 0;
+
+		// Stop at the subcommand, the rest may belong to another command
+		c = getopt_long (argc, argv, "+h",
+				 long_options, &option_index);
+
+		/* Detect the end of the options. */
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'h':
+				show_help();
+				return 0;
+
+			case '?':
+				/* getopt_long already printed an error message. */
+				break;
+
+			default:
+				abort();
+		}
+	}
+
+	if (argc - optind < 2) {
+		show_help();
+		return 1;
+	}
+
+	const char *cmd = argv[optind];
+
+	argc -= optind;
+	argv += optind;
+
+	if (strcmp(cmd, "define") == 0) {
+		return macro_define(argc, argv);
+	} else if (strcmp(cmd, "play") == 0) {
+		return macro_play(argc, argv);
+	} else if (strcmp(cmd, "delete") == 0) {
+		return macro_delete(argc, argv);
+	}
+
+	fprintf(stderr, "ydotool: macro: unknown subcommand: %s\n", cmd);
+
+	return 1;
+}
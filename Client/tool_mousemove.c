@@ -36,6 +36,10 @@
 
 #include "ydotool.h"
 
+#include <string.h>
+
+#define DEFAULT_RATE_HZ		125
+
 static void show_help() {
 	puts(
 		"Usage: mousemove [OPTION]... [-x <xpos> -y <ypos>] [-- <xpos> <ypos>]\n"
@@ -46,12 +50,40 @@ static void show_help() {
 		"  -a, --absolute             Use absolute position, not applicable to wheel\n"
 		"  -x, --xpos                 X position\n"
 		"  -y, --ypos                 Y position\n"
+		"  -d, --duration=MS          Glide there in MS milliseconds instead of jumping\n"
+		"  -r, --rate=HZ              Steps per second of a glide (default: 125)\n"
+		"  -c, --curve=CURVE          Speed profile of a glide: linear (default),\n"
+		"                               ease-in-out, or bezier:X1,Y1,X2,Y2\n"
 		"  -h, --help                 Display this help and exit\n"
 		"\n"
-		"You need to disable mouse speed acceleration for correct absolute movement."
+		"For correct absolute movement, start ydotoold with --absolute, or disable\n"
+		"mouse speed acceleration.\n"
+		"Glides are relative moves, use --spin for accurate steps at high rates."
 	);
 }
 
+// linear, ease-in-out, or bezier:X1,Y1,X2,Y2
+static int parse_curve(const char *spec, struct ydotool_curve *curve) {
+	memset(curve, 0, sizeof(*curve));
+
+	if (strcmp(spec, "linear") == 0) {
+		curve->type = YDOTOOL_CURVE_LINEAR;
+	} else if (strcmp(spec, "ease-in-out") == 0) {
+		curve->type = YDOTOOL_CURVE_EASE_IN_OUT;
+	} else if (strncmp(spec, "bezier:", 7) == 0) {
+		curve->type = YDOTOOL_CURVE_BEZIER;
+
+		if (sscanf(spec + 7, "%lf,%lf,%lf,%lf", &curve->x1, &curve->y1, &curve->x2, &curve->y2) != 4
+		    || curve->x1 < 0 || curve->x1 > 1 || curve->x2 < 0 || curve->x2 > 1) {
+			return -1;
+		}
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
 int tool_mousemove(int argc, char **argv) {
 	if (argc < 2) {
 		show_help();
@@ -61,6 +93,10 @@ int tool_mousemove(int argc, char **argv) {
 	int is_abs = 0;
 	int is_wheel = 0;
 
+	int duration_ms = 0;
+	int rate_hz = DEFAULT_RATE_HZ;
+	struct ydotool_curve curve = {.type = YDOTOOL_CURVE_LINEAR};
+
 	int i = 0;
 	int32_t pos[2] = {0, 0};
 
@@ -73,12 +109,15 @@ int tool_mousemove(int argc, char **argv) {
 			{"wheel", no_argument, 0, 'w'},
 			{"xpos", required_argument, 0, 'x'},
 			{"ypos", required_argument, 0, 'y'},
+			{"duration", required_argument, 0, 'd'},
+			{"rate", required_argument, 0, 'r'},
+			{"curve", required_argument, 0, 'c'},
 			{0, 0, 0, 0}
 		};
 		/* getopt_long stores the option index here. */
 		int option_index = 0;
 
-		c = getopt_long (argc, argv, "hawx:y:",
+		c = getopt_long (argc, argv, "hawx:y:d:r:c:",
 				 long_options, &option_index);
 
 		/* Detect the end of the options. */
@@ -115,6 +154,21 @@ int tool_mousemove(int argc, char **argv) {
 				i++;
 				break;
 
+			case 'd':
+				duration_ms = strtol(optarg, NULL, 10);
+				break;
+
+			case 'r':
+				rate_hz = strtol(optarg, NULL, 10);
+				break;
+
+			case 'c':
+				if (parse_curve(optarg, &curve)) {
+					printf("Invalid curve: %s\n", optarg);
+					return 1;
+				}
+				break;
+
 			case '?':
 				/* getopt_long already printed an error message. */
 				break;
@@ -139,17 +193,24 @@ int tool_mousemove(int argc, char **argv) {
 			return 1;
 		}
 
-		if (is_abs) {
-			uinput_emit(EV_REL, REL_X, INT32_MIN, 0);
-			uinput_emit(EV_REL, REL_Y, INT32_MIN, 1);
+		if (duration_ms > 0 && (is_abs || is_wheel)) {
+			puts("Only relative mouse moves can glide");
+			return 1;
+		}
+
+		if (rate_hz <= 0) {
+			puts("Rate must be positive");
+			return 1;
 		}
 
 		if (is_wheel) {
-			uinput_emit(EV_REL, REL_HWHEEL, pos[0], 0);
-			uinput_emit(EV_REL, REL_WHEEL, pos[1], 1);
+			ydotool_wheel(yd_conn, pos[0], pos[1]);
+		} else if (duration_ms > 0) {
+			ydotool_mouse_path(yd_conn, pos[0], pos[1], duration_ms, rate_hz, &curve);
+		} else if (is_abs) {
+			ydotool_mouse_move_to(yd_conn, pos[0], pos[1]);
 		} else {
-			uinput_emit(EV_REL, REL_X, pos[0], 0);
-			uinput_emit(EV_REL, REL_Y, pos[1], 1);
+			ydotool_mouse_move(yd_conn, pos[0], pos[1]);
 		}
 	} else {
 		show_help();
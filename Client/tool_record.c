@@ -0,0 +1,341 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+#include "ydotool.h"
+#include "trace.h"
+
+#include <inttypes.h>
+#include <poll.h>
+#include <string.h>
+
+#define MAX_DEVICES	32
+
+// Events of one device kept until its SYN_REPORT
+#define FRAME_MAX	64
+
+struct device {
+	const char *path;
+	int fd;
+	bool dropped;
+	int len;
+	struct input_event frame[FRAME_MAX];
+};
+
+static volatile sig_atomic_t stop = 0;
+
+static void show_help() {
+	puts(
+		"Usage: record [OPTION]... FILE DEVICE...\n"
+		"Record the events of input devices (/dev/input/eventN) to FILE, or to the standard\n"
+		"output if FILE is -, until interrupted. Use `ydotool replay' to play them back.\n"
+		"Key, relative and absolute events are kept, key autorepeat is left to the compositor.\n"
+		"\n"
+		"Options:\n"
+		"  -t, --time=SECONDS         Stop after SECONDS\n"
+		"  -h, --help                 Display this help and exit\n"
+		"\n"
+		"ydotoold doesn't need to be running."
+	);
+}
+
+static void handle_signal(int sig) {
+	stop = 1;
+}
+
+static uint64_t event_us(const struct input_event *ev) {
+	return (uint64_t)ev->input_event_sec * 1000000 + ev->input_event_usec;
+}
+
+static int frame_write(struct trace_writer *w, struct device *dev) {
+	for (int i = 0; i < dev->len; i++) {
+		struct input_event *ev = &dev->frame[i];
+
+		if (trace_write(w, event_us(ev), ev->type, ev->code, ev->value)) {
+			return -1;
+		}
+	}
+
+	dev->len = 0;
+
+	return 0;
+}
+
+static int device_event(struct trace_writer *w, struct device *dev, const struct input_event *ev) {
+	switch (ev->type) {
+		case EV_SYN:
+			if (ev->code == SYN_DROPPED) {
+				// The kernel buffer overflowed, the frame is incomplete up to the next report
+				dev->dropped = true;
+				dev->len = 0;
+				return 0;
+			}
+
+			if (ev->code != SYN_REPORT) {
+				return 0;
+			}
+
+			if (dev->dropped) {
+				dev->dropped = false;
+				dev->len = 0;
+				return 0;
+			}
+
+			if (!dev->len) {
+				return 0;
+			}
+
+			break;
+
+		case EV_KEY:
+			if (ev->value == 2) {
+				return 0;
+			}
+
+			break;
+
+		case EV_REL:
+		case EV_ABS:
+			break;
+
+		default:
+			return 0;
+	}
+
+	if (dev->dropped) {
+		return 0;
+	}
+
+	// Unusually large frames go out in pieces, the replay only sends at the report
+	if (dev->len == FRAME_MAX && frame_write(w, dev)) {
+		return -1;
+	}
+
+	dev->frame[dev->len++] = *ev;
+
+	if (ev->type == EV_SYN) {
+		return frame_write(w, dev);
+	}
+
+	return 0;
+}
+
+int tool_record(int argc, char **argv) {
+	int time_s = 0;
+
+	while (1) {
+		int c;
+
+		static struct option long_options[] = {
+			{"time", required_argument, 0, 't'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		/* getopt_long stores the option index here. */
+		int option_index = 0;
+
+		c = getopt_long (argc, argv, "ht:",
+				 long_options, &option_index);
+
+		/* Detect the end of the options. */
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 't':
+				time_s = strtol(optarg, NULL, 10);
+				break;
+
+			case 'h':
+				show_help();
+				return 0;
+
+			case '?':
+				/* getopt_long already printed an error message. */
+				break;
+
+			default:
+				abort();
+		}
+	}
+
+	int dev_count = argc - optind - 1;
+
+	if (dev_count < 1) {
+		show_help();
+		return 1;
+	}
+
+	if (dev_count > MAX_DEVICES) {
+		fprintf(stderr, "ydotool: record: at most %d devices\n", MAX_DEVICES);
+		return 1;
+	}
+
+	const char *out_path = argv[optind];
+	static struct device devs[MAX_DEVICES];
+	struct pollfd pfds[MAX_DEVICES];
+
+	for (int i = 0; i < dev_count; i++) {
+		struct device *dev = &devs[i];
+
+		dev->path = argv[optind + 1 + i];
+		dev->fd = open(dev->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+		if (dev->fd < 0) {
+			fprintf(stderr, "ydotool: record: %s: %s\n", dev->path, strerror(errno));
+			return 1;
+		}
+
+		// All devices on one clock that doesn't jump, the default is the wall clock
+		int clock = CLOCK_MONOTONIC;
+		ioctl(dev->fd, EVIOCSCLOCKID, &clock);
+
+		pfds[i] = (struct pollfd) {
+			.fd = dev->fd,
+			.events = POLLIN
+		};
+	}
+
+	FILE *fp = strcmp(out_path, "-") == 0 ? stdout : fopen(out_path, "w");
+
+	if (!fp) {
+		fprintf(stderr, "ydotool: record: %s: %s\n", out_path, strerror(errno));
+		return 1;
+	}
+
+	struct trace_writer w;
+
+	if (trace_writer_init(&w, fp)) {
+		fprintf(stderr, "ydotool: record: %s: %s\n", out_path, strerror(errno));
+		return 1;
+	}
+
+	// No SA_RESTART, poll() has to return
+	struct sigaction sa = {
+		.sa_handler = handle_signal
+	};
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	int rc = 0;
+	bool write_failed = false;
+	int open_count = dev_count;
+
+	while (!stop && open_count) {
+		int timeout_ms = -1;
+
+		if (time_s > 0) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+
+			int64_t left_ms = (int64_t)time_s * 1000 - ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+
+			if (left_ms <= 0) {
+				break;
+			}
+
+			timeout_ms = left_ms;
+		}
+
+		if (poll(pfds, dev_count, timeout_ms) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			perror("ydotool: record: poll");
+			rc = 1;
+			break;
+		}
+
+		for (int i = 0; i < dev_count; i++) {
+			if (!pfds[i].revents) {
+				continue;
+			}
+
+			struct input_event buf[64];
+			ssize_t len = read(devs[i].fd, buf, sizeof(buf));
+
+			if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+				continue;
+			}
+
+			if (len <= 0) {
+				// Unplugged
+				fprintf(stderr, "ydotool: record: %s: %s\n", devs[i].path, len ? strerror(errno) : "end of file");
+				close(devs[i].fd);
+				pfds[i].fd = -1;
+				open_count--;
+				continue;
+			}
+
+			for (int j = 0; j < len / sizeof(struct input_event); j++) {
+				if (device_event(&w, &devs[i], &buf[j])) {
+					write_failed = true;
+					break;
+				}
+			}
+		}
+
+		// Keep a pipe reader up to date
+		if (write_failed || fflush(fp)) {
+			write_failed = true;
+			break;
+		}
+	}
+
+	if (fp != stdout ? fclose(fp) : fflush(fp)) {
+		write_failed = true;
+	}
+
+	if (write_failed) {
+		rc = 1;
+		fprintf(stderr, "ydotool: record: %s: %s\n", out_path, strerror(errno));
+	}
+
+	fprintf(stderr, "Recorded %" PRIu64 " events in %" PRIu64 " bytes (%.1f bytes per event)\n",
+		w.events, w.bytes, w.events ? (double)w.bytes / w.events : 0.0);
+
+	for (int i = 0; i < dev_count; i++) {
+		if (pfds[i].fd >= 0) {
+			close(pfds[i].fd);
+		}
+	}
+
+	return rc;
+}
@@ -0,0 +1,256 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+#include "ydotool.h"
+#include "trace.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+// Played pages are dropped every so often, so long traces don't pile up in memory
+#define RELEASE_BYTES	(1 << 20)
+
+static volatile sig_atomic_t stop = 0;
+
+static uint8_t keys_down[KEY_CNT / 8];
+
+static void show_help() {
+	puts(
+		"Usage: replay [OPTION]... FILE\n"
+		"Play back a trace written by `ydotool record' with its original timing.\n"
+		"\n"
+		"Options:\n"
+		"  -s, --speed=X              Play X times as fast, e.g. 0.5 or 2; 0 sends the events\n"
+		"                               as fast as ydotoold takes them (default: 1)\n"
+		"  -l, --loop=N               Play N times, 0 to repeat until interrupted (default: 1)\n"
+		"  -h, --help                 Display this help and exit\n"
+		"\n"
+		"Keys still down when the trace ends or the replay is interrupted are released.\n"
+		"With `ydotool --timed replay' the whole trace is sent at once and ydotoold keeps\n"
+		"the timing."
+	);
+}
+
+static void handle_signal(int sig) {
+	stop = 1;
+}
+
+static int replay_event(const struct trace_event *ev) {
+	switch (ev->type) {
+		case EV_SYN:
+			return ev->code == SYN_REPORT ? ydotool_frame_flush(yd_conn) : 0;
+
+		case EV_KEY:
+			if (ev->code >= KEY_CNT) {
+				return 0;
+			}
+
+			if (ev->value) {
+				keys_down[ev->code / 8] |= 1 << (ev->code % 8);
+			} else {
+				keys_down[ev->code / 8] &= ~(1 << (ev->code % 8));
+			}
+
+			return ydotool_frame_add(yd_conn, ev->type, ev->code, ev->value);
+
+		case EV_REL:
+		case EV_ABS:
+			return ydotool_frame_add(yd_conn, ev->type, ev->code, ev->value);
+	}
+
+	return 0;
+}
+
+static void release_keys() {
+	ydotool_frame_flush(yd_conn);
+
+	for (int code = 0; code < KEY_CNT; code++) {
+		if (keys_down[code / 8] & (1 << (code % 8))) {
+			ydotool_frame_add(yd_conn, EV_KEY, code, 0);
+		}
+	}
+
+	ydotool_frame_flush(yd_conn);
+}
+
+int tool_replay(int argc, char **argv) {
+	double speed = 1;
+	long loops = 1;
+
+	while (1) {
+		int c;
+
+		static struct option long_options[] = {
+			{"speed", required_argument, 0, 's'},
+			{"loop", required_argument, 0, 'l'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		/* getopt_long stores the option index here. */
+		int option_index = 0;
+
+		c = getopt_long (argc, argv, "hs:l:",
+				 long_options, &option_index);
+
+		/* Detect the end of the options. */
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 's':
+				speed = strtod(optarg, NULL);
+				break;
+
+			case 'l':
+				loops = strtol(optarg, NULL, 10);
+				break;
+
+			case 'h':
+				show_help();
+				return 0;
+
+			case '?':
+				/* getopt_long already printed an error message. */
+				break;
+
+			default:
+				abort();
+		}
+	}
+
+	if (optind != argc - 1) {
+		show_help();
+		return 1;
+	}
+
+	if (!(speed >= 0) || loops < 0) {
+		fputs("ydotool: replay: the speed and the loop count can't be negative\n", stderr);
+		return 1;
+	}
+
+	const char *path = argv[optind];
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+
+	if (fd < 0 || fstat(fd, &st)) {
+		fprintf(stderr, "ydotool: replay: %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	if (!S_ISREG(st.st_mode)) {
+		fprintf(stderr, "ydotool: replay: %s: not a regular file\n", path);
+		return 1;
+	}
+
+	size_t len = st.st_size;
+	uint8_t *map = len ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+
+	close(fd);
+
+	struct trace_reader r;
+
+	if (map == MAP_FAILED || trace_reader_init(&r, map, len)) {
+		fprintf(stderr, "ydotool: replay: %s: %s\n", path, map == MAP_FAILED ? strerror(errno) : "not a ydotool trace");
+		return 1;
+	}
+
+	madvise(map, len, MADV_SEQUENTIAL);
+
+	struct sigaction sa = {
+		.sa_handler = handle_signal
+	};
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	// If we are killed, the daemon releases what the trace holds down
+	ydotool_set_release_on_close(yd_conn, true);
+
+	int rc = 0;
+
+	for (long loop = 0; !stop && (!loops || loop < loops); loop++) {
+		// Trace time is scaled as a whole, rounding doesn't add up over long traces
+		uint64_t trace_us = 0;
+		uint64_t played_us = 0;
+		size_t released = 0;
+
+		trace_reader_rewind(&r);
+
+		struct trace_event ev;
+		int got = 0;
+
+		while (!stop && (got = trace_read(&r, &ev)) > 0) {
+			if (ev.delta_us && speed > 0) {
+				trace_us += ev.delta_us;
+
+				uint64_t due_us = trace_us / speed;
+
+				if (due_us > played_us) {
+					ydotool_delay_us(yd_conn, due_us - played_us);
+					played_us = due_us;
+				}
+			}
+
+			if (replay_event(&ev) && errno != EAGAIN) {
+				perror("ydotool: replay");
+				stop = 1;
+				rc = 1;
+				break;
+			}
+
+			size_t done = (r.pos - map) & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+
+			if (done - released >= RELEASE_BYTES) {
+				madvise(map + released, done - released, MADV_DONTNEED);
+				released = done;
+			}
+		}
+
+		if (got < 0) {
+			fprintf(stderr, "ydotool: replay: %s: broken trace at byte %td\n", path, r.pos - map);
+			rc = 1;
+			break;
+		}
+	}
+
+	release_keys();
+
+	ydotool_set_release_on_close(yd_conn, false);
+
+	munmap(map, len);
+
+	return rc;
+}
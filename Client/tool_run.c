@@ -0,0 +1,257 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+#include "ydotool.h"
+#include "script.h"
+
+#include <string.h>
+
+static volatile sig_atomic_t stop = 0;
+
+static void show_help() {
+	puts(
+		"Usage: run [OPTION]... SCRIPT\n"
+		"Run an input script, or the bytecode compiled from one, in this process over one\n"
+		"connection to ydotoold.\n"
+		"\n"
+		"Options:\n"
+		"  -c, --compile              Compile SCRIPT and save the bytecode instead of running it,\n"
+		"                               so later runs skip the parser\n"
+		"  -o, --output=FILE          Where --compile saves it (default: SCRIPT with its\n"
+		"                               extension replaced by .ydc)\n"
+		"  -h, --help                 Display this help and exit\n"
+		"\n"
+		"Script example:\n"
+		"  # Open a terminal and list the first 3 files\n"
+		"  key super+enter\n"
+		"  wait 500\n"
+		"  i = 1\n"
+		"  repeat 3\n"
+		"    type \"ls | sed -n \", i, \"p\\n\"\n"
+		"    i = i + 1\n"
+		"  end\n"
+		"\n"
+		"See ydotool(1) for the statements."
+	);
+}
+
+static void handle_signal(int sig) {
+	stop = 1;
+}
+
+static char *file_read(const char *path, size_t *len) {
+	FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+
+	if (!fp) {
+		return NULL;
+	}
+
+	char *buf = NULL;
+	size_t cap = 0;
+
+	*len = 0;
+
+	while (1) {
+		if (*len == cap) {
+			cap = cap ? cap * 2 : 4096;
+
+			char *nbuf = realloc(buf, cap);
+
+			if (!nbuf) {
+				free(buf);
+				buf = NULL;
+				break;
+			}
+
+			buf = nbuf;
+		}
+
+		size_t n = fread(buf + *len, 1, cap - *len, fp);
+
+		*len += n;
+
+		if (n == 0) {
+			if (ferror(fp)) {
+				free(buf);
+				buf = NULL;
+			}
+			break;
+		}
+	}
+
+	if (fp != stdin) {
+		fclose(fp);
+	}
+
+	return buf;
+}
+
+// SCRIPT with its extension replaced by .ydc
+static void output_path(const char *path, char *buf, size_t len) {
+	const char *slash = strrchr(path, '/');
+	const char *dot = strrchr(path, '.');
+	int base_len = dot && (!slash || dot > slash + 1) ? dot - path : strlen(path);
+
+	snprintf(buf, len, "%.*s.ydc", base_len, path);
+}
+
+int tool_run(int argc, char **argv) {
+	bool compile = false;
+	const char *out_path = NULL;
+
+	while (1) {
+		int c;
+
+		static struct option long_options[] = {
+			{"compile", no_argument, 0, 'c'},
+			{"output", required_argument, 0, 'o'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		/* getopt_long stores the option index here. */
+		int option_index = 0;
+
+		c = getopt_long (argc, argv, "hco:",
+				 long_options, &option_index);
+
+		/* Detect the end of the options. */
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'c':
+				compile = true;
+				break;
+
+			case 'o':
+				out_path = optarg;
+				break;
+
+			case 'h':
+				show_help();
+				return 0;
+
+			case '?':
+				/* getopt_long already printed an error message. */
+				break;
+
+			default:
+				abort();
+		}
+	}
+
+	if (optind != argc - 1) {
+		show_help();
+		return 1;
+	}
+
+	const char *path = argv[optind];
+	size_t len;
+	char *src = file_read(path, &len);
+
+	if (!src) {
+		fprintf(stderr, "ydotool: run: %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	struct script script;
+	int rc;
+
+	if (script_is_bytecode(src, len)) {
+		rc = script_load(src, len, &script);
+
+		if (rc) {
+			fprintf(stderr, "ydotool: run: %s: %s\n", path,
+				errno == EBADMSG ? "damaged bytecode, or from another version of ydotool" : strerror(errno));
+		}
+	} else {
+		rc = script_compile(src, len, path, &script);
+	}
+
+	free(src);
+
+	if (rc) {
+		return 1;
+	}
+
+	if (compile) {
+		char buf[PATH_MAX];
+
+		if (!out_path) {
+			if (strcmp(path, "-") == 0) {
+				fputs("ydotool: run: --compile needs --output when reading stdin\n", stderr);
+				script_free(&script);
+				return 1;
+			}
+
+			output_path(path, buf, sizeof(buf));
+			out_path = buf;
+		}
+
+		rc = script_save(&script, out_path);
+
+		if (rc) {
+			fprintf(stderr, "ydotool: run: %s: %s\n", out_path, strerror(errno));
+		}
+
+		script_free(&script);
+
+		return rc ? 1 : 0;
+	}
+
+	// Inside shell or macro define the connection is there already
+	if (!yd_conn) {
+		daemon_connect();
+	}
+
+	struct sigaction sa = {
+		.sa_handler = handle_signal
+	};
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	// The script releases its keys when it ends or is stopped, the daemon does if we are killed
+	ydotool_set_release_on_close(yd_conn, true);
+
+	rc = script_run(&script, yd_conn, &stop);
+
+	ydotool_set_release_on_close(yd_conn, false);
+
+	script_free(&script);
+
+	return rc ? 1 : 0;
+}
@@ -0,0 +1,313 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+#include "ydotool.h"
+#include <string.h>
+
+#define SHELL_LINE_MAX		4096
+#define SHELL_ARGS_MAX		256
+
+static void show_help() {
+	puts(
+		"Usage: shell [OPTION]...\n"
+		"Run commands read line by line, in this process and over one daemon connection.\n"
+		"\n"
+		"Options:\n"
+		"  -f, --file=PATH            Read commands from a file instead of stdin\n"
+		"  -q, --quiet                Don't report how long each command took\n"
+		"  -h, --help                 Display this help and exit\n"
+		"\n"
+		"Each line is a command with the same syntax as on the command line, e.g.:\n"
+		"  key 29:1 46:1 46:0 29:0\n"
+		"  mousemove -x 10 -y 10\n"
+		"  type 'Hello world'\n"
+		"  sleep 100\n"
+		"Words are split on whitespace. Single quotes keep everything literally,\n"
+		"in double quotes \\\" and \\\\ are escapes. `sleep MS' waits MS milliseconds.\n"
+		"Empty lines and lines starting with '#' are ignored."
+	);
+}
+
+/*
+    Split a line into words in place. Returns the number of words, or -1 on
+    an unterminated quote.
+*/
+static int split_line(char *line, char **args, int max_args) {
+	int argc = 0;
+	char *in = line;
+
+	while (1) {
+		while (*in == ' ' || *in == '\t' || *in == '\n' || *in == '\r') {
+			in++;
+		}
+
+		if (*in == 0) {
+			break;
+		}
+
+		if (argc == max_args - 1) {
+			return -1;
+		}
+
+		char *out = in;
+		args[argc++] = out;
+
+		char quote = 0;
+
+		while (*in) {
+			char c = *in++;
+
+			if (quote == '\'') {
+				if (c == '\'') {
+					quote = 0;
+				} else {
+					*out++ = c;
+				}
+			} else if (quote == '"') {
+				if (c == '"') {
+					quote = 0;
+				} else if (c == '\\' && (*in == '"' || *in == '\\')) {
+					*out++ = *in++;
+				} else {
+					*out++ = c;
+				}
+			} else if (c == '\'' || c == '"') {
+				quote = c;
+			} else if (c == '\\' && *in) {
+				*out++ = *in++;
+			} else if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+				break;
+			} else {
+				*out++ = c;
+			}
+		}
+
+		if (quote) {
+			return -1;
+		}
+
+		// May overwrite the separator we just consumed, never unread input
+		*out = 0;
+	}
+
+	args[argc] = NULL;
+
+	return argc;
+}
+
+static uint64_t now_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int run_command(int argc, char **argv) {
+	if (strcmp(argv[0], "sleep") == 0) {
+		if (argc != 2) {
+			puts("Usage: sleep MS");
+			return 1;
+		}
+
+		ydotool_delay_ms(yd_conn, strtol(argv[1], NULL, 10));
+		return 0;
+	}
+
+	tool_main_fn tool_main = tool_find(argv[0]);
+
+	if (!tool_main) {
+		printf("ydotool: shell: unknown command: %s\n", argv[0]);
+		return 1;
+	}
+
+	if (tool_main == tool_shell || tool_main == tool_stdin) {
+		printf("ydotool: shell: %s can't be used in a shell\n", argv[0]);
+		return 1;
+	}
+
+	// Reinitialize getopt, the previous command may have left it anywhere
+	optind = 0;
+
+	int rc = tool_main(argc, argv);
+
+	ydotool_frame_flush(yd_conn);
+
+	return rc;
+}
+
+int tool_shell(int argc, char **argv) {
+	const char *file_path = NULL;
+	bool quiet = false;
+
+	while (1) {
+		int c;
+
+		static struct option long_options[] = {
+			{"file", required_argument, 0, 'f'},
+			{"quiet", no_argument, 0, 'q'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		/* getopt_long stores the option index here. */
+		int option_index = 0;
+
+		c = getopt_long (argc, argv, "hf:q",
+				 long_options, &option_index);
+
+		/* Detect the end of the options. */
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'f':
+				file_path = optarg;
+				break;
+
+			case 'q':
+				quiet = true;
+				break;
+
+			case 'h':
+				show_help();
+				return 0;
+
+			case '?':
+				/* getopt_long already printed an error message. */
+				break;
+
+			default:
+				abort();
+		}
+	}
+
+	FILE *fp = stdin;
+
+	if (file_path && strcmp(file_path, "-") != 0) {
+		fp = fopen(file_path, "r");
+
+		if (!fp) {
+			fprintf(stderr, "ydotool: shell: error: failed to open %s: %s\n", file_path,
+				strerror(errno));
+			return 2;
+		}
+	}
+
+	bool interactive = isatty(fileno(fp));
+
+	static char line[SHELL_LINE_MAX];
+	static char *args[SHELL_ARGS_MAX];
+
+	int line_no = 0;
+	int commands = 0;
+	int failures = 0;
+	uint64_t total_ns = 0;
+
+	while (1) {
+		if (interactive) {
+			fputs("ydotool> ", stdout);
+			fflush(stdout);
+		}
+
+		if (!fgets(line, sizeof(line), fp)) {
+			break;
+		}
+
+		line_no++;
+
+		size_t len = strlen(line);
+
+		if (len == sizeof(line) - 1 && line[len-1] != '\n') {
+			fprintf(stderr, "ydotool: shell: line %d: line too long\n", line_no);
+			failures++;
+
+			// Skip the rest of it
+			int ch;
+			while ((ch = fgetc(fp)) != EOF && ch != '\n');
+			continue;
+		}
+
+		char *p = line;
+		while (*p == ' ' || *p == '\t') {
+			p++;
+		}
+
+		if (*p == '#') {
+			continue;
+		}
+
+		int cmd_argc = split_line(line, args, SHELL_ARGS_MAX);
+
+		if (cmd_argc < 0) {
+			fprintf(stderr, "ydotool: shell: line %d: unterminated quote or too many words\n", line_no);
+			failures++;
+			continue;
+		}
+
+		if (cmd_argc == 0) {
+			continue;
+		}
+
+		// Delays of this command are paced from now, not from the previous one
+		ydotool_pacing_restart(yd_conn);
+
+		uint64_t t_start = now_ns();
+		int rc = run_command(cmd_argc, args);
+		uint64_t elapsed = now_ns() - t_start;
+
+		commands++;
+		total_ns += elapsed;
+
+		if (rc) {
+			failures++;
+		}
+
+		if (!quiet) {
+			fprintf(stderr, "line %d: %s: %.3f ms%s\n", line_no, args[0], elapsed / 1e6,
+				rc ? " (failed)" : "");
+		}
+	}
+
+	if (fp != stdin) {
+		fclose(fp);
+	}
+
+	if (!quiet) {
+		fprintf(stderr, "%d commands, %d failed, %.3f ms total\n", commands, failures, total_ns / 1e6);
+	}
+
+	return failures ? 1 : 0;
+}
@@ -107,21 +107,23 @@ int tool_stdin(int argc, char **argv) {
 		// Emit key events
 		if (isUppercase) {
 		printf("  Sending shift\n");
-			uinput_emit(EV_KEY, KEY_LEFTSHIFT, 1, 1); // Press shift for uppercase
+			ydotool_frame_add(yd_conn, EV_KEY, KEY_LEFTSHIFT, 1); // Press shift for uppercase
 		}
 		if (isCtrl) {
 			printf("  Sending ctrl\n");
-			uinput_emit(EV_KEY, KEY_LEFTCTRL, 1, 1); // Press ctrl
+			ydotool_frame_add(yd_conn, EV_KEY, KEY_LEFTCTRL, 1); // Press ctrl
 			}
-			uinput_emit(EV_KEY, kc, 1, 1); // Key down
+			ydotool_frame_add(yd_conn, EV_KEY, kc, 1); // Key down
+			ydotool_frame_flush(yd_conn);
 			usleep(opt_key_hold_ms * 1000); // Hold key
-			uinput_emit(EV_KEY, kc, 0, 1); // Key up
+			ydotool_frame_add(yd_conn, EV_KEY, kc, 0); // Key up
 		if (isCtrl) {
-			uinput_emit(EV_KEY, KEY_LEFTCTRL, 0, 1); // Release ctrl
+			ydotool_frame_add(yd_conn, EV_KEY, KEY_LEFTCTRL, 0); // Release ctrl
 		}
 		if (isUppercase) {
-			uinput_emit(EV_KEY, KEY_LEFTSHIFT, 0, 1); // Release shift for uppercase
+			ydotool_frame_add(yd_conn, EV_KEY, KEY_LEFTSHIFT, 0); // Release shift for uppercase
 		}
+		ydotool_frame_flush(yd_conn);
 
 		usleep(opt_key_delay_ms * 1000); // Delay between keys
     }
@@ -35,47 +35,40 @@
 */
 
 #include "ydotool.h"
+#include <inttypes.h>
+#include <limits.h>
 #include <string.h>
 
-#define FLAG_UPPERCASE		0x80000000
-
-static const int32_t ascii2keycode_map[128] = {
-	// 00 - 0f
-	-1,-1,-1,-1,-1,-1,-1,-1,
-	-1,KEY_TAB,KEY_ENTER,-1,-1,-1,-1,-1,
-
-	// 10 - 1f
-	-1,-1,-1,-1,-1,-1,-1,-1,
-	-1,-1,-1,-1,-1,-1,-1,-1,
-
-	// 20 - 2f
-	KEY_SPACE,KEY_1|FLAG_UPPERCASE,KEY_APOSTROPHE|FLAG_UPPERCASE,KEY_3|FLAG_UPPERCASE,KEY_4|FLAG_UPPERCASE,KEY_5|FLAG_UPPERCASE,KEY_7|FLAG_UPPERCASE,KEY_APOSTROPHE,
-	KEY_9|FLAG_UPPERCASE,KEY_0|FLAG_UPPERCASE,KEY_8|FLAG_UPPERCASE,KEY_EQUAL|FLAG_UPPERCASE,KEY_COMMA,KEY_MINUS,KEY_DOT,KEY_SLASH,
-
-	// 30 - 3f
-	KEY_0,KEY_1,KEY_2,KEY_3,KEY_4,KEY_5,KEY_6,KEY_7,
-	KEY_8,KEY_9,KEY_SEMICOLON|FLAG_UPPERCASE,KEY_SEMICOLON,KEY_COMMA|FLAG_UPPERCASE,KEY_EQUAL,KEY_DOT|FLAG_UPPERCASE,KEY_SLASH|FLAG_UPPERCASE,
-
-	// 40 - 4f
-	KEY_2|FLAG_UPPERCASE,KEY_A|FLAG_UPPERCASE,KEY_B|FLAG_UPPERCASE,KEY_C|FLAG_UPPERCASE,KEY_D|FLAG_UPPERCASE,KEY_E|FLAG_UPPERCASE,KEY_F|FLAG_UPPERCASE,KEY_G|FLAG_UPPERCASE,
-	KEY_H|FLAG_UPPERCASE,KEY_I|FLAG_UPPERCASE,KEY_J|FLAG_UPPERCASE,KEY_K|FLAG_UPPERCASE,KEY_L|FLAG_UPPERCASE,KEY_M|FLAG_UPPERCASE,KEY_N|FLAG_UPPERCASE,KEY_O|FLAG_UPPERCASE,
-
-	// 50 - 5f
-	KEY_P|FLAG_UPPERCASE,KEY_Q|FLAG_UPPERCASE,KEY_R|FLAG_UPPERCASE,KEY_S|FLAG_UPPERCASE,KEY_T|FLAG_UPPERCASE,KEY_U|FLAG_UPPERCASE,KEY_V|FLAG_UPPERCASE,KEY_W|FLAG_UPPERCASE,
-	KEY_X|FLAG_UPPERCASE,KEY_Y|FLAG_UPPERCASE,KEY_Z|FLAG_UPPERCASE,KEY_LEFTBRACE,KEY_BACKSLASH,KEY_RIGHTBRACE,KEY_6|FLAG_UPPERCASE,KEY_MINUS|FLAG_UPPERCASE,
-
-	// 60 - 6f
-	KEY_GRAVE,KEY_A,KEY_B,KEY_C,KEY_D,KEY_E,KEY_F,KEY_G,
-	KEY_H,KEY_I,KEY_J,KEY_K,KEY_L,KEY_M,KEY_N,KEY_O,
-
-	// 70 - 7f
-	KEY_P,KEY_Q,KEY_R,KEY_S,KEY_T,KEY_U,KEY_V,KEY_W,
-	KEY_X,KEY_Y,KEY_Z,KEY_LEFTBRACE|FLAG_UPPERCASE,KEY_BACKSLASH|FLAG_UPPERCASE,KEY_RIGHTBRACE|FLAG_UPPERCASE,KEY_GRAVE|FLAG_UPPERCASE,-1
-};
-
-static int opt_key_delay_ms = 20;
-static int opt_key_hold_ms = 20;
-static int opt_next_delay_ms = 0;
+#define DEFAULT_KEY_DELAY_MS	20
+#define DEFAULT_KEY_HOLD_MS	20
+#define DEFAULT_NEXT_DELAY_MS	0
+#define DEFAULT_ROLLOVER	4
+
+// Backoff: bytes typed between checks, and checks to stay at a rate after backing off
+#define BACKOFF_CHUNK		16
+#define BACKOFF_SETTLE		8
+#define BACKOFF_MAX_MS		1000
+#define BACKOFF_TIMEOUT_MS	5000
+#define BACKOFF_RATE_FILE	"type-rate"
+
+static int opt_key_delay_ms = DEFAULT_KEY_DELAY_MS;
+static int opt_key_hold_ms = DEFAULT_KEY_HOLD_MS;
+static int opt_next_delay_ms = DEFAULT_NEXT_DELAY_MS;
+
+static bool opt_plan = false;
+static int opt_rollover = 0;
+static bool opt_backoff = false;
+
+static struct {
+	bool on;
+	uint64_t lost;		// As the daemon counted at the last check
+	uint64_t lost_here;	// Since we started
+	int settle;
+	int min_delay_ms;	// The starting rate, it never types faster
+	int min_hold_ms;
+} backoff;
+
+static struct ydotool_type_stats stats;
 
 static void show_help() {
 	puts(
@@ -100,37 +93,165 @@ static void show_help() {
 		"  -f, --file=PATH            Specify a file, the contents of which will be be typed as if passed as an argument.\n"
 		"                               The filepath may also be '-' to read from stdin\n"
 		"  -e, --escape=BOOL          Escape enable (1) or disable (0)\n"
+		"  -l, --layout=LAYOUT[:VARIANT]\n"
+		"                             XKB keyboard layout of the session, e.g. de or fr:bepo\n"
+		"                               (default: $YDOTOOL_LAYOUT, or US)\n"
+		"  -k, --keymap=PATH          Use a layout compiled before, instead of --layout\n"
+		"  -u, --unicode=MODE         What to do with characters the layout has no key for:\n"
+		"                               skip (default), or ctrl-shift-u (GTK and IBus)"
+	);
+
+	printf(
+		"  -r, --rollover[=N]         Press the next key every key delay, before the previous one\n"
+		"                               comes up, with up to N keys down (default: %d)\n", DEFAULT_ROLLOVER
+	);
+
+	puts(
+		"  -b, --backoff              Slow down when ydotoold --verify loses keys on its\n"
+		"                               device and speed back up, never faster than -d\n"
+		"                               and -H; starts from the rate of the last run\n"
+		"                               unless they are given\n"
+		"  -p, --plan                 Don't type, print how many events typing would take\n"
 		"  -h, --help                 Display this help and exit\n"
 		"\n"
+		"Text is UTF-8. A layout is compiled from XKB on first use and cached in\n"
+		"$XDG_CACHE_HOME/ydotool, delete the cache file after changing it.\n"
+		"\n"
 		"Escape is enabled by default when typing command line arguments, and disabled by default when typing from file and stdin."
 	);
 }
 
+/*
+    Backoff: type twice as slow after a chunk the daemon didn't read back
+    complete, stay there for a while, then speed up again by a millisecond
+    of hold and delay per clean chunk. Where it ends up is remembered as
+    the starting point of the next run.
+
+    It only ever backs off from -d and -H (or the defaults), it doesn't
+    look for the fastest rate above them: the daemon only sees what its
+    own reader of the device lost, not what the compositor did, so a clean
+    read back says little about going any faster.
+*/
+static void backoff_load() {
+	char path[PATH_MAX];
+	FILE *fp = ydotool_cache_path(BACKOFF_RATE_FILE, path, sizeof(path)) ? NULL : fopen(path, "r");
+	int delay, hold;
+
+	if (fp) {
+		if (fscanf(fp, "%d %d", &delay, &hold) == 2) {
+			opt_key_delay_ms = delay > backoff.min_delay_ms ? delay : backoff.min_delay_ms;
+			opt_key_hold_ms = hold > backoff.min_hold_ms ? hold : backoff.min_hold_ms;
+		}
+
+		fclose(fp);
+	}
+}
+
+static void backoff_save() {
+	char path[PATH_MAX];
+	FILE *fp = ydotool_cache_path(BACKOFF_RATE_FILE, path, sizeof(path)) ? NULL : fopen(path, "w");
+
+	if (fp) {
+		fprintf(fp, "%d %d\n", opt_key_delay_ms, opt_key_hold_ms);
+		fclose(fp);
+	}
+}
+
+static void backoff_check() {
+	uint64_t lost;
 
+	if (ydotool_verify(yd_conn, BACKOFF_TIMEOUT_MS, &lost)) {
+		if (errno == ENOTSUP) {
+			fputs("ydotool: type: --backoff needs ydotoold --verify, typing at a fixed rate\n", stderr);
+		} else {
+			fprintf(stderr, "ydotool: type: --backoff: %s, typing at a fixed rate\n", strerror(errno));
+		}
 
-static void type_char(char c, bool delay) {
-	int kdef = ascii2keycode_map[c];
-	if (kdef == -1) {
+		backoff.on = false;
 		return;
 	}
 
-	uint16_t kc = kdef & 0xffff;
+	if (!backoff.on) {
+		// First check, only to learn where the daemon's count stands
+		backoff.on = true;
+	} else if (lost > backoff.lost) {
+		backoff.lost_here += lost - backoff.lost;
+		backoff.settle = BACKOFF_SETTLE;
+
+		opt_key_delay_ms = opt_key_delay_ms * 2 + 1 < BACKOFF_MAX_MS ? opt_key_delay_ms * 2 + 1 : BACKOFF_MAX_MS;
+		opt_key_hold_ms = opt_key_hold_ms * 2 + 1 < BACKOFF_MAX_MS ? opt_key_hold_ms * 2 + 1 : BACKOFF_MAX_MS;
+	} else if (backoff.settle) {
+		backoff.settle--;
+	} else {
+		if (opt_key_delay_ms > backoff.min_delay_ms) {
+			opt_key_delay_ms--;
+		}
+
+		if (opt_key_hold_ms > backoff.min_hold_ms) {
+			opt_key_hold_ms--;
+		}
+	}
+
+	backoff.lost = lost;
+}
+
+// Type a run of text, or only count what typing it would do
+static int type_text(const char *text, size_t len) {
+	int rc = 0;
+
+	if (opt_plan) {
+		rc = ydotool_type_plan(yd_conn, text, len, &stats);
+	} else if (!backoff.on) {
+		rc = ydotool_type_n(yd_conn, text, len, opt_key_delay_ms, opt_key_hold_ms, &stats);
+	} else {
+		for (size_t off = 0; off < len && !rc; off += BACKOFF_CHUNK) {
+			size_t n = len - off < BACKOFF_CHUNK ? len - off : BACKOFF_CHUNK;
+
+			rc = ydotool_type_n(yd_conn, text + off, n, opt_key_delay_ms, opt_key_hold_ms, &stats);
+
+			if (!rc && backoff.on) {
+				backoff_check();
+			}
+		}
+	}
+
+	if (rc) {
+		fprintf(stderr, "ydotool: type: error: %s\n", strerror(errno));
+	}
+
+	return rc;
+}
+
+static int set_layout(const char *layout, const char *keymap_path) {
+	if (keymap_path) {
+		if (ydotool_keymap_load(yd_conn, keymap_path)) {
+			fprintf(stderr, "ydotool: type: error: failed to load keymap %s: %s\n", keymap_path, strerror(errno));
+			return -1;
+		}
+
+		return 0;
+	}
 
-	if (kdef & FLAG_UPPERCASE) {
-		uinput_emit(EV_KEY, KEY_LEFTSHIFT, 1, 1);
+	if (!layout || !*layout) {
+		return ydotool_set_layout(yd_conn, NULL, NULL);
 	}
-	uinput_emit(EV_KEY, kc, 1, 1);
 
-	usleep(opt_key_hold_ms * 1000);
+	char name[128];
+	snprintf(name, sizeof(name), "%s", layout);
 
-	uinput_emit(EV_KEY, kc, 0, 1);
-	if (kdef & FLAG_UPPERCASE) {
-		uinput_emit(EV_KEY, KEY_LEFTSHIFT, 0, 1);
+	char *variant = strchr(name, ':');
+
+	if (variant) {
+		*variant++ = 0;
 	}
 
-	if (delay) {
-		usleep(opt_key_delay_ms * 1000);
+	if (ydotool_set_layout(yd_conn, name, variant)) {
+		fprintf(stderr, "ydotool: type: error: failed to set up layout %s: %s\n", layout,
+			errno == ENOTSUP ? "ydotool was built without libxkbcommon" : strerror(errno));
+		return -1;
 	}
+
+	return 0;
 }
 
 static int escape(char in) {
@@ -174,17 +295,29 @@ static int escape(char in) {
 }
 
 int tool_type(int argc, char **argv) {
+	// Options of a previous run in the same process (e.g. `shell') don't carry over
+	opt_key_delay_ms = DEFAULT_KEY_DELAY_MS;
+	opt_key_hold_ms = DEFAULT_KEY_HOLD_MS;
+	opt_next_delay_ms = DEFAULT_NEXT_DELAY_MS;
+	opt_plan = false;
+	opt_rollover = 0;
+	opt_backoff = false;
+	memset(&backoff, 0, sizeof(backoff));
+
 	if (argc < 2) {
 		show_help();
 		return 0;
 	}
 
-
-
 	const char *file_path = NULL;
 
 	int enable_escape = -1;
 
+	const char *layout = getenv("YDOTOOL_LAYOUT");
+	const char *keymap_path = NULL;
+	enum ydotool_type_fallback fallback = YDOTOOL_TYPE_SKIP;
+	bool rate_given = false;
+
 	while (1) {
 		int c;
 
@@ -194,13 +327,19 @@ int tool_type(int argc, char **argv) {
 			{"key-hold", required_argument, 0, 'H'},
 			{"escape", required_argument, 0, 'e'},
 			{"file", required_argument, 0, 'f'},
+			{"layout", required_argument, 0, 'l'},
+			{"keymap", required_argument, 0, 'k'},
+			{"unicode", required_argument, 0, 'u'},
+			{"plan", no_argument, 0, 'p'},
+			{"rollover", optional_argument, 0, 'r'},
+			{"backoff", no_argument, 0, 'b'},
 			{"help", no_argument, 0, 'h'},
 			{0, 0, 0, 0}
 		};
 		/* getopt_long stores the option index here. */
 		int option_index = 0;
 
-		c = getopt_long (argc, argv, "hd:D:H:f:e:",
+		c = getopt_long (argc, argv, "hd:D:H:f:e:l:k:u:pr::b",
 				 long_options, &option_index);
 
 		/* Detect the end of the options. */
@@ -219,6 +358,7 @@ int tool_type(int argc, char **argv) {
 				break;
 			case 'd':
 				opt_key_delay_ms = strtol(optarg, NULL, 10);
+				rate_given = true;
 				break;
 
 			case 'D':
@@ -227,6 +367,7 @@ int tool_type(int argc, char **argv) {
 
 			case 'H':
 				opt_key_hold_ms = strtol(optarg, NULL, 10);
+				rate_given = true;
 				break;
 
 			case 'f':
@@ -235,13 +376,48 @@ int tool_type(int argc, char **argv) {
 
 			case 'h':
 				show_help();
-				exit(0);
-				break;
+				return 0;
 
 			case 'e':
 				enable_escape = strtol(optarg, NULL, 10);
 				break;
 
+			case 'l':
+				layout = optarg;
+				break;
+
+			case 'k':
+				keymap_path = optarg;
+				break;
+
+			case 'u':
+				if (strcmp(optarg, "skip") == 0) {
+					fallback = YDOTOOL_TYPE_SKIP;
+				} else if (strcmp(optarg, "ctrl-shift-u") == 0) {
+					fallback = YDOTOOL_TYPE_CTRL_SHIFT_U;
+				} else {
+					fprintf(stderr, "ydotool: type: error: unknown unicode mode %s\n", optarg);
+					return 1;
+				}
+				break;
+
+			case 'p':
+				opt_plan = true;
+				break;
+
+			case 'b':
+				opt_backoff = true;
+				break;
+
+			case 'r':
+				opt_rollover = optarg ? strtol(optarg, NULL, 10) : DEFAULT_ROLLOVER;
+
+				if (opt_rollover < 1 || opt_rollover > YDOTOOL_ROLLOVER_MAX) {
+					fprintf(stderr, "ydotool: type: error: rollover must be 1 to %d keys\n", YDOTOOL_ROLLOVER_MAX);
+					return 1;
+				}
+				break;
+
 			case '?':
 				/* getopt_long already printed an error message. */
 				break;
@@ -251,6 +427,26 @@ int tool_type(int argc, char **argv) {
 		}
 	}
 
+	if (set_layout(layout, keymap_path)) {
+		return 2;
+	}
+
+	ydotool_set_type_fallback(yd_conn, fallback);
+	ydotool_set_rollover(yd_conn, opt_rollover);
+
+	if (opt_backoff && !opt_plan) {
+		backoff.min_delay_ms = opt_key_delay_ms;
+		backoff.min_hold_ms = opt_key_hold_ms;
+
+		if (!rate_given) {
+			backoff_load();
+		}
+
+		backoff_check();
+	}
+
+	memset(&stats, 0, sizeof(stats));
+
 	if (file_path) {
 		if (enable_escape == -1) {
 			enable_escape = 0;
@@ -266,17 +462,24 @@ int tool_type(int argc, char **argv) {
 			return 2;
 		}
 
-		char buf[128];
+		char buf[4096];
+		char text[sizeof(buf)];
 
 		ssize_t rc;
 		while ((rc = read(fd, buf, sizeof(buf)))) {
 			if (rc > 0) {
+				size_t len = 0;
+
 				for (int i = 0; i<rc; i++) {
 					int c = enable_escape ? escape(buf[i]) : buf[i];
 					if (c != -1) {
-						type_char((char)c, i != rc - 1);
+						text[len++] = (char)c;
 					}
 				}
+
+				if (type_text(text, len)) {
+					return 2;
+				}
 			} else if (rc < 0) {
 				fprintf(stderr, "ydotool: type: error: read %s failed: %s\n", file_path, strerror(errno));
 				return 2;
@@ -290,22 +493,34 @@ int tool_type(int argc, char **argv) {
 		if (optind < argc) {
 			while (optind < argc) {
 				char *pstr = argv[optind++];
+				char *text = malloc(strlen(pstr) + 1);
+				size_t len = 0;
 
-//				printf("pstr: %s\n", pstr);
+				if (!text) {
+					perror("ydotool: type: error");
+					return 2;
+				}
 
-				for (int i = 0; ; i++) {
+				// Escapes only ever shorten the string
+				for (int i = 0; pstr[i]; i++) {
 					int c = enable_escape ? escape(pstr[i]) : pstr[i];
-					char next = pstr[i+1];
 
 					if (c == 0) {
 						break;
 					} else if (c != -1) {
-						type_char((char)c, next);
+						text[len++] = (char)c;
 					}
 				}
 
-				if (argv[optind])
-					usleep(opt_next_delay_ms * 1000);
+				int rc = type_text(text, len);
+				free(text);
+
+				if (rc) {
+					return 2;
+				}
+
+				if (argv[optind] && !opt_plan)
+					ydotool_delay_ms(yd_conn, opt_next_delay_ms);
 			}
 		} else {
 			show_help();
@@ -313,5 +528,22 @@ int tool_type(int argc, char **argv) {
 
 	}
 
+	if (opt_plan) {
+		printf("Characters: %u, %u skipped\n"
+		       "Events: %u with modifiers pressed around every key, %u with modifiers latched\n",
+		       stats.chars, stats.skipped, stats.events_unlatched, stats.events);
+		return 0;
+	}
+
+	if (backoff.on) {
+		backoff_save();
+		fprintf(stderr, "ydotool: type: backoff rate: %d ms delay, %d ms hold, %" PRIu64 " key events lost\n",
+			opt_key_delay_ms, opt_key_hold_ms, backoff.lost_here);
+	}
+
+	if (stats.skipped) {
+		fprintf(stderr, "ydotool: type: %u characters that could not be typed were skipped\n", stats.skipped);
+	}
+
 	return 0;
 }
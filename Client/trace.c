@@ -0,0 +1,165 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+#include "trace.h"
+
+#include <errno.h>
+#include <string.h>
+
+static size_t varint_put(uint8_t *buf, uint64_t v) {
+	size_t len = 0;
+
+	while (v >= 0x80) {
+		buf[len++] = v | 0x80;
+		v >>= 7;
+	}
+
+	buf[len++] = v;
+
+	return len;
+}
+
+// 1 on success, 0 if the trace ends inside the number, -1 if it's too long
+static int varint_get(struct trace_reader *r, uint64_t *v) {
+	uint64_t ret = 0;
+
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (r->pos == r->end) {
+			return 0;
+		}
+
+		uint8_t b = *r->pos++;
+
+		ret |= (uint64_t)(b & 0x7f) << shift;
+
+		if (!(b & 0x80)) {
+			*v = ret;
+			return 1;
+		}
+	}
+
+	return -1;
+}
+
+int trace_writer_init(struct trace_writer *w, FILE *fp) {
+	uint8_t header[TRACE_HEADER_LEN] = {0};
+
+	memcpy(header, TRACE_MAGIC, 4);
+	header[4] = TRACE_VERSION;
+
+	*w = (struct trace_writer) {
+		.fp = fp,
+		.bytes = sizeof(header)
+	};
+
+	return fwrite(header, sizeof(header), 1, fp) == 1 ? 0 : -1;
+}
+
+int trace_write(struct trace_writer *w, uint64_t time_us, uint16_t type, uint16_t code, int32_t value) {
+	uint8_t buf[TRACE_EVENT_MAX];
+	size_t len = 0;
+
+	uint64_t delta_us = w->started && time_us > w->last_us ? time_us - w->last_us : 0;
+
+	if (!w->started || time_us > w->last_us) {
+		w->last_us = time_us;
+		w->started = true;
+	}
+
+	len += varint_put(buf + len, delta_us);
+	len += varint_put(buf + len, type);
+	len += varint_put(buf + len, code);
+	len += varint_put(buf + len, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+
+	if (fwrite(buf, len, 1, w->fp) != 1) {
+		return -1;
+	}
+
+	w->events++;
+	w->bytes += len;
+
+	return 0;
+}
+
+int trace_reader_init(struct trace_reader *r, const void *buf, size_t len) {
+	const uint8_t *p = buf;
+
+	if (len < TRACE_HEADER_LEN || memcmp(p, TRACE_MAGIC, 4) || p[4] != TRACE_VERSION) {
+		errno = EBADMSG;
+		return -1;
+	}
+
+	r->start = p + TRACE_HEADER_LEN;
+	r->pos = r->start;
+	r->end = p + len;
+
+	return 0;
+}
+
+void trace_reader_rewind(struct trace_reader *r) {
+	r->pos = r->start;
+}
+
+int trace_read(struct trace_reader *r, struct trace_event *ev) {
+	uint64_t v[4];
+
+	for (int i = 0; i < 4; i++) {
+		int rc = varint_get(r, &v[i]);
+
+		if (rc <= 0) {
+			if (rc < 0) {
+				errno = EBADMSG;
+			} else {
+				// A trace cut off in the middle of an event, e.g. by a killed recorder
+				r->pos = r->end;
+			}
+
+			return rc;
+		}
+	}
+
+	if (v[1] > UINT16_MAX || v[2] > UINT16_MAX || v[3] > UINT32_MAX) {
+		errno = EBADMSG;
+		return -1;
+	}
+
+	ev->delta_us = v[0];
+	ev->type = v[1];
+	ev->code = v[2];
+	ev->value = (int32_t)((uint32_t)v[3] >> 1) ^ -(int32_t)(v[3] & 1);
+
+	return 1;
+}
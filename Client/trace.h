@@ -0,0 +1,93 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+    Input traces, as written by `ydotool record' and read by `ydotool replay'.
+
+    After an 8 byte header ("YDTR", version, 3 reserved bytes) come the
+    events, each one as four LEB128 varints: microseconds since the previous
+    event, type, code, and the zigzag encoded value. Frames end with their
+    SYN_REPORT like on the device, so a typical key or relative motion event
+    takes 4 to 6 bytes. There is no index and no trailer: a trace can be
+    streamed to a pipe and a truncated one stays readable up to the cut.
+*/
+
+#define TRACE_MAGIC		"YDTR"
+#define TRACE_VERSION		1
+#define TRACE_HEADER_LEN	8
+
+// Longest encoding of one event: 64 bit delta, 3 x 32 bit fields
+#define TRACE_EVENT_MAX		(10 + 5 * 3)
+
+struct trace_event {
+	uint64_t delta_us;
+	uint16_t type;
+	uint16_t code;
+	int32_t value;
+};
+
+struct trace_writer {
+	FILE *fp;
+	uint64_t last_us;
+	bool started;
+	uint64_t events;
+	uint64_t bytes;
+};
+
+struct trace_reader {
+	const uint8_t *start;
+	const uint8_t *pos;
+	const uint8_t *end;
+};
+
+extern int trace_writer_init(struct trace_writer *w, FILE *fp);
+
+// Timestamps going backwards, e.g. across devices, are written as no delay
+extern int trace_write(struct trace_writer *w, uint64_t time_us, uint16_t type, uint16_t code, int32_t value);
+
+// Checks the header, len is the size of the whole trace
+extern int trace_reader_init(struct trace_reader *r, const void *buf, size_t len);
+extern void trace_reader_rewind(struct trace_reader *r);
+
+// 1 for an event, 0 at the end, -1 with errno EBADMSG on a broken trace
+extern int trace_read(struct trace_reader *r, struct trace_event *ev);
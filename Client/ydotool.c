@@ -49,12 +49,19 @@
 struct tool_def {
 	char name[16];
 	void *ptr;
+	bool standalone;	// Connects to ydotoold itself if it needs to, see daemon_connect()
 };
 
-int fd_daemon_socket = -1;
+struct ydotool *yd_conn = NULL;
+
+static bool opt_timed = false;
+static uint32_t spin_us = 0;
+static bool timing_report = false;
+static bool opt_wait = false;
+static bool opt_ring = false;
 
 static int tool_debug(int argc, char **argv) {
-	printf("fd_daemon_socket: %d\n", fd_daemon_socket);
+	printf("fd_daemon_socket: %d\n", ydotool_fd(yd_conn));
 	printf("argc: %d\n", argc);
 
 	for (int i=0; i<argc; i++) {
@@ -83,13 +90,50 @@ static const struct tool_def tool_list[] = {
 	{"debug",     tool_debug},
 	{"bakers",    tool_bakers},
 	{"stdin",     tool_stdin},
+	{"shell",     tool_shell},
+	{"batch",     tool_shell},
+	{"flush",     tool_flush},
+	{"stats",     tool_stats},
+	{"latency",   tool_latency, true},
+	{"run",       tool_run, true},
+	{"record",    tool_record, true},
+	{"replay",    tool_replay},
+	{"macro",     tool_macro},
 };
 
+static const struct tool_def *tool_lookup(const char *name) {
+	int tool_count = sizeof(tool_list) / sizeof(struct tool_def);
+
+	for (int i=0; i<tool_count; i++) {
+		if (strcmp(tool_list[i].name, name) == 0) {
+			return &tool_list[i];
+		}
+	}
+
+	return NULL;
+}
+
+tool_main_fn tool_find(const char *name) {
+	const struct tool_def *tool = tool_lookup(name);
+
+	return tool ? tool->ptr : NULL;
+}
+
 static void show_help() {
-	puts("Usage: ydotool [OPTION] <cmd> <args>\n"
+	puts("Usage: ydotool [OPTION]... <cmd> <args>\n"
 		"Options:\n"
 		"  -h, --help                 Display this help and exit\n"
 		"  -V, --version              Show version information\n"
+		"  -t, --timed                Send the whole sequence at once and let the daemon\n"
+		"                               keep the timing (the command returns immediately)\n"
+		"  -s, --spin=US              Busy-wait the last US microseconds before each deadline\n"
+		"                               for sub-millisecond accuracy (default: 0, sleep only)\n"
+		"  -R, --timing-report        Print requested vs. achieved intervals and jitter\n"
+		"                               to stderr when the command finishes\n"
+		"  -w, --wait                 Return only once the daemon has written the events\n"
+		"                               to the input device\n"
+		"  -r, --ring                 Pass events through shared memory instead of the\n"
+		"                               socket, if the daemon supports it\n"
 	     "Available commands:");
 
 	int tool_count = sizeof(tool_list) / sizeof(struct tool_def);
@@ -106,22 +150,41 @@ static void show_version() {
 	puts(VERSION);
 }
 
-void uinput_emit(uint16_t type, uint16_t code, int32_t val, bool syn_report) {
-	struct input_event ie = {
-		.type = type,
-		.code = code,
-		.value = val
-	};
+/*
+    Connect to the daemon with the global options, exits on failure.
+    Standalone commands call it once they know they need the daemon.
+*/
+void daemon_connect() {
+	yd_conn = ydotool_connect(NULL);
+
+	if (!yd_conn) {
+		int err = errno;
+		char socket_path[108];
 
-	write(fd_daemon_socket, &ie, sizeof(ie));
+		ydotool_default_socket_path(socket_path, sizeof(socket_path));
+		printf("failed to connect socket `%s': %s\n", socket_path, strerror(err));
 
-	if (syn_report) {
-		ie.type = EV_SYN;
-		ie.code = SYN_REPORT;
-		ie.value = 0;
-		write(fd_daemon_socket, &ie, sizeof(ie));
+		switch (err) {
+			case ENOENT:
+			case ECONNREFUSED:
+				puts("Please check if ydotoold is running.");
+				break;
+			case EACCES:
+			case EPERM:
+				puts("Please check if the current user has sufficient permissions to access the socket file.");
+				break;
+		}
+
+		exit(2);
 	}
 
+	ydotool_set_timed(yd_conn, opt_timed);
+	ydotool_set_pacing(yd_conn, spin_us, timing_report);
+
+	// Timed sequences are queued by the daemon anyway, and without a ring the socket just works
+	if (opt_ring && !opt_timed) {
+		ydotool_use_ring(yd_conn, 0);
+	}
 }
 
 int main(int argc, char **argv) {
@@ -129,11 +192,21 @@ int main(int argc, char **argv) {
 	static struct option long_options[] = {
 		{"help", no_argument, 0, 'h'},
 		{"version", no_argument, 0, 'V'},
+		{"timed", no_argument, 0, 't'},
+		{"spin", required_argument, 0, 's'},
+		{"timing-report", no_argument, 0, 'R'},
+		{"wait", no_argument, 0, 'w'},
+		{"ring", no_argument, 0, 'r'},
+		{0, 0, 0, 0}
 	};
 
-	int opt = getopt_long(argc, argv, "hV", long_options, NULL);
-	if (opt != -1)
-	{
+	while (1) {
+		// Stop at the command name, the rest belongs to the command
+		int opt = getopt_long(argc, argv, "+hVts:Rwr", long_options, NULL);
+
+		if (opt == -1)
+			break;
+
 		switch (opt) {
 			case 'h':
 				show_help();
@@ -143,6 +216,26 @@ int main(int argc, char **argv) {
 				show_version();
 				exit(0);
 
+			case 't':
+				opt_timed = true;
+				break;
+
+			case 's':
+				spin_us = strtol(optarg, NULL, 10);
+				break;
+
+			case 'R':
+				timing_report = true;
+				break;
+
+			case 'w':
+				opt_wait = true;
+				break;
+
+			case 'r':
+				opt_ring = true;
+				break;
+
 			default:
 				puts("Not a valid option\n");
 				show_help();
@@ -150,61 +243,61 @@ int main(int argc, char **argv) {
 		}
 	}
 
-	int (*tool_main)(int argc, char **argv) = NULL;
+	if (optind >= argc) {
+		show_help();
+		exit(1);
+	}
 
-	int tool_count = sizeof(tool_list) / sizeof(struct tool_def);
+	char *cmd_name = argv[optind];
 
-	for (int i=0; i<tool_count; i++) {
-		if (strcmp(tool_list[i].name, argv[1]) == 0) {
-			tool_main = tool_list[i].ptr;
-		}
-	}
+	const struct tool_def *tool = tool_lookup(cmd_name);
 
-	if (!tool_main) {
+	if (!tool) {
 		printf("ydotool: Unknown command: %s\n"
-		       "Run 'ydotool --help' if you want a command list\n", argv[1]);
+		       "Run 'ydotool --help' if you want a command list\n", cmd_name);
 		return 1;
 	}
 
-	fd_daemon_socket = socket(AF_UNIX, SOCK_DGRAM, 0);
+	tool_main_fn tool_main = tool->ptr;
 
-	if (fd_daemon_socket < 0) {
-		perror("failed to create socket");
-		exit(2);
+	int tool_argc = argc - optind;
+	char **tool_argv = argv + optind;
+
+	// Let the command parse its own options from the start
+	optind = 1;
+
+	if (opt_timed && tool_main == tool_stdin) {
+		puts("ydotool: stdin is interactive and can't be used with --timed");
+		return 1;
 	}
 
-	struct sockaddr_un sa = {
-		.sun_family = AF_UNIX
-	};
+	if (!tool->standalone) {
+		daemon_connect();
+	}
 
-	char *env_ys = getenv("YDOTOOL_SOCKET");
-	char *env_xrd = getenv("XDG_RUNTIME_DIR");
+	int rc = tool_main(tool_argc, tool_argv);
 
-	if (env_ys) {
-		snprintf(sa.sun_path, sizeof(sa.sun_path)-1, "%s", env_ys);
-	} else if (env_xrd){
-		snprintf(sa.sun_path, sizeof(sa.sun_path)-1, "%s/.ydotool_socket", env_xrd);
-	} else {
-		snprintf(sa.sun_path, sizeof(sa.sun_path)-1, "%s", "/tmp/.ydotool_socket");
+	// Standalone commands that never connected are done
+	if (!yd_conn) {
+		return rc;
 	}
 
-	if (connect(fd_daemon_socket, (const struct sockaddr *) &sa, sizeof(sa))) {
-		int err = errno;
-		printf("failed to connect socket `%s': %s\n", sa.sun_path, strerror(err));
+	ydotool_sync(yd_conn);
 
-		switch (err) {
-			case ENOENT:
-			case ECONNREFUSED:
-				puts("Please check if ydotoold is running.");
-				break;
-			case EACCES:
-			case EPERM:
-				puts("Please check if the current user has sufficient permissions to access the socket file.");
-				break;
+	if (opt_wait && ydotool_flush(yd_conn, -1)) {
+		if (errno == ENOTSUP) {
+			fputs("ydotool: --wait: the daemon doesn't acknowledge delivery, please update ydotoold\n", stderr);
+		} else {
+			fprintf(stderr, "ydotool: --wait: %s\n", strerror(errno));
+			rc = rc ? rc : 1;
 		}
+	}
 
-		exit(2);
+	if (timing_report) {
+		ydotool_timing_report(yd_conn, stderr);
 	}
 
-	return tool_main(argc-1, argv+1);
+	ydotool_disconnect(yd_conn);
+
+	return rc;
 }
@@ -62,10 +62,26 @@
 
 #include <linux/uinput.h>
 
-extern void uinput_emit(uint16_t type, uint16_t code, int32_t val, bool syn_report);
+#include "libydotool.h"
+
+extern struct ydotool *yd_conn;
 
 extern int tool_click(int argc, char **argv);
 extern int tool_mousemove(int argc, char **argv);
 extern int tool_type(int argc, char **argv);
 extern int tool_key(int argc, char **argv);
 extern int tool_stdin(int argc, char **argv);
+extern int tool_shell(int argc, char **argv);
+extern int tool_flush(int argc, char **argv);
+extern int tool_stats(int argc, char **argv);
+extern int tool_latency(int argc, char **argv);
+extern int tool_record(int argc, char **argv);
+extern int tool_replay(int argc, char **argv);
+extern int tool_macro(int argc, char **argv);
+extern int tool_run(int argc, char **argv);
+
+typedef int (*tool_main_fn)(int argc, char **argv);
+
+extern tool_main_fn tool_find(const char *name);
+
+extern void daemon_connect();
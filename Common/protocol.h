@@ -0,0 +1,247 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+#pragma once
+
+/*
+    Wire format shared by ydotool and ydotoold.
+
+    Every datagram on the daemon socket is an array of one or more
+    `struct input_event' records. The daemon forwards each datagram to
+    uinput with a single write(), so a client should send a complete
+    frame (events followed by one SYN_REPORT) per datagram.
+*/
+
+#include <linux/input.h>
+
+/*
+    Besides the datagram socket, ydotoold listens on a SOCK_SEQPACKET
+    socket at the same path plus this suffix. Its messages have the same
+    format, and the connection gives every client its own queue. Replies
+    come back on the connection, one that stops reading them until one
+    doesn't fit is closed rather than left without its answer.
+*/
+#define YDOTOOL_SEQ_SOCKET_SUFFIX	".seq"
+
+/* Maximum number of records in a single datagram */
+#define YDOTOOL_FRAME_MAX		64
+
+#define YDOTOOL_FRAME_MAX_BYTES		(YDOTOOL_FRAME_MAX * sizeof(struct input_event))
+
+/*
+    Records of this type are protocol control records. The daemon consumes
+    them instead of forwarding them to uinput; `code' selects the command
+    and `value' carries its argument. The type is above EV_MAX, so an older
+    daemon that passes them through is harmless: the kernel drops them.
+*/
+#define YDOTOOL_EV_CTL			0xffff
+
+enum ydotool_ctl_code {
+	/*
+	    Timed playback. When this is the first record of a datagram, the
+	    rest of the datagram is queued in the daemon instead of being
+	    written at once. The `time' field of each event holds its offset
+	    from the start of the stream, and the daemon emits it at that
+	    offset. `value' is YDOTOOL_TIMED_BEGIN on the first datagram of a
+	    stream and 0 on the ones that continue it. A stream starts when
+	    the previous one of the same client ends, and events of the client
+	    that aren't timed wait for it too. Streams of different clients
+	    play side by side, each frame going through the scheduler as one
+	    of its client, so keys one of them holds down don't reach the
+	    others. All datagram senders count as one client. A datagram the
+	    client's timed queue has no room for is dropped whole, and a
+	    connection is answered with the same code, `value' 0 and ENOSPC
+	    in the seconds field.
+	*/
+	YDOTOOL_CTL_TIMED = 1,
+
+	/*
+	    Delivery barrier, a datagram of its own. Once everything the
+	    daemon received before it, from any client, has been written to
+	    uinput (timed events included), the daemon answers with
+	    YDOTOOL_CTL_ACK carrying the same `value'. Connections only, the
+	    datagram socket has no way back.
+	*/
+	YDOTOOL_CTL_SYNC = 2,
+
+	/*
+	    Daemon to client. `value' is the sequence number of the
+	    YDOTOOL_CTL_SYNC being answered, its seconds field is 0 on success or
+	    the errno of a uinput write that failed in the meantime.
+	*/
+	YDOTOOL_CTL_ACK = 3,
+
+	/*
+	    Daemon to client. `value' is 1 when the client's queue is full
+	    and the daemon stops reading from it, 0 when it reads again.
+	*/
+	YDOTOOL_CTL_BUSY = 4,
+
+	/*
+	    Shared memory ring, see struct ydotool_ring. The client sends a
+	    memfd holding the ring and an eventfd doorbell with SCM_RIGHTS,
+	    `value' is the ring size in events. The daemon answers with the
+	    same code, `value' 1 if it took the ring, 0 and an errno in the
+	    seconds field if not. Connections only.
+	*/
+	YDOTOOL_CTL_RING = 5,
+
+	/*
+	    Delivery barrier like YDOTOOL_CTL_SYNC, answered with the same code
+	    and `value' once reached. The seconds field is the number of key
+	    events the daemon wrote but didn't find when reading its device
+	    back, since it started, the microseconds field 1 if it reads back
+	    at all. It is answered before the YDOTOOL_CTL_ACK of a
+	    YDOTOOL_CTL_SYNC sent right after it, which tells an older daemon
+	    that ignored it apart. Connections only.
+	*/
+	YDOTOOL_CTL_VERIFY = 6,
+
+	/*
+	    Store a named macro in the daemon. The first record is followed by
+	    the name (see YDOTOOL_MACRO_NAME_RECORDS), then by events with
+	    their offsets from the start of the macro, as in YDOTOOL_CTL_TIMED.
+	    Long macros take several datagrams: `value' has YDOTOOL_MACRO_BEGIN
+	    on the first one and YDOTOOL_MACRO_END on the last. The daemon
+	    answers the last one with the same code, `value' 1 if it stored the
+	    macro, 0 and an errno in the seconds field if not. A macro defined
+	    without events is deleted. Connections only.
+	*/
+	YDOTOOL_CTL_MACRO_DEFINE = 7,
+
+	/*
+	    Play a macro through timed playback of the client, once what it
+	    queued for timed playback before has been played. The first
+	    record is followed by the name. A connection gets an answer right
+	    away, with the same code and `value' 1, or 0 and an errno in the
+	    seconds field: ENOENT for an unknown macro, ENOSPC if the timed
+	    queue can't take it now.
+	*/
+	YDOTOOL_CTL_MACRO_PLAY = 8,
+
+	/*
+	    Ask for the daemon's metrics. It answers right away with the
+	    same code and `value' 1, passing a memfd that holds them in the
+	    Prometheus text format with SCM_RIGHTS, the seconds field being
+	    its length; or with `value' 0 and an errno in the seconds field.
+	    Connections only.
+	*/
+	YDOTOOL_CTL_STATS = 9,
+
+	/*
+	    Ask for the latency trace of a daemon running with --trace.
+	    Answered like YDOTOOL_CTL_STATS, the memfd holding a struct
+	    ydotool_trace_header and its records; ENOTSUP if tracing is off.
+	    Connections only.
+	*/
+	YDOTOOL_CTL_TRACE = 10,
+
+	/*
+	    With `value' 1, keys the connection still holds down when it
+	    closes are released by the daemon, e.g. for a tool that may be
+	    killed halfway through. By default they stay down, as they do
+	    after a datagram, so that one process can press a key and another
+	    one release it. `value' 0 turns it off again. Connections only.
+	*/
+	YDOTOOL_CTL_RELEASE_ON_CLOSE = 11,
+};
+
+#define YDOTOOL_TIMED_BEGIN		1
+
+#define YDOTOOL_MACRO_BEGIN		1
+#define YDOTOOL_MACRO_END		2
+
+/*
+    Macro names are NUL padded to this many bytes, the NUL included, and
+    take the records right after the control record.
+*/
+#define YDOTOOL_MACRO_NAME_MAX		32
+#define YDOTOOL_MACRO_NAME_RECORDS	((YDOTOOL_MACRO_NAME_MAX + sizeof(struct input_event) - 1) / sizeof(struct input_event))
+
+/*
+    Single producer, single consumer ring of events in a memfd shared with
+    the daemon. The client writes complete frames and publishes them by
+    advancing `tail', and writes to the doorbell only if the daemon had
+    already consumed everything before them. The daemon advances `head'.
+    When the ring is full, the client sets `producer_waiting' and waits for
+    YDOTOOL_CTL_BUSY with value 0 on the socket.
+
+    Indices run freely and are masked on access. Both sides use
+    sequentially consistent atomics on them, so a doorbell can't get lost
+    between the daemon draining the ring and going back to sleep. The memfd
+    must be sealed against shrinking.
+*/
+#define YDOTOOL_RING_MAGIC		0x59445247	// "YDRG"
+#define YDOTOOL_RING_SIZE_MIN		64
+#define YDOTOOL_RING_SIZE_MAX		65536
+
+struct ydotool_ring {
+	uint32_t magic;
+	uint32_t size;		// In events, a power of 2
+	uint32_t head __attribute__((aligned(64)));
+	uint32_t tail __attribute__((aligned(64)));
+	uint32_t producer_waiting __attribute__((aligned(64)));
+	struct input_event ev[] __attribute__((aligned(64)));
+};
+
+#define YDOTOOL_RING_BYTES(size)	(sizeof(struct ydotool_ring) + (size_t)(size) * sizeof(struct input_event))
+
+/*
+    Latency trace kept by ydotoold --trace, one record per frame, oldest
+    first. Times are CLOCK_MONOTONIC in ns. A client that stamps its
+    events with that clock when it sends them (see
+    ydotool_set_trace_stamps()) gives the time it sent a frame.
+*/
+#define YDOTOOL_TRACE_MAGIC		0x544c4459	// "YDLT"
+#define YDOTOOL_TRACE_VERSION		1
+
+struct ydotool_trace_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;	// sizeof(struct ydotool_trace_record) of the writer
+	uint32_t count;
+};
+
+struct ydotool_trace_record {
+	uint64_t sent_ns;	// The client's stamp, 0 if it had none
+	uint64_t received_ns;	// Its SYN_REPORT was queued (was due, for timed playback)
+	uint64_t write_ns;	// The write() to uinput that took it began, 0 if none did
+	uint32_t write_dur_ns;
+	uint32_t seq;		// Frame number, counting from 1
+	uint16_t client;	// Slot, 0 for the datagram socket
+	uint16_t events;	// In the frame, SYN_REPORT included, 0 until it is scheduled
+	uint32_t reserved;
+};
@@ -0,0 +1,1666 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+/*
+    Client queues, timed playback and the frame scheduler.
+
+    Every source of events has a client slot with its own queue: the
+    datagram socket (all of its senders share one slot) and each
+    SOCK_SEQPACKET connection. The scheduler serves the
+    slots round-robin, one complete frame (up to and including SYN_REPORT)
+    at a time. While a client holds keys down, key frames of the other
+    clients wait, so a held modifier never leaks into someone else's typing.
+
+    A connection can also hand us a shared memory ring, which is drained
+    into its queue as if the events had come over the socket.
+
+    Absolute pointer frames (ABS_X/ABS_Y) go to the absolute pointer
+    device when there is one. Without it, and without a touchscreen taking
+    those axes, they are turned into the old trick of slamming the pointer
+    into the top left corner and moving relatively from there.
+
+    With coalescing on, frames of relative motion and wheel events that
+    pile up in a queue are summed into one frame. Nothing else is merged or
+    reordered.
+
+    A connection can ask for a delivery barrier. The daemon notes how far
+    every queue has been filled at that moment, and acknowledges once all
+    of them have been written up to there.
+
+    Timed events wait in a timed queue of their client and enter its
+    queue when they are due, so they wait for other clients' held keys
+    like anything else. A new stream of a client starts when its last one
+    ends, streams of different clients play at the same time. Macros (see
+    macros.c) are played by copying them into the timed queue of the
+    client that asked, like a timed stream sent in one go.
+
+    With several instances, every instance has its own datagram slot and
+    held keys, and connections belong to the instance they came in on. All slots are still served round-robin,
+    but barriers and held keys only concern the clients of one instance.
+*/
+
+#include "ydotoold.h"
+
+struct daemon_stats stats;
+
+bool coalesce_rel = false;
+
+static struct client clients[CLIENTS_MAX];
+
+// Instance i receives datagrams in slot i, connections come after them
+static uint32_t first_conn = 1;
+
+// Past the last slot in use, connections take the first free one so this stays low
+static uint32_t clients_end = 1;
+
+// Round-robin position of the scheduler
+static uint32_t rr_next = 0;
+
+static int fd_timer = -1;
+
+struct timed_event {
+	uint64_t deadline;	// CLOCK_MONOTONIC, in ns
+	struct input_event ev;
+};
+
+struct timed_queue {
+	struct timed_event ev[TIMED_QUEUE_MAX];
+	uint32_t head;		// Free running, masked on access
+	uint32_t tail;
+};
+
+/*
+    Each datagram gets its own slot, so that one recvmmsg() can take
+    several of them.
+*/
+static struct input_event recv_slots[RECV_BATCH_MAX][YDOTOOL_FRAME_MAX];
+static struct iovec recv_iovs[RECV_BATCH_MAX];
+static struct mmsghdr recv_msgs[RECV_BATCH_MAX];
+
+// Room for the two fds of YDOTOOL_CTL_RING
+static union {
+	char buf[CMSG_SPACE(2 * sizeof(int))];
+	struct cmsghdr align;
+} recv_cmsgs[RECV_BATCH_MAX];
+
+static struct input_event out_buf[4096];
+static size_t out_len = 0;
+static struct instance *out_inst = NULL;	// Instance and device the buffered events are for
+static int out_dev = DEV_MAIN;
+
+static int last_write_errno = 0;
+
+struct sync_request {
+	bool active;
+	struct instance *inst;		// Only its clients are waited for
+	uint32_t client;
+	uint32_t generation;
+	int32_t seq;
+	uint16_t reply;			// YDOTOOL_CTL_ACK, or YDOTOOL_CTL_VERIFY
+	uint64_t write_errors;		// stats.write_errors when the barrier was set
+
+	// Queue tails when the barrier was set
+	uint32_t tail[CLIENTS_MAX];
+	uint32_t tail_generation[CLIENTS_MAX];
+	uint32_t end;			// clients_end, later slots joined after it
+};
+
+static struct sync_request syncs[SYNC_PENDING_MAX];
+
+uint64_t monotonic_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Returns how much was written
+static size_t uinput_write(int fd, const void *buf, size_t len) {
+	size_t off = 0;
+
+	while (off < len) {
+		uint64_t start = monotonic_ns();
+		ssize_t rc = write(fd, (const uint8_t *)buf + off, len - off);
+
+		hist_add(&hist_write, monotonic_ns() - start);
+
+		if (rc <= 0) {
+			if (rc < 0 && errno == EINTR) {
+				continue;
+			}
+
+			stats.write_errors++;
+			last_write_errno = rc < 0 ? errno : EIO;
+			break;
+		}
+
+		stats.writes++;
+		stats.events_written += rc / sizeof(struct input_event);
+		off += rc;
+	}
+
+	return off;
+}
+
+// What the input core does on the way to evdev, for the simulated backend
+static void out_stamp() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	for (size_t i=0; i<out_len; i++) {
+		out_buf[i].input_event_sec = ts.tv_sec;
+		out_buf[i].input_event_usec = ts.tv_nsec / 1000;
+	}
+}
+
+static void out_flush() {
+	if (out_len) {
+		uint64_t start = tracing ? monotonic_ns() : 0;
+
+		if (out_inst->simulated) {
+			out_stamp();
+		}
+
+		if (out_dev == DEV_ABS) {
+			uinput_write(out_inst->fd_uinput_abs, out_buf, out_len * sizeof(struct input_event));
+		} else {
+			size_t len = uinput_write(out_inst->fd_uinput, out_buf, out_len * sizeof(struct input_event));
+
+			// Only the device of the first instance is read back
+			if (out_inst == instances) {
+				verify_written(out_buf, len / sizeof(struct input_event));
+			}
+		}
+
+		if (tracing) {
+			latency_frames_written(start, monotonic_ns());
+		}
+
+		out_len = 0;
+	}
+}
+
+// Frames of another instance go to its devices, what the last one has pending is written first
+static void out_select(struct instance *in) {
+	if (out_inst != in) {
+		out_flush();
+		out_inst = in;
+	}
+}
+
+// Switching devices writes out what the other one has pending, to keep the order
+static void out_push_to(int dev, const struct input_event *ev) {
+	if (out_len == sizeof(out_buf) / sizeof(out_buf[0]) || (out_len && out_dev != dev)) {
+		out_flush();
+	}
+
+	out_dev = dev;
+	out_buf[out_len++] = *ev;
+
+	// Read back frame by frame, the reader's buffer holds far fewer events than a write can take
+	if (ev->type == EV_SYN && ev->code == SYN_REPORT && dev == DEV_MAIN && out_inst == instances && verify_enabled()) {
+		out_flush();
+	}
+}
+
+static void out_push(const struct input_event *ev) {
+	out_push_to(DEV_MAIN, ev);
+}
+
+static void out_push_rel(uint16_t code, int32_t value) {
+	struct input_event ev = {
+		.type = EV_REL,
+		.code = code,
+		.value = value
+	};
+
+	out_push(&ev);
+}
+
+static void out_push_syn(int dev) {
+	struct input_event syn = {
+		.type = EV_SYN,
+		.code = SYN_REPORT
+	};
+
+	out_push_to(dev, &syn);
+}
+
+// Absolute position without an absolute device, needs pointer acceleration off
+static void out_push_abs_fallback(const bool *has, const int32_t *pos) {
+	for (int i=0; i<2; i++) {
+		if (has[i]) {
+			out_push_rel(i ? REL_Y : REL_X, INT32_MIN);
+		}
+	}
+
+	out_push_syn(DEV_MAIN);
+
+	for (int i=0; i<2; i++) {
+		if (has[i]) {
+			out_push_rel(i ? REL_Y : REL_X, pos[i]);
+		}
+	}
+}
+
+static uint32_t queue_len(const struct client *c) {
+	return c->tail - c->head;
+}
+
+static uint32_t queue_free(const struct client *c) {
+	return CLIENT_QUEUE_MAX - queue_len(c);
+}
+
+// uinput ignores the time of events, in the queue it holds when they were queued, in µs
+static void queue_push(struct client *c, const struct input_event *ev, uint32_t queued_us) {
+	struct input_event *slot = &c->queue[c->tail++ & (CLIENT_QUEUE_MAX - 1)];
+
+	*slot = *ev;
+	slot->input_event_usec = queued_us;
+
+	if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+		c->frames++;
+
+		// The sequence number takes the place of the seconds
+		if (tracing) {
+			bool stamped = ev->input_event_sec || ev->input_event_usec;
+
+			slot->input_event_sec = latency_frame_queued(c - clients, ev, stamped);
+		}
+	}
+}
+
+static uint32_t timed_queue_len(const struct client *c) {
+	const struct timed_queue *tq = c->timed_queue;
+
+	return tq ? tq->tail - tq->head : 0;
+}
+
+static uint32_t timed_queue_free(const struct client *c) {
+	return TIMED_QUEUE_MAX - timed_queue_len(c);
+}
+
+static uint32_t timed_queue_pending() {
+	uint32_t len = 0;
+
+	for (uint32_t i=0; i<clients_end; i++) {
+		len += timed_queue_len(&clients[i]);
+	}
+
+	return len;
+}
+
+/*
+    Queue an event of the client for when it is due, there must be room.
+    Deadlines only go forward, an event can't overtake the ones queued
+    before it.
+*/
+static void timed_queue_add(struct client *c, const struct input_event *ev, uint64_t deadline) {
+	struct timed_queue *tq = c->timed_queue;
+
+	if (!timed_queue_len(c)) {
+		tq->head = tq->tail = 0;
+	}
+
+	if (deadline < c->timed_last) {
+		deadline = c->timed_last;
+	}
+
+	struct timed_event *te = &tq->ev[tq->tail++ & (TIMED_QUEUE_MAX - 1)];
+
+	te->deadline = c->timed_last = deadline;
+	te->ev = *ev;
+}
+
+/*
+    Events at base + their offsets, returns 0 or -errno. It's all of them
+    or none, a stream cut short could leave a key pressed for good. Most
+    clients never play anything back, their queue is allocated on first
+    use.
+*/
+static int timed_queue_push(struct client *c, const struct input_event *ev, size_t count, uint64_t base) {
+	if (count > timed_queue_free(c)) {
+		return -ENOSPC;
+	}
+
+	if (!c->timed_queue && !(c->timed_queue = malloc(sizeof(struct timed_queue)))) {
+		return -ENOMEM;
+	}
+
+	for (size_t i=0; i<count; i++) {
+		uint64_t deadline = base
+				    + (uint64_t)ev[i].input_event_sec * 1000000000
+				    + (uint64_t)ev[i].input_event_usec * 1000;
+
+		timed_queue_add(c, &ev[i], deadline);
+	}
+
+	stats.timed_events += count;
+
+	return 0;
+}
+
+// A new stream of the client starts when its last one ends, returns 0 or -errno
+static int timed_stream_push(struct client *c, const struct input_event *ev, size_t count, bool begin) {
+	if (begin) {
+		uint64_t now = monotonic_ns();
+
+		c->timed_base = c->timed_last > now ? c->timed_last : now;
+	}
+
+	return timed_queue_push(c, ev, count, c->timed_base);
+}
+
+// Move the events that are due into the client's queue, where they wait for held keys like the others
+static void timed_queue_dispatch(struct client *c, uint64_t now) {
+	struct timed_queue *tq = c->timed_queue;
+
+	while (timed_queue_len(c) && queue_free(c)) {
+		struct timed_event *te = &tq->ev[tq->head & (TIMED_QUEUE_MAX - 1)];
+
+		if (te->deadline > now) {
+			break;
+		}
+
+		// Timed events carry offsets, not the time they were sent
+		struct input_event ev = te->ev;
+
+		ev.input_event_sec = ev.input_event_usec = 0;
+
+		queue_push(c, &ev, te->deadline / 1000);
+		tq->head++;
+	}
+}
+
+// Arm the timer for the earliest head of the queues, or disarm it if they are all empty
+static void timed_queue_arm() {
+	struct itimerspec its = {0};
+	bool armed = false;
+	uint64_t deadline = 0;
+
+	for (uint32_t i=0; i<clients_end; i++) {
+		const struct client *c = &clients[i];
+
+		if (timed_queue_len(c)) {
+			uint64_t head = c->timed_queue->ev[c->timed_queue->head & (TIMED_QUEUE_MAX - 1)].deadline;
+
+			if (!armed || head < deadline) {
+				deadline = head;
+				armed = true;
+			}
+		}
+	}
+
+	if (armed) {
+		its.it_value.tv_sec = deadline / 1000000000;
+		its.it_value.tv_nsec = deadline % 1000000000;
+
+		// Zero would disarm the timer
+		if (!deadline) {
+			its.it_value.tv_nsec = 1;
+		}
+	}
+
+	timerfd_settime(fd_timer, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/*
+    Queue a macro for timed playback, after what the client has queued for
+    it already, returns 0 or -errno. The stream the client may be sending
+    goes on with its own base.
+*/
+static int macro_play(struct client *c, const struct input_event *rec, size_t count) {
+	char name[YDOTOOL_MACRO_NAME_MAX];
+	uint32_t len;
+
+	if (macro_name_get(rec, count, name)) {
+		return -EINVAL;
+	}
+
+	const struct input_event *ev = macro_find(name, &len);
+
+	if (!ev) {
+		return -ENOENT;
+	}
+
+	uint64_t now = monotonic_ns();
+	int rc = timed_queue_push(c, ev, len, c->timed_last > now ? c->timed_last : now);
+
+	if (rc) {
+		return rc;
+	}
+
+	stats.macro_plays++;
+	stats.macro_events += len;
+
+	return 0;
+}
+
+/*
+    Events that aren't timed go behind the client's timed playback while
+    there is any, so that what a client sends stays in order. The receive
+    budget leaves room for them.
+*/
+static void client_push(struct client *c, const struct input_event *ev, uint32_t queued_us) {
+	if (timed_queue_len(c)) {
+		timed_queue_add(c, ev, c->timed_last);
+	} else {
+		queue_push(c, ev, queued_us);
+	}
+}
+
+// How many datagrams the client can take right now
+static int client_recv_budget(const struct client *c) {
+	uint32_t free_events = queue_free(c);
+
+	if (timed_queue_free(c) < free_events) {
+		free_events = timed_queue_free(c);
+	}
+
+	uint32_t budget = free_events / YDOTOOL_FRAME_MAX;
+
+	return budget > RECV_BATCH_MAX ? RECV_BATCH_MAX : budget;
+}
+
+// The ring stays mapped until the slot is freed, so that it can be drained
+static void client_close_doorbell(struct client *c) {
+	if (c->fd_doorbell >= 0) {
+		epoll_ctl(fd_epoll, EPOLL_CTL_DEL, c->fd_doorbell, NULL);
+		close(c->fd_doorbell);
+		c->fd_doorbell = -1;
+	}
+}
+
+static void client_ring_free(struct client *c) {
+	client_close_doorbell(c);
+
+	if (c->ring) {
+		munmap(c->ring, YDOTOOL_RING_BYTES(c->ring_size));
+		c->ring = NULL;
+	}
+}
+
+static void client_close(uint32_t idx) {
+	struct client *c = &clients[idx];
+
+	if (c->polling) {
+		epoll_ctl(fd_epoll, EPOLL_CTL_DEL, c->fd, NULL);
+	}
+
+	client_close_doorbell(c);
+	close(c->fd);
+
+	c->fd = -1;
+	c->closing = true;
+	c->polling = false;
+}
+
+/*
+    Replies are never queued. One that doesn't fit because the peer stopped
+    reading them would leave it waiting for an ack forever, so the
+    connection is closed instead and the peer gets an error.
+*/
+static void client_reply_failed(uint32_t idx) {
+	fputs("Client isn't reading its replies, closing the connection\n", stderr);
+	client_close(idx);
+}
+
+static void client_send_ctl_time(uint32_t idx, uint16_t code, int32_t value, uint64_t sec, uint64_t usec) {
+	struct client *c = &clients[idx];
+
+	if (idx < first_conn || !c->active || c->fd < 0) {
+		return;
+	}
+
+	struct input_event ev = {
+		.input_event_sec = sec,
+		.input_event_usec = usec,
+		.type = YDOTOOL_EV_CTL,
+		.code = code,
+		.value = value
+	};
+
+	if (send(c->fd, &ev, sizeof(ev), MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof(ev)) {
+		client_reply_failed(idx);
+	}
+}
+
+static void client_send_ctl(uint32_t idx, uint16_t code, int32_t value, int32_t status) {
+	client_send_ctl_time(idx, code, value, status, 0);
+}
+
+// The metrics and the latency trace go in a memfd, they don't fit in a reply
+static void client_send_memfd(uint32_t idx, uint16_t code) {
+	struct client *c = &clients[idx];
+	size_t len;
+	int fd;
+
+	if (c->fd < 0) {
+		return;
+	}
+
+	// They cover every instance, so only the first one answers
+	if (c->inst != instances) {
+		client_send_ctl(idx, code, 0, ENOTSUP);
+		return;
+	}
+
+	fd = code == YDOTOOL_CTL_STATS ? metrics_memfd(&len) : latency_trace_memfd(&len);
+
+	if (fd < 0) {
+		client_send_ctl(idx, code, 0, errno);
+		return;
+	}
+
+	struct input_event ev = {
+		.input_event_sec = len,
+		.type = YDOTOOL_EV_CTL,
+		.code = code,
+		.value = 1
+	};
+
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} cmsg = {0};
+
+	struct iovec iov = {
+		.iov_base = &ev,
+		.iov_len = sizeof(ev)
+	};
+
+	struct msghdr mh = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cmsg.buf,
+		.msg_controllen = sizeof(cmsg.buf)
+	};
+
+	struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+
+	if (sendmsg(c->fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof(ev)) {
+		client_reply_failed(idx);
+	}
+
+	close(fd);
+}
+
+/*
+    Stop reading from a client while its queue is full, the sender then
+    blocks, and a connection is told so. The fd leaves the epoll set
+    instead of just dropping EPOLLIN, so a hangup can't wake us up in a
+    loop before we can read again.
+*/
+static void client_update_polling(uint32_t idx) {
+	struct client *c = &clients[idx];
+
+	if (!c->active || c->fd < 0) {
+		return;
+	}
+
+	bool want = client_recv_budget(c) > 0;
+
+	if (want != c->polling) {
+		struct epoll_event ee = {
+			.events = EPOLLIN,
+			.data.u64 = EP_DATA(EP_CLIENT, idx)
+		};
+
+		epoll_ctl(fd_epoll, want ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, c->fd, &ee);
+		c->polling = want;
+	}
+
+	if (idx >= first_conn && want == c->busy) {
+		c->busy = !want;
+		client_send_ctl(idx, YDOTOOL_CTL_BUSY, c->busy, 0);
+
+		if (c->busy) {
+			stats.busy++;
+		}
+	}
+}
+
+// Take the fds passed along with a message, closing any beyond max
+static int msg_take_fds(struct msghdr *mh, int *fds, int max) {
+	int n = 0;
+
+	for (struct cmsghdr *cm = CMSG_FIRSTHDR(mh); cm; cm = CMSG_NXTHDR(mh, cm)) {
+		if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+			continue;
+		}
+
+		int count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+		for (int i=0; i<count; i++) {
+			int fd;
+
+			memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+
+			if (n < max) {
+				fds[n++] = fd;
+			} else {
+				close(fd);
+			}
+		}
+	}
+
+	return n;
+}
+
+// Events published in the ring but not moved to the queue yet
+static uint32_t client_ring_pending(const struct client *c) {
+	if (!c->ring) {
+		return 0;
+	}
+
+	uint32_t avail = __atomic_load_n(&c->ring->tail, __ATOMIC_SEQ_CST) - c->ring_head;
+
+	return avail > c->ring_size ? 0 : avail;
+}
+
+/*
+    Map a client's ring. The memfd has to be sealed against shrinking,
+    otherwise the client could make us fault on the mapping.
+*/
+static void client_ring_setup(uint32_t idx, int *fds, int nfds, int32_t size) {
+	struct client *c = &clients[idx];
+	struct ydotool_ring *ring = MAP_FAILED;
+	struct stat st;
+	int err = 0;
+
+	if (nfds != 2) {
+		err = EBADF;
+	} else if (c->ring) {
+		err = EEXIST;
+	} else if (size < YDOTOOL_RING_SIZE_MIN || size > YDOTOOL_RING_SIZE_MAX || (size & (size - 1))) {
+		err = EINVAL;
+	} else {
+		int seals = fcntl(fds[0], F_GET_SEALS);
+
+		if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+			err = EPERM;
+		} else if (fstat(fds[0], &st) || st.st_size < YDOTOOL_RING_BYTES(size)) {
+			err = EINVAL;
+		}
+	}
+
+	if (!err) {
+		ring = mmap(NULL, YDOTOOL_RING_BYTES(size), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+
+		if (ring == MAP_FAILED) {
+			err = errno;
+		} else if (ring->magic != YDOTOOL_RING_MAGIC || ring->size != size) {
+			err = EINVAL;
+		}
+	}
+
+	if (!err) {
+		struct epoll_event ee = {
+			.events = EPOLLIN,
+			.data.u64 = EP_DATA(EP_DOORBELL, idx)
+		};
+
+		if (epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fds[1], &ee)) {
+			err = errno;
+		}
+	}
+
+	if (nfds > 0) {
+		close(fds[0]);
+	}
+
+	if (err) {
+		if (ring != MAP_FAILED) {
+			munmap(ring, YDOTOOL_RING_BYTES(size));
+		}
+
+		if (nfds > 1) {
+			close(fds[1]);
+		}
+
+		client_send_ctl(idx, YDOTOOL_CTL_RING, 0, err);
+		return;
+	}
+
+	c->ring = ring;
+	c->ring_size = size;
+	c->ring_head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+	c->fd_doorbell = fds[1];
+
+	stats.rings++;
+
+	client_send_ctl(idx, YDOTOOL_CTL_RING, 1, 0);
+}
+
+/*
+    Move what the client published in its ring to its queue. The tail is
+    read again after head is stored, so that events published while we
+    were draining are either seen here or rung for.
+*/
+static void client_ring_drain(uint32_t idx) {
+	struct client *c = &clients[idx];
+	struct ydotool_ring *ring = c->ring;
+	uint32_t moved = 0;
+
+	while (queue_free(c)) {
+		uint32_t avail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) - c->ring_head;
+
+		if (avail > c->ring_size) {
+			fputs("Client ring is corrupted, closing the connection\n", stderr);
+			client_ring_free(c);
+
+			if (c->fd >= 0) {
+				client_close(idx);
+			}
+			return;
+		}
+
+		if (!avail) {
+			break;
+		}
+
+		if (avail > queue_free(c)) {
+			avail = queue_free(c);
+		}
+
+		for (uint32_t i=0; i<avail; i++) {
+			queue_push(c, &ring->ev[(c->ring_head + i) & (c->ring_size - 1)], wake_us);
+		}
+
+		c->ring_head += avail;
+		moved += avail;
+
+		__atomic_store_n(&ring->head, c->ring_head, __ATOMIC_SEQ_CST);
+	}
+
+	if (moved) {
+		stats.events += moved;
+		stats.ring_events += moved;
+		stats.bytes += moved * sizeof(struct input_event);
+		c->counters.events += moved;
+		c->counters.bytes += moved * sizeof(struct input_event);
+
+		if (__atomic_exchange_n(&ring->producer_waiting, 0, __ATOMIC_SEQ_CST)) {
+			client_send_ctl(idx, YDOTOOL_CTL_BUSY, 0, 0);
+		}
+	}
+}
+
+static void sync_register(uint32_t idx, int32_t seq, uint16_t reply) {
+	struct sync_request *s = NULL;
+
+	for (int i=0; i<SYNC_PENDING_MAX; i++) {
+		if (!syncs[i].active) {
+			s = &syncs[i];
+			break;
+		}
+	}
+
+	if (!s) {
+		client_send_ctl(idx, YDOTOOL_CTL_ACK, seq, EAGAIN);
+		return;
+	}
+
+	s->active = true;
+	s->inst = clients[idx].inst;
+	s->client = idx;
+	s->generation = clients[idx].generation;
+	s->seq = seq;
+	s->reply = reply;
+	s->write_errors = stats.write_errors;
+
+	s->end = clients_end;
+
+	for (uint32_t i=0; i<s->end; i++) {
+		// Timed and then ring events will enter the queue in order, right after what it holds
+		s->tail[i] = clients[i].tail + timed_queue_len(&clients[i]) + client_ring_pending(&clients[i]);
+		s->tail_generation[i] = clients[i].generation;
+	}
+
+	stats.syncs++;
+}
+
+static bool sync_reached(const struct sync_request *s) {
+	for (uint32_t i=0; i<s->end && i<clients_end; i++) {
+		const struct client *c = &clients[i];
+
+		// A client that went away has drained its queue
+		if (!c->active || c->inst != s->inst || c->generation != s->tail_generation[i]) {
+			continue;
+		}
+
+		if ((int32_t)(s->tail[i] - c->head) > 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Must run after the output has been written. Verifications are answered first, see YDOTOOL_CTL_VERIFY.
+static void syncs_complete() {
+	static const uint16_t order[] = {YDOTOOL_CTL_VERIFY, YDOTOOL_CTL_ACK};
+
+	for (int o=0; o<sizeof(order)/sizeof(order[0]); o++) {
+		for (int i=0; i<SYNC_PENDING_MAX; i++) {
+			struct sync_request *s = &syncs[i];
+
+			if (!s->active || s->reply != order[o] || !sync_reached(s)) {
+				continue;
+			}
+
+			if (clients[s->client].generation == s->generation) {
+				if (s->reply == YDOTOOL_CTL_VERIFY) {
+					client_send_ctl_time(s->client, YDOTOOL_CTL_VERIFY, s->seq,
+							     stats.verify_lost, verify_enabled());
+				} else {
+					client_send_ctl(s->client, YDOTOOL_CTL_ACK, s->seq,
+							stats.write_errors != s->write_errors ? last_write_errno : 0);
+				}
+			}
+
+			s->active = false;
+		}
+	}
+}
+
+// What a departed client left pressed stays down, unless it asked for it to be released
+static void client_release_keys(uint32_t idx) {
+	struct client *c = &clients[idx];
+
+	if (!c->keys_held) {
+		return;
+	}
+
+	if (!c->release_on_close) {
+		memset(c->keys_down, 0, sizeof(c->keys_down));
+		c->keys_held = 0;
+		return;
+	}
+
+	out_select(c->inst);
+
+	for (int code=0; code<KEY_CNT; code++) {
+		if (c->keys_down[code / 8] & (1 << (code % 8))) {
+			struct input_event ev = {
+				.type = EV_KEY,
+				.code = code,
+				.value = 0
+			};
+
+			out_push(&ev);
+		}
+	}
+
+	struct input_event syn = {
+		.type = EV_SYN,
+		.code = SYN_REPORT
+	};
+
+	out_push(&syn);
+
+	memset(c->keys_down, 0, sizeof(c->keys_down));
+	c->keys_held = 0;
+}
+
+// Returns -1 if the queue can't be allocated
+static int client_take(uint32_t idx, struct instance *in) {
+	struct client *c = &clients[idx];
+
+	if (!c->queue && !(c->queue = malloc(CLIENT_QUEUE_MAX * sizeof(struct input_event)))) {
+		return -1;
+	}
+
+	c->inst = in;
+	c->active = true;
+	c->since = monotonic_ns();
+
+	if (idx >= clients_end) {
+		clients_end = idx + 1;
+	}
+
+	return 0;
+}
+
+static void client_free(uint32_t idx) {
+	clients[idx].active = false;
+
+	while (clients_end > first_conn && !clients[clients_end - 1].active) {
+		clients_end--;
+	}
+}
+
+void clients_init(int fd_tmr) {
+	fd_timer = fd_tmr;
+	first_conn = clients_end = instance_count;
+
+	for (int i=0; i<RECV_BATCH_MAX; i++) {
+		recv_iovs[i].iov_base = recv_slots[i];
+		recv_iovs[i].iov_len = sizeof(recv_slots[i]);
+		recv_msgs[i].msg_hdr.msg_iov = &recv_iovs[i];
+		recv_msgs[i].msg_hdr.msg_iovlen = 1;
+		recv_msgs[i].msg_hdr.msg_control = recv_cmsgs[i].buf;
+	}
+
+	for (int i=0; i<CLIENTS_MAX; i++) {
+		clients[i].fd = -1;
+		clients[i].fd_doorbell = -1;
+	}
+
+	struct epoll_event ee = {
+		.events = EPOLLIN
+	};
+
+	for (uint32_t i=0; i<instance_count; i++) {
+		struct instance *in = &instances[i];
+
+		in->legacy = i;
+		in->kbd_owner = -1;
+
+		if (client_take(in->legacy, in)) {
+			perror("failed to allocate client queues");
+			exit(2);
+		}
+
+		clients[in->legacy].fd = in->fd_dgram;
+		clients[in->legacy].polling = true;
+
+		ee.data.u64 = EP_DATA(EP_CLIENT, in->legacy);
+		epoll_ctl(fd_epoll, EPOLL_CTL_ADD, in->fd_dgram, &ee);
+
+		if (in->fd_seq >= 0) {
+			ee.data.u64 = EP_DATA(EP_LISTEN, i);
+			epoll_ctl(fd_epoll, EPOLL_CTL_ADD, in->fd_seq, &ee);
+		}
+	}
+
+	ee.data.u64 = EP_DATA(EP_TIMER, 0);
+	epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_timer, &ee);
+}
+
+// The queues are only touched once clients fill them, that shouldn't page fault
+void clients_prefault() {
+	prefault(clients, sizeof(clients));
+
+	for (uint32_t i=0; i<CLIENTS_MAX; i++) {
+		if (clients[i].queue) {
+			prefault(clients[i].queue, CLIENT_QUEUE_MAX * sizeof(struct input_event));
+		}
+	}
+
+	prefault(recv_slots, sizeof(recv_slots));
+	prefault(out_buf, sizeof(out_buf));
+}
+
+void clients_accept(uint32_t instance) {
+	struct instance *in = &instances[instance];
+
+	while (1) {
+		int fd = accept4(in->fd_seq, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (fd < 0) {
+			return;
+		}
+
+		uint32_t idx;
+
+		for (idx=first_conn; idx<CLIENTS_MAX; idx++) {
+			if (!clients[idx].active) {
+				break;
+			}
+		}
+
+		if (idx == CLIENTS_MAX) {
+			fputs("Too many clients, connection refused\n", stderr);
+			close(fd);
+			continue;
+		}
+
+		if (client_take(idx, in)) {
+			fputs("Out of memory, connection refused\n", stderr);
+			close(fd);
+			continue;
+		}
+
+		struct client *c = &clients[idx];
+
+		c->closing = false;
+		c->polling = true;
+		c->busy = false;
+		c->release_on_close = false;
+		c->fd = fd;
+		c->generation++;
+		c->timed_base = c->timed_last = 0;
+		c->head = c->tail = 0;
+		c->frames = 0;
+		memset(&c->counters, 0, sizeof(c->counters));
+
+		struct ucred cred;
+		socklen_t cred_len = sizeof(cred);
+
+		c->pid = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) ? 0 : cred.pid;
+
+		struct epoll_event ee = {
+			.events = EPOLLIN,
+			.data.u64 = EP_DATA(EP_CLIENT, idx)
+		};
+
+		epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd, &ee);
+
+		stats.connections++;
+	}
+}
+
+void clients_readable(uint32_t idx) {
+	struct client *c = &clients[idx];
+
+	if (!c->active || c->fd < 0) {
+		return;
+	}
+
+	int budget = client_recv_budget(c);
+
+	for (int i=0; i<budget; i++) {
+		recv_msgs[i].msg_hdr.msg_controllen = sizeof(recv_cmsgs[i].buf);
+	}
+
+	int n = budget ? recvmmsg(c->fd, recv_msgs, budget, MSG_DONTWAIT | MSG_CMSG_CLOEXEC, NULL) : 0;
+
+	bool eof = false;
+	int received = 0;
+
+	for (int i=0; i<n; i++) {
+		size_t dlen = recv_msgs[i].msg_len;
+
+		int fds[2];
+		int nfds = msg_take_fds(&recv_msgs[i].msg_hdr, fds, 2);
+
+		struct input_event *rec = recv_slots[i];
+		size_t count = dlen / sizeof(struct input_event);
+
+		bool valid = !(recv_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) && dlen && !(dlen % sizeof(struct input_event));
+
+		if (valid && rec[0].type == YDOTOOL_EV_CTL && rec[0].code == YDOTOOL_CTL_RING && idx != c->inst->legacy) {
+			client_ring_setup(idx, fds, nfds, rec[0].value);
+		} else {
+			for (int j=0; j<nfds; j++) {
+				close(fds[j]);
+			}
+		}
+
+		// A connection reads 0 bytes at EOF, for every remaining slot
+		if (dlen == 0 && idx != c->inst->legacy) {
+			eof = true;
+			break;
+		}
+
+		stats.bytes += dlen;
+		c->counters.bytes += dlen;
+
+		if (!valid) {
+			stats.datagrams_dropped++;
+			continue;
+		}
+
+		received++;
+		c->counters.datagrams++;
+
+		if (rec[0].type == YDOTOOL_EV_CTL) {
+			if (rec[0].code == YDOTOOL_CTL_TIMED) {
+				int rc = timed_stream_push(c, rec + 1, count - 1, rec[0].value & YDOTOOL_TIMED_BEGIN);
+
+				if (rc) {
+					stats.timed_rejected++;
+					client_send_ctl(idx, YDOTOOL_CTL_TIMED, 0, -rc);
+				}
+
+				c->counters.events += count - 1;
+			} else if ((rec[0].code == YDOTOOL_CTL_SYNC || rec[0].code == YDOTOOL_CTL_VERIFY) && idx != c->inst->legacy) {
+				sync_register(idx, rec[0].value, rec[0].code == YDOTOOL_CTL_SYNC ? YDOTOOL_CTL_ACK : YDOTOOL_CTL_VERIFY);
+			} else if (rec[0].code == YDOTOOL_CTL_MACRO_DEFINE && idx != c->inst->legacy) {
+				// Macros are shared, they stay with the first instance
+				int rc = c->inst == instances ? macro_define(idx, c->generation, rec, count) : -ENOTSUP;
+
+				if (rc) {
+					client_send_ctl(idx, YDOTOOL_CTL_MACRO_DEFINE, rc > 0, rc > 0 ? 0 : -rc);
+				}
+			} else if (rec[0].code == YDOTOOL_CTL_MACRO_PLAY) {
+				int rc = c->inst == instances ? macro_play(c, rec, count) : -ENOTSUP;
+
+				client_send_ctl(idx, YDOTOOL_CTL_MACRO_PLAY, !rc, -rc);
+			} else if ((rec[0].code == YDOTOOL_CTL_STATS || rec[0].code == YDOTOOL_CTL_TRACE) && idx != c->inst->legacy) {
+				client_send_memfd(idx, rec[0].code);
+			} else if (rec[0].code == YDOTOOL_CTL_RELEASE_ON_CLOSE && idx != c->inst->legacy) {
+				c->release_on_close = rec[0].value;
+			}
+			continue;
+		}
+
+		for (size_t j=0; j<count; j++) {
+			client_push(c, &rec[j], wake_us);
+		}
+
+		stats.events += count;
+		c->counters.events += count;
+	}
+
+	if (received) {
+		stats.wakeups++;
+		stats.datagrams += received;
+	}
+
+	if (idx != c->inst->legacy && c->fd >= 0 && (eof || (n < 0 && errno != EAGAIN && errno != EINTR))) {
+		client_close(idx);
+	}
+}
+
+void clients_doorbell(uint32_t idx) {
+	struct client *c = &clients[idx];
+	uint64_t count;
+
+	if (!c->active || c->fd_doorbell < 0) {
+		return;
+	}
+
+	// The ring is drained by clients_run()
+	ssize_t rc = read(c->fd_doorbell, &count, sizeof(count));
+
+	if (rc == sizeof(count)) {
+		stats.doorbells++;
+	} else if (rc == 0 || (errno != EAGAIN && errno != EINTR)) {
+		// Not an eventfd after all, it would wake us up forever
+		client_close(idx);
+	}
+}
+
+void clients_timer_expired() {
+	uint64_t expirations;
+
+	read(fd_timer, &expirations, sizeof(expirations));
+}
+
+// Length of the frame at the head of the queue, 0 if it's not complete yet
+static uint32_t client_frame_len(const struct client *c, bool *has_key) {
+	uint32_t len = queue_len(c);
+
+	*has_key = false;
+
+	for (uint32_t i=0; i<len; i++) {
+		const struct input_event *ev = &c->queue[(c->head + i) & (CLIENT_QUEUE_MAX - 1)];
+
+		if (ev->type == EV_KEY) {
+			*has_key = true;
+		} else if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+			return i + 1;
+		}
+	}
+
+	// A full queue without a SYN_REPORT would never drain otherwise
+	return len == CLIENT_QUEUE_MAX ? len : 0;
+}
+
+static void client_track_key(struct client *c, const struct input_event *ev) {
+	if (ev->code >= KEY_CNT) {
+		return;
+	}
+
+	uint8_t mask = 1 << (ev->code % 8);
+	uint8_t *byte = &c->keys_down[ev->code / 8];
+
+	if (ev->value == 1 && !(*byte & mask)) {
+		*byte |= mask;
+		c->keys_held++;
+	} else if (ev->value == 0 && (*byte & mask)) {
+		*byte &= ~mask;
+		c->keys_held--;
+	}
+}
+
+// For the frame at the head of the queue, about to be scheduled
+static void client_queue_delay(const struct client *c) {
+	int32_t us = wake_us - c->queue[c->head & (CLIENT_QUEUE_MAX - 1)].input_event_usec;
+
+	// Timed events are stamped when due, which can be after the wakeup began
+	hist_add(&hist_queue, us > 0 ? (uint64_t)us * 1000 : 0);
+}
+
+// Position of a relative axis in the sums of client_coalesce(), -1 if it can't be merged
+static int rel_slot(uint16_t code) {
+	switch (code) {
+		case REL_X:
+			return 0;
+		case REL_Y:
+			return 1;
+		case REL_HWHEEL:
+			return 2;
+		case REL_WHEEL:
+			return 3;
+		default:
+			return -1;
+	}
+}
+
+// Length of the frame at offset `off' into the queue if it only holds mergeable motion, else 0
+static uint32_t rel_frame_len(const struct client *c, uint32_t off) {
+	uint32_t len = queue_len(c);
+
+	for (uint32_t i=off; i<len; i++) {
+		const struct input_event *ev = &c->queue[(c->head + i) & (CLIENT_QUEUE_MAX - 1)];
+
+		if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+			return i - off + 1;
+		}
+
+		if (ev->type != EV_REL || rel_slot(ev->code) < 0) {
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+/*
+    Sum the consecutive motion frames at the head of the queue into one.
+    Stops at the first other frame, or where a sum would overflow. Returns
+    false if there weren't at least two frames to merge.
+*/
+static bool client_coalesce(struct client *c) {
+	static const uint16_t codes[] = {REL_X, REL_Y, REL_HWHEEL, REL_WHEEL};
+
+	int64_t sum[4] = {0};
+	uint32_t off = 0;
+	uint32_t merged = 0;
+	uint32_t len;
+
+	while ((len = rel_frame_len(c, off))) {
+		int64_t next[4];
+		bool overflow = false;
+
+		memcpy(next, sum, sizeof(next));
+
+		for (uint32_t i=0; i<len-1; i++) {
+			const struct input_event *ev = &c->queue[(c->head + off + i) & (CLIENT_QUEUE_MAX - 1)];
+			int slot = rel_slot(ev->code);
+
+			next[slot] += ev->value;
+
+			if (next[slot] > INT32_MAX || next[slot] < INT32_MIN) {
+				overflow = true;
+			}
+		}
+
+		if (overflow) {
+			break;
+		}
+
+		memcpy(sum, next, sizeof(sum));
+		off += len;
+		merged++;
+	}
+
+	if (merged < 2) {
+		return false;
+	}
+
+	client_queue_delay(c);
+
+	if (tracing) {
+		uint32_t start = 0;
+
+		for (uint32_t i=0; i<off; i++) {
+			const struct input_event *ev = &c->queue[(c->head + i) & (CLIENT_QUEUE_MAX - 1)];
+
+			if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+				latency_frame_scheduled(ev->input_event_sec, i + 1 - start);
+				start = i + 1;
+			}
+		}
+	}
+
+	c->head += off;
+	c->frames -= merged;
+
+	uint32_t written = 0;
+
+	for (int i=0; i<4; i++) {
+		if (sum[i]) {
+			struct input_event ev = {
+				.type = EV_REL,
+				.code = codes[i],
+				.value = sum[i]
+			};
+
+			out_push(&ev);
+			written++;
+		}
+	}
+
+	// Motion that cancelled out leaves nothing to report
+	if (written) {
+		struct input_event syn = {
+			.type = EV_SYN,
+			.code = SYN_REPORT
+		};
+
+		out_push(&syn);
+		written++;
+
+		stats.frames++;
+		c->counters.frames++;
+	}
+
+	stats.coalesced += merged - 1;
+	stats.coalesced_events += off - written;
+
+	return true;
+}
+
+// Move one frame of a client to the output, returns false if it has to wait
+static bool client_schedule_frame(uint32_t idx) {
+	struct client *c = &clients[idx];
+
+	bool has_key;
+	uint32_t len = client_frame_len(c, &has_key);
+
+	if (!len) {
+		return false;
+	}
+
+	struct instance *in = c->inst;
+
+	if (has_key && in->kbd_owner >= 0 && in->kbd_owner != idx) {
+		stats.deferred++;
+		return false;
+	}
+
+	out_select(in);
+
+	// Only when the client is behind, a lone frame goes out as it is
+	if (coalesce_rel && !has_key && c->frames > 1 && client_coalesce(c)) {
+		return true;
+	}
+
+	int devs = 0;			// Devices that got events of this frame
+	bool abs_has[2] = {false, false};
+	int32_t abs_pos[2];
+
+	client_queue_delay(c);
+
+	for (uint32_t i=0; i<len; i++) {
+		struct input_event *ev = &c->queue[c->head++ & (CLIENT_QUEUE_MAX - 1)];
+
+		if (ev->type == EV_KEY) {
+			client_track_key(c, ev);
+		} else if (ev->type == EV_ABS && (ev->code == ABS_X || ev->code == ABS_Y) && !in->abs_on_main) {
+			if (in->fd_uinput_abs >= 0) {
+				out_push_to(DEV_ABS, ev);
+				devs |= DEV_ABS;
+			} else {
+				abs_has[ev->code == ABS_Y] = true;
+				abs_pos[ev->code == ABS_Y] = ev->value;
+			}
+			continue;
+		} else if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+			c->frames--;
+
+			if (tracing) {
+				latency_frame_scheduled(ev->input_event_sec, len);
+			}
+
+			if (abs_has[0] || abs_has[1]) {
+				out_push_abs_fallback(abs_has, abs_pos);
+				devs |= DEV_MAIN;
+			}
+
+			// Every device that got events of the frame ends it
+			if (devs & DEV_ABS) {
+				out_push_syn(DEV_ABS);
+			}
+
+			if ((devs & DEV_MAIN) || !devs) {
+				out_push(ev);
+			}
+			continue;
+		}
+
+		out_push(ev);
+		devs |= DEV_MAIN;
+	}
+
+	stats.frames++;
+	c->counters.frames++;
+
+	if (c->keys_held) {
+		in->kbd_owner = idx;
+	} else if (in->kbd_owner == idx) {
+		in->kbd_owner = -1;
+	}
+
+	return true;
+}
+
+/*
+    Everything that has to happen after a wakeup: feed due timed events,
+    schedule frames round-robin, write them to uinput at once, and update
+    timers and polling.
+*/
+void clients_run() {
+	uint64_t now = monotonic_ns();
+
+	for (uint32_t idx=0; idx<clients_end; idx++) {
+		if (timed_queue_len(&clients[idx])) {
+			timed_queue_dispatch(&clients[idx], now);
+		}
+	}
+
+	bool progress = true;
+
+	while (progress) {
+		progress = false;
+
+		for (uint32_t i=0; i<clients_end; i++) {
+			uint32_t idx = (rr_next + i) % clients_end;
+
+			if (!clients[idx].active) {
+				continue;
+			}
+
+			// Ring events wait behind the timed playback of the client
+			if (clients[idx].ring && !timed_queue_len(&clients[idx])) {
+				client_ring_drain(idx);
+			}
+
+			if (client_schedule_frame(idx)) {
+				progress = true;
+			}
+		}
+
+		rr_next = (rr_next + 1) % clients_end;
+	}
+
+	for (uint32_t idx=first_conn; idx<clients_end; idx++) {
+		struct client *c = &clients[idx];
+
+		// A frame the client never finished is dropped, timed playback goes on until it ends
+		if (c->active && c->closing && !c->frames && !timed_queue_len(c) && !client_ring_pending(c)) {
+			c->head = c->tail;
+
+			free(c->timed_queue);
+			c->timed_queue = NULL;
+
+			client_ring_free(c);
+			client_release_keys(idx);
+			macro_client_gone(idx);
+
+			if (c->inst->kbd_owner == idx) {
+				c->inst->kbd_owner = -1;
+			}
+
+			client_free(idx);
+		}
+	}
+
+	out_flush();
+
+	syncs_complete();
+
+	// A client queue may have been full, then the head is overdue and fires at once
+	timed_queue_arm();
+
+	for (uint32_t idx=0; idx<clients_end; idx++) {
+		client_update_polling(idx);
+	}
+}
+
+static void client_label(uint32_t idx, char *buf, size_t len) {
+	const struct client *c = &clients[idx];
+	int n = 0;
+
+	if (instance_count > 1) {
+		n = snprintf(buf, len, "instance=\"%s\",", c->inst->name);
+	}
+
+	if (idx == c->inst->legacy) {
+		snprintf(buf + n, len - n, "client=\"datagram\"");
+	} else {
+		snprintf(buf + n, len - n, "client=\"%u\",pid=\"%d\"", idx, (int)c->pid);
+	}
+}
+
+// Per client, rates are left to whoever scrapes the counters
+void clients_metrics(FILE *fp) {
+	// In the order of `values' below
+	static const struct {
+		const char *name;
+		const char *type;
+		const char *help;
+	} families[] = {
+		{"client_datagrams_total", "counter", "Datagrams and messages received from a client."},
+		{"client_received_bytes_total", "counter", "Bytes received from a client, through its shared ring included."},
+		{"client_events_total", "counter", "Events received from a client."},
+		{"client_frames_total", "counter", "Frames of a client scheduled for writing."},
+		{"client_queue_depth", "gauge", "Events in a client's queue."},
+		{"client_age_seconds", "gauge", "Time since the client connected, or the daemon started."},
+	};
+
+	uint64_t now = monotonic_ns();
+	int connected = 0;
+
+	for (uint32_t i=first_conn; i<clients_end; i++) {
+		if (clients[i].active) {
+			connected++;
+		}
+	}
+
+	metric_header(fp, "clients", "gauge", "Connected clients.");
+	fprintf(fp, "ydotoold_clients %d\n", connected);
+
+	metric_header(fp, "timed_queue_depth", "gauge", "Events waiting for timed playback.");
+	fprintf(fp, "ydotoold_timed_queue_depth %u\n", timed_queue_pending());
+
+	for (size_t f=0; f<sizeof(families)/sizeof(families[0]); f++) {
+		metric_header(fp, families[f].name, families[f].type, families[f].help);
+
+		for (uint32_t idx=0; idx<clients_end; idx++) {
+			const struct client *c = &clients[idx];
+			char label[64 + INSTANCE_NAME_MAX];
+
+			if (!c->active) {
+				continue;
+			}
+
+			client_label(idx, label, sizeof(label));
+
+			double values[] = {
+				c->counters.datagrams,
+				c->counters.bytes,
+				c->counters.events,
+				c->counters.frames,
+				queue_len(c),
+				(now - c->since) / 1e9,
+			};
+
+			fprintf(fp, "ydotoold_%s{%s} %.15g\n", families[f].name, label, values[f]);
+		}
+	}
+}
+
+void show_stats() {
+	int connected = 0;
+
+	for (uint32_t i=first_conn; i<clients_end; i++) {
+		if (clients[i].active) {
+			connected++;
+		}
+	}
+
+	printf("Receive stats: %" PRIu64 " datagrams, %" PRIu64 " events, %" PRIu64 " wakeups, %" PRIu64 " uinput writes\n",
+	       stats.datagrams, stats.events, stats.wakeups, stats.writes);
+	printf("Dropped: %" PRIu64 " datagrams that weren't whole events\n", stats.datagrams_dropped);
+	printf("Average batch size: %.2f datagrams per wakeup\n",
+	       stats.wakeups ? (double)stats.datagrams / stats.wakeups : 0.0);
+	printf("Timed playback: %" PRIu64 " events queued, %u pending, %" PRIu64 " datagrams rejected\n",
+	       stats.timed_events, timed_queue_pending(), stats.timed_rejected);
+	printf("Scheduler: %" PRIu64 " frames, %" PRIu64 " deferred for held keys\n",
+	       stats.frames, stats.deferred);
+	printf("Clients: %d connected, %" PRIu64 " connections total, told busy %" PRIu64 " times\n",
+	       connected, stats.connections, stats.busy);
+
+	if (instance_count > 1) {
+		printf("Instances: %u\n", instance_count);
+	}
+
+	printf("Delivery: %" PRIu64 " barriers, %" PRIu64 " uinput write errors\n",
+	       stats.syncs, stats.write_errors);
+	printf("Verification: %s, %" PRIu64 " key events written, %" PRIu64 " read back, %" PRIu64 " lost, "
+	       "%" PRIu64 " unexpected, %" PRIu64 " overflows\n",
+	       verify_enabled() ? "on" : "off", stats.verify_expected, stats.verify_seen, stats.verify_lost,
+	       stats.verify_unexpected, stats.verify_overflows);
+	printf("Coalescing: %s, %" PRIu64 " frames merged, %" PRIu64 " events saved\n",
+	       coalesce_rel ? "on" : "off", stats.coalesced, stats.coalesced_events);
+	printf("Macros: %u stored, %u events, %" PRIu64 " played, %" PRIu64 " events queued\n",
+	       macros_count(), macros_events(), stats.macro_plays, stats.macro_events);
+	printf("Shared rings: %" PRIu64 " set up, %" PRIu64 " events, %" PRIu64 " doorbells\n",
+	       stats.rings, stats.ring_events, stats.doorbells);
+	fflush(stdout);
+}
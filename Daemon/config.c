@@ -0,0 +1,247 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+/*
+    Instances of --config, an INI style file:
+
+        # Comment
+        [seat0]
+        socket-path = /run/ydotoold/seat0.sock
+        socket-perm = 0660
+        socket-own = 1000:1000
+        device-name = ydotoold seat0
+        capabilities = keyboard,mouse,touch
+        keys = pc
+        absolute = 1920x1080
+
+    A section starts from the settings of the command line, except for the
+    socket path, which every section must have and no two may share.
+*/
+
+#include "ydotoold.h"
+
+#include <ctype.h>
+
+static char *trim(char *s) {
+	while (isspace((unsigned char)*s)) {
+		s++;
+	}
+
+	char *end = s + strlen(s);
+
+	while (end > s && isspace((unsigned char)end[-1])) {
+		*--end = 0;
+	}
+
+	return s;
+}
+
+// Returns -1 for a word that isn't a capability
+static int capabilities_parse(char *list, enum ydotool_uinput_setup_options *setup) {
+	*setup = 0;
+
+	for (char *word = strtok(list, ","); word; word = strtok(NULL, ",")) {
+		word = trim(word);
+
+		if (strcmp(word, "keyboard") == 0) {
+			*setup |= ENABLE_KEY;
+		} else if (strcmp(word, "mouse") == 0) {
+			*setup |= ENABLE_REL;
+		} else if (strcmp(word, "touch") == 0) {
+			*setup |= ENABLE_ABS;
+		} else {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// Names of --keys, also taken by the keys setting
+int key_profile_parse(const char *name, enum ydotool_key_profile *keys) {
+	if (strcmp(name, "full") == 0) {
+		*keys = KEYS_FULL;
+	} else if (strcmp(name, "pc") == 0) {
+		*keys = KEYS_PC;
+	} else if (strcmp(name, "buttons") == 0) {
+		*keys = KEYS_BUTTONS;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+// Returns an error message, or NULL
+static const char *option_set(struct instance_config *cfg, const char *key, char *value) {
+	if (strcmp(key, "socket-path") == 0) {
+		if (strlen(value) >= sizeof(cfg->socket_path)) {
+			return "socket path too long";
+		}
+
+		strcpy(cfg->socket_path, value);
+	} else if (strcmp(key, "socket-perm") == 0) {
+		snprintf(cfg->socket_perm, sizeof(cfg->socket_perm), "%s", value);
+	} else if (strcmp(key, "socket-own") == 0) {
+		if (!strchr(value, ':')) {
+			return "invalid ownership specification";
+		}
+
+		snprintf(cfg->socket_own, sizeof(cfg->socket_own), "%s", value);
+	} else if (strcmp(key, "device-name") == 0) {
+		snprintf(cfg->device_name, sizeof(cfg->device_name), "%s", value);
+	} else if (strcmp(key, "capabilities") == 0) {
+		if (capabilities_parse(value, &cfg->setup)) {
+			return "capabilities are keyboard, mouse and touch";
+		}
+	} else if (strcmp(key, "keys") == 0) {
+		if (key_profile_parse(value, &cfg->keys)) {
+			return "keys are full, pc or buttons";
+		}
+	} else if (strcmp(key, "absolute") == 0) {
+		if (sscanf(value, "%dx%d", &cfg->abs_width, &cfg->abs_height) != 2
+		    || cfg->abs_width < 2 || cfg->abs_height < 2) {
+			return "invalid screen size";
+		}
+	} else if (strcmp(key, "simulate") == 0) {
+		cfg->simulate = strdup(value);
+	} else {
+		return "unknown setting";
+	}
+
+	return NULL;
+}
+
+// Returns NULL if the section is fine
+static const char *section_check(const struct instance_config *cfg, const struct instance_config *prev, int count) {
+	if (!cfg->socket_path[0]) {
+		return "no socket-path";
+	}
+
+	for (int i=0; i<count; i++) {
+		if (strcmp(prev[i].name, cfg->name) == 0) {
+			return "name used twice";
+		}
+
+		if (strcmp(prev[i].socket_path, cfg->socket_path) == 0) {
+			return "socket path used twice";
+		}
+	}
+
+	return NULL;
+}
+
+// Returns the number of instances, or -1 after printing what's wrong
+int config_load(const char *path, const struct instance_config *defaults, struct instance_config *out) {
+	FILE *fp = fopen(path, "r");
+
+	if (!fp) {
+		printf("failed to open `%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	char *line = NULL;
+	size_t line_cap = 0;
+	int lineno = 0;
+	int count = 0;
+	int section_line = 0;
+	const char *err = NULL;
+
+	while (!err && getline(&line, &line_cap, fp) >= 0) {
+		char *s = trim(line);
+
+		lineno++;
+
+		if (!*s || *s == '#' || *s == ';') {
+			continue;
+		}
+
+		if (*s == '[') {
+			char *end = strchr(s, ']');
+
+			if (count && (err = section_check(&out[count - 1], out, count - 1))) {
+				lineno = section_line;
+				break;
+			}
+
+			if (!end || end[1] || end == s + 1) {
+				err = "invalid section";
+			} else if (end - s - 1 >= INSTANCE_NAME_MAX) {
+				err = "instance name too long";
+			} else if (count == INSTANCES_MAX) {
+				err = "too many instances";
+			} else {
+				*end = 0;
+
+				out[count] = *defaults;
+				out[count].socket_path[0] = 0;
+				snprintf(out[count].name, sizeof(out[count].name), "%s", s + 1);
+
+				count++;
+				section_line = lineno;
+			}
+			continue;
+		}
+
+		char *eq = strchr(s, '=');
+
+		if (!count) {
+			err = "setting outside of a section";
+		} else if (!eq) {
+			err = "expected key = value";
+		} else {
+			*eq = 0;
+			err = option_set(&out[count - 1], trim(s), trim(eq + 1));
+		}
+	}
+
+	if (!err && count && (err = section_check(&out[count - 1], out, count - 1))) {
+		lineno = section_line;
+	}
+
+	if (!err && !count) {
+		err = "no instances";
+	}
+
+	free(line);
+	fclose(fp);
+
+	if (err) {
+		printf("%s:%d: %s\n", path, lineno, err);
+		return -1;
+	}
+
+	return count;
+}
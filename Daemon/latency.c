@@ -0,0 +1,192 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+/*
+    Latency trace, with --trace.
+
+    Every frame gets a record in a fixed ring when its SYN_REPORT is
+    queued, with the client's send stamp if it made one. The record's
+    number rides along in the seconds field of the queued SYN_REPORT, which
+    uinput ignores, so scheduling the frame can find it again, unless the
+    ring has wrapped around since. Frames scheduled since the last write
+    get its start and duration.
+
+    The ring goes to the trace file on SIGUSR2, or to a connection that
+    asks for it with YDOTOOL_CTL_TRACE, in the format of protocol.h.
+*/
+
+#include "ydotoold.h"
+
+#include <sys/uio.h>
+
+// Frames scheduled between two writes that get the time of the write
+#define PENDING_MAX	8192
+
+bool tracing = false;
+
+static const char *trace_path = NULL;
+
+static struct ydotool_trace_record *ring = NULL;
+static uint32_t next_seq = 1;
+
+static uint32_t pending[PENDING_MAX];
+static uint32_t pending_len = 0;
+
+int latency_trace_setup(const char *path) {
+	ring = calloc(LATENCY_TRACE_MAX, sizeof(*ring));
+
+	if (!ring) {
+		return -1;
+	}
+
+	trace_path = path;
+	tracing = true;
+
+	return 0;
+}
+
+static struct ydotool_trace_record *record_find(uint32_t seq) {
+	struct ydotool_trace_record *r = &ring[seq & (LATENCY_TRACE_MAX - 1)];
+
+	return seq && r->seq == seq ? r : NULL;
+}
+
+// Returns the number of the new record
+uint32_t latency_frame_queued(uint32_t client, const struct input_event *syn, bool stamped) {
+	uint32_t seq = next_seq++;
+
+	// 0 marks a SYN_REPORT without a record
+	if (!seq) {
+		seq = next_seq++;
+	}
+
+	struct ydotool_trace_record *r = &ring[seq & (LATENCY_TRACE_MAX - 1)];
+
+	memset(r, 0, sizeof(*r));
+	r->seq = seq;
+	r->client = client;
+	r->received_ns = monotonic_ns();
+
+	if (stamped) {
+		r->sent_ns = (uint64_t)syn->input_event_sec * 1000000000 + (uint64_t)syn->input_event_usec * 1000;
+	}
+
+	return seq;
+}
+
+void latency_frame_scheduled(uint32_t seq, uint32_t events) {
+	struct ydotool_trace_record *r = record_find(seq);
+
+	if (r && pending_len < PENDING_MAX) {
+		r->events = events;
+		pending[pending_len++] = seq;
+	}
+}
+
+void latency_frames_written(uint64_t start, uint64_t end) {
+	for (uint32_t i=0; i<pending_len; i++) {
+		struct ydotool_trace_record *r = record_find(pending[i]);
+
+		if (r) {
+			r->write_ns = start;
+			r->write_dur_ns = end - start;
+		}
+	}
+
+	pending_len = 0;
+}
+
+// The header and the records, oldest first, in one go
+static int trace_write(int fd, size_t *len) {
+	uint32_t count = next_seq - 1 < LATENCY_TRACE_MAX ? next_seq - 1 : LATENCY_TRACE_MAX;
+	uint32_t first = (next_seq - count) & (LATENCY_TRACE_MAX - 1);
+	uint32_t wrapped = first + count > LATENCY_TRACE_MAX ? first + count - LATENCY_TRACE_MAX : 0;
+
+	struct ydotool_trace_header hdr = {
+		.magic = YDOTOOL_TRACE_MAGIC,
+		.version = YDOTOOL_TRACE_VERSION,
+		.record_size = sizeof(struct ydotool_trace_record),
+		.count = count
+	};
+
+	struct iovec iov[3] = {
+		{&hdr, sizeof(hdr)},
+		{&ring[first], (size_t)(count - wrapped) * sizeof(*ring)},
+		{&ring[0], (size_t)wrapped * sizeof(*ring)},
+	};
+
+	*len = sizeof(hdr) + (size_t)count * sizeof(*ring);
+
+	return writev(fd, iov, 3) == *len ? 0 : -1;
+}
+
+int latency_trace_memfd(size_t *len) {
+	if (!tracing) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	int fd = memfd_create("ydotoold-trace", MFD_CLOEXEC);
+
+	if (fd >= 0 && trace_write(fd, len)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+void latency_trace_save() {
+	if (!tracing) {
+		puts("Latency trace: off, start with --trace");
+		return;
+	}
+
+	int fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	size_t len;
+
+	if (fd < 0 || trace_write(fd, &len)) {
+		printf("failed to save the latency trace to `%s': %s\n", trace_path, strerror(errno));
+	} else {
+		printf("Latency trace: %zu bytes saved to %s\n", len, trace_path);
+	}
+
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	fflush(stdout);
+}
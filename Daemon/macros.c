@@ -0,0 +1,364 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+/*
+    Named macros.
+
+    A macro is a sequence of events with their offsets from its start, as
+    timed playback takes them. All of them live back to back in one arena,
+    a definition being uploaded is collected at its end and becomes a macro
+    when complete. Replacing or deleting a macro moves the ones after it
+    down, which is fine for something that changes a few times a day.
+
+    With a file set, the macros are loaded from it at startup and it is
+    rewritten whenever one changes. The file is a header, the table and the
+    arena as they are in memory, so it only suits the machine it was
+    written on.
+
+    Saving happens in the event loop, so it isn't flushed to disk: that
+    would stall every client until the disk is done. The new file is
+    renamed over the old one, which is all or nothing, and the kernel
+    writes it back a little later.
+*/
+
+#include "ydotoold.h"
+
+#include <sys/uio.h>
+
+#define MACRO_FILE_MAGIC	0x434d4459	// "YDMC"
+#define MACRO_FILE_VERSION	1
+
+struct macro {
+	char name[YDOTOOL_MACRO_NAME_MAX];
+	uint32_t start;		// In the arena
+	uint32_t len;
+};
+
+struct macro_file_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;	// sizeof(struct input_event) of the writer
+	uint32_t count;
+	uint32_t events;
+	uint32_t reserved;
+};
+
+static struct macro macros[MACROS_MAX];
+static uint32_t macro_count = 0;
+
+static struct input_event arena[MACRO_ARENA_MAX];
+static uint32_t arena_used = 0;
+
+static const char *macro_path = NULL;
+
+// Definition being uploaded, at arena_used
+static struct {
+	bool active;
+	uint32_t client;
+	uint32_t generation;
+	char name[YDOTOOL_MACRO_NAME_MAX];
+	uint32_t len;
+	int err;		// Reported at the end
+} def;
+
+int macro_name_get(const struct input_event *rec, size_t count, char *name) {
+	if (count < 1 + YDOTOOL_MACRO_NAME_RECORDS) {
+		return -1;
+	}
+
+	memcpy(name, rec + 1, YDOTOOL_MACRO_NAME_MAX);
+
+	if (!name[0] || !memchr(name, 0, YDOTOOL_MACRO_NAME_MAX)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static struct macro *macro_lookup(const char *name) {
+	for (uint32_t i=0; i<macro_count; i++) {
+		if (strcmp(macros[i].name, name) == 0) {
+			return &macros[i];
+		}
+	}
+
+	return NULL;
+}
+
+const struct input_event *macro_find(const char *name, uint32_t *len) {
+	struct macro *m = macro_lookup(name);
+
+	if (!m) {
+		return NULL;
+	}
+
+	*len = m->len;
+
+	return arena + m->start;
+}
+
+uint32_t macros_count() {
+	return macro_count;
+}
+
+uint32_t macros_events() {
+	return arena_used;
+}
+
+static void macro_remove(struct macro *m) {
+	uint32_t end = m->start + m->len;
+
+	// A definition in progress moves along
+	memmove(arena + m->start, arena + end, (arena_used + def.len - end) * sizeof(struct input_event));
+	arena_used -= m->len;
+
+	for (uint32_t i=0; i<macro_count; i++) {
+		if (macros[i].start >= end) {
+			macros[i].start -= m->len;
+		}
+	}
+
+	*m = macros[--macro_count];
+}
+
+static void macros_save() {
+	if (!macro_path) {
+		return;
+	}
+
+	char tmp_path[PATH_MAX];
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", macro_path) >= sizeof(tmp_path)) {
+		fprintf(stderr, "Macro file path too long: %s\n", macro_path);
+		return;
+	}
+
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+	if (fd < 0) {
+		fprintf(stderr, "failed to save macros to `%s': %s\n", tmp_path, strerror(errno));
+		return;
+	}
+
+	struct macro_file_header hdr = {
+		.magic = MACRO_FILE_MAGIC,
+		.version = MACRO_FILE_VERSION,
+		.record_size = sizeof(struct input_event),
+		.count = macro_count,
+		.events = arena_used
+	};
+
+	const struct iovec iov[] = {
+		{&hdr, sizeof(hdr)},
+		{macros, macro_count * sizeof(struct macro)},
+		{arena, arena_used * sizeof(struct input_event)},
+	};
+
+	size_t total = 0;
+
+	for (int i=0; i<sizeof(iov)/sizeof(iov[0]); i++) {
+		total += iov[i].iov_len;
+	}
+
+	// A regular file takes it in one go, anything else is a failure
+	if (writev(fd, iov, sizeof(iov)/sizeof(iov[0])) != total) {
+		fprintf(stderr, "failed to save macros to `%s': %s\n", tmp_path, strerror(errno ? errno : EIO));
+		close(fd);
+		unlink(tmp_path);
+		return;
+	}
+
+	close(fd);
+
+	if (rename(tmp_path, macro_path)) {
+		fprintf(stderr, "failed to save macros to `%s': %s\n", macro_path, strerror(errno));
+		unlink(tmp_path);
+	}
+}
+
+// A file we can't read is left alone, the macros are then kept in memory only
+int macros_load(const char *path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		if (errno != ENOENT) {
+			return -1;
+		}
+
+		// Nothing saved yet
+		macro_path = path;
+		return 0;
+	}
+
+	struct macro_file_header hdr;
+	int rc = -1;
+
+	errno = EINVAL;
+
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != MACRO_FILE_MAGIC
+	    || hdr.version != MACRO_FILE_VERSION || hdr.record_size != sizeof(struct input_event)
+	    || hdr.count > MACROS_MAX || hdr.events > MACRO_ARENA_MAX) {
+		goto out;
+	}
+
+	size_t table_len = hdr.count * sizeof(struct macro);
+	size_t arena_len = hdr.events * sizeof(struct input_event);
+
+	if (read(fd, macros, table_len) != table_len || read(fd, arena, arena_len) != arena_len) {
+		goto out;
+	}
+
+	for (uint32_t i=0; i<hdr.count; i++) {
+		struct macro *m = &macros[i];
+
+		if (!m->name[0] || !memchr(m->name, 0, sizeof(m->name))
+		    || m->start > hdr.events || m->len > hdr.events - m->start) {
+			goto out;
+		}
+	}
+
+	macro_count = hdr.count;
+	arena_used = hdr.events;
+	macro_path = path;
+	rc = 0;
+
+out:
+	close(fd);
+
+	return rc;
+}
+
+void macro_client_gone(uint32_t client) {
+	if (def.active && def.client == client) {
+		def.active = false;
+		def.len = 0;
+	}
+}
+
+static int macro_commit() {
+	struct macro *old = macro_lookup(def.name);
+
+	if (!def.len) {
+		if (!old) {
+			return -ENOENT;
+		}
+
+		macro_remove(old);
+		return 1;
+	}
+
+	if (old) {
+		macro_remove(old);
+	}
+
+	if (macro_count == MACROS_MAX) {
+		return -ENOSPC;
+	}
+
+	struct macro *m = &macros[macro_count++];
+
+	memcpy(m->name, def.name, sizeof(m->name));
+	m->start = arena_used;
+	m->len = def.len;
+
+	arena_used += def.len;
+
+	return 1;
+}
+
+/*
+    Take one datagram of a definition. Returns 0 while it goes on, then 1
+    once the macro is stored, or -errno.
+*/
+int macro_define(uint32_t client, uint32_t generation, const struct input_event *rec, size_t count) {
+	int32_t flags = rec[0].value;
+	char name[YDOTOOL_MACRO_NAME_MAX];
+
+	if (macro_name_get(rec, count, name)) {
+		return flags & YDOTOOL_MACRO_END ? -EINVAL : 0;
+	}
+
+	bool owner = def.active && def.client == client && def.generation == generation;
+
+	if (flags & YDOTOOL_MACRO_BEGIN) {
+		if (def.active && !owner) {
+			// Someone else is uploading, this one is ignored up to its end
+			return flags & YDOTOOL_MACRO_END ? -EBUSY : 0;
+		}
+
+		def.active = true;
+		def.client = client;
+		def.generation = generation;
+		def.len = 0;
+		def.err = 0;
+		memcpy(def.name, name, sizeof(def.name));
+
+		owner = true;
+	}
+
+	if (!owner || strcmp(def.name, name)) {
+		return flags & YDOTOOL_MACRO_END ? -EBUSY : 0;
+	}
+
+	for (size_t i=1+YDOTOOL_MACRO_NAME_RECORDS; i<count && !def.err; i++) {
+		if (rec[i].type == YDOTOOL_EV_CTL) {
+			continue;
+		}
+
+		// Also more than timed playback could ever take at once
+		if (arena_used + def.len == MACRO_ARENA_MAX || def.len == TIMED_QUEUE_MAX) {
+			def.err = ENOSPC;
+			break;
+		}
+
+		arena[arena_used + def.len++] = rec[i];
+	}
+
+	if (!(flags & YDOTOOL_MACRO_END)) {
+		return 0;
+	}
+
+	int rc = def.err ? -def.err : macro_commit();
+
+	def.active = false;
+	def.len = 0;
+
+	if (rc > 0) {
+		macros_save();
+	}
+
+	return rc;
+}
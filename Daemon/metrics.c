@@ -0,0 +1,178 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+/*
+    Metrics for finding out where input gets delayed.
+
+    The daemon is single threaded, so the counters in `stats' and the
+    histograms here are plain variables, and recording is an increment.
+    Histograms have power of 2 buckets from about 1 µs to 8.6 s, finding
+    the bucket is a count of leading zeros.
+
+    - uinput write: how long each write() to a device takes.
+    - Queue delay: from when a frame was queued (due, for timed playback)
+      to when it is scheduled, in whole wakeups: frames that wait for
+      another client's held keys or a full output show up here.
+    - Wakeup: from epoll_wait() returning until everything is written.
+
+    A connection asks for YDOTOOL_CTL_STATS and gets the metrics in the
+    Prometheus text format, in a memfd.
+*/
+
+#include "ydotoold.h"
+
+// Upper bound of bucket 0 is 2^HIST_SHIFT ns
+#define HIST_SHIFT	10
+
+struct histogram hist_write;
+struct histogram hist_queue;
+struct histogram hist_wakeup;
+
+uint32_t wake_us = 0;
+
+void hist_add(struct histogram *h, uint64_t ns) {
+	int i = ns >> HIST_SHIFT ? 64 - __builtin_clzll(ns >> HIST_SHIFT) : 0;
+
+	if (i < HIST_BUCKETS) {
+		h->bucket[i]++;
+	}
+
+	h->count++;
+	h->sum_ns += ns;
+}
+
+uint64_t metrics_wakeup() {
+	uint64_t ns = monotonic_ns();
+
+	wake_us = ns / 1000;
+
+	return ns;
+}
+
+void metrics_wakeup_end(uint64_t woke) {
+	hist_add(&hist_wakeup, monotonic_ns() - woke);
+}
+
+void metric_header(FILE *fp, const char *name, const char *type, const char *help) {
+	fprintf(fp, "# HELP ydotoold_%s %s\n# TYPE ydotoold_%s %s\n", name, help, name, type);
+}
+
+static void metric(FILE *fp, const char *name, const char *type, const char *help, uint64_t value) {
+	metric_header(fp, name, type, help);
+	fprintf(fp, "ydotoold_%s %" PRIu64 "\n", name, value);
+}
+
+static void metric_histogram(FILE *fp, const char *name, const char *help, const struct histogram *h) {
+	uint64_t total = 0;
+
+	metric_header(fp, name, "histogram", help);
+
+	for (int i=0; i<HIST_BUCKETS; i++) {
+		total += h->bucket[i];
+		fprintf(fp, "ydotoold_%s_bucket{le=\"%.9g\"} %" PRIu64 "\n",
+			name, (double)(1ULL << (HIST_SHIFT + i)) / 1e9, total);
+	}
+
+	fprintf(fp, "ydotoold_%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", name, h->count);
+	fprintf(fp, "ydotoold_%s_sum %.9f\n", name, h->sum_ns / 1e9);
+	fprintf(fp, "ydotoold_%s_count %" PRIu64 "\n", name, h->count);
+}
+
+static void metrics_write(FILE *fp) {
+	metric(fp, "wakeups_total", "counter", "Wakeups that received datagrams.", stats.wakeups);
+	metric(fp, "datagrams_total", "counter", "Datagrams and messages received.", stats.datagrams);
+	metric(fp, "datagrams_dropped_total", "counter", "Datagrams dropped for not being whole events.", stats.datagrams_dropped);
+	metric(fp, "received_bytes_total", "counter", "Bytes received, through shared rings included.", stats.bytes);
+	metric(fp, "events_received_total", "counter", "Events received, through shared rings included.", stats.events);
+	metric(fp, "frames_total", "counter", "Frames scheduled for writing.", stats.frames);
+	metric(fp, "frames_deferred_total", "counter", "Times a frame waited for another client's held keys.", stats.deferred);
+	metric(fp, "uinput_writes_total", "counter", "write() calls to uinput.", stats.writes);
+	metric(fp, "uinput_events_total", "counter", "Events written to uinput.", stats.events_written);
+	metric(fp, "uinput_write_errors_total", "counter", "Failed writes to uinput.", stats.write_errors);
+	metric(fp, "timed_events_total", "counter", "Events queued for timed playback.", stats.timed_events);
+	metric(fp, "timed_rejected_total", "counter", "Timed datagrams dropped whole, the timed queue was full.", stats.timed_rejected);
+	metric(fp, "connections_total", "counter", "Connections accepted.", stats.connections);
+	metric(fp, "busy_total", "counter", "Times a connection was told that its queue is full.", stats.busy);
+	metric(fp, "syncs_total", "counter", "Delivery barriers.", stats.syncs);
+	metric(fp, "coalesced_frames_total", "counter", "Motion frames merged into the one before them.", stats.coalesced);
+	metric(fp, "ring_events_total", "counter", "Events taken from shared rings.", stats.ring_events);
+	metric(fp, "doorbells_total", "counter", "Doorbells rung by shared ring producers.", stats.doorbells);
+	metric(fp, "macro_plays_total", "counter", "Macros played.", stats.macro_plays);
+	metric(fp, "macros", "gauge", "Macros stored.", macros_count());
+
+	if (verify_enabled()) {
+		metric(fp, "verify_expected_total", "counter", "Key events written that the device must pass on.", stats.verify_expected);
+		metric(fp, "verify_lost_total", "counter", "Key events written and not read back.", stats.verify_lost);
+		metric(fp, "verify_overflows_total", "counter", "Overflows of the read back buffer.", stats.verify_overflows);
+	}
+
+	metric_histogram(fp, "uinput_write_seconds", "Duration of write() calls to uinput.", &hist_write);
+	metric_histogram(fp, "queue_delay_seconds", "Time frames spent queued in the daemon, in whole wakeups.", &hist_queue);
+	metric_histogram(fp, "wakeup_seconds", "Time from a wakeup until everything is written.", &hist_wakeup);
+
+	clients_metrics(fp);
+}
+
+// Returns a memfd holding the metrics, or -1
+int metrics_memfd(size_t *len) {
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *fp = open_memstream(&buf, &size);
+
+	if (!fp) {
+		return -1;
+	}
+
+	metrics_write(fp);
+
+	if (fclose(fp)) {
+		free(buf);
+		return -1;
+	}
+
+	int fd = memfd_create("ydotoold-stats", MFD_CLOEXEC);
+
+	if (fd >= 0 && write(fd, buf, size) != size) {
+		close(fd);
+		fd = -1;
+	}
+
+	free(buf);
+
+	*len = size;
+
+	return fd;
+}
@@ -0,0 +1,189 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+/*
+    Real-time mode, with --realtime and --cpus.
+
+    Each step is tried on its own and reported as it turned out, so that a
+    daemon without the privileges still starts, just without the guarantees.
+    The scheduling policy isn't passed on to xinput and other children.
+*/
+
+#include "ydotoold.h"
+
+#include <sched.h>
+
+#include <sys/resource.h>
+
+// Stack touched before locking, more than the main loop ever uses
+#define PREFAULT_STACK		(256 * 1024)
+
+// Write to every page, without changing what's there
+void prefault(void *buf, size_t len) {
+	volatile uint8_t *p = buf;
+	long page = sysconf(_SC_PAGESIZE);
+
+	for (size_t off=0; off<len; off+=page) {
+		p[off] = p[off];
+	}
+
+	if (len) {
+		p[len - 1] = p[len - 1];
+	}
+}
+
+static void __attribute__((noinline)) prefault_stack() {
+	volatile uint8_t buf[PREFAULT_STACK];
+
+	for (size_t off=0; off<sizeof(buf); off+=4096) {
+		buf[off] = 0;
+	}
+}
+
+// Parses "0-3,6" into set, returns -1 if it isn't a valid list
+static int cpus_parse(const char *list, cpu_set_t *set) {
+	CPU_ZERO(set);
+
+	while (*list) {
+		char *end;
+		long first = strtol(list, &end, 10);
+		long last = first;
+
+		if (end == list) {
+			return -1;
+		}
+
+		if (*end == '-') {
+			list = end + 1;
+			last = strtol(list, &end, 10);
+
+			if (end == list) {
+				return -1;
+			}
+		}
+
+		if (first < 0 || last < first || last >= CPU_SETSIZE) {
+			return -1;
+		}
+
+		for (long cpu=first; cpu<=last; cpu++) {
+			CPU_SET(cpu, set);
+		}
+
+		if (*end == ',') {
+			end++;
+		} else if (*end) {
+			return -1;
+		}
+
+		list = end;
+	}
+
+	return CPU_COUNT(set) ? 0 : -1;
+}
+
+int realtime_cpus_check(const char *list) {
+	cpu_set_t set;
+
+	return cpus_parse(list, &set);
+}
+
+static void realtime_pin(const char *list) {
+	cpu_set_t set;
+
+	cpus_parse(list, &set);
+
+	if (sched_setaffinity(0, sizeof(set), &set)) {
+		printf("CPUs: not pinned to %s: %s\n", list, strerror(errno));
+	} else {
+		printf("CPUs: pinned to %s\n", list);
+	}
+}
+
+// MCL_FUTURE past RLIMIT_MEMLOCK would make later mmap()s of client rings fail
+static void realtime_lock() {
+	struct rlimit rl;
+	int flags = MCL_CURRENT;
+
+	if (geteuid() == 0 || (!getrlimit(RLIMIT_MEMLOCK, &rl) && rl.rlim_cur == RLIM_INFINITY)) {
+		flags |= MCL_FUTURE;
+	}
+
+	if (mlockall(flags)) {
+		printf("Memory: not locked: %s, see RLIMIT_MEMLOCK\n", strerror(errno));
+	} else {
+		printf("Memory: locked%s\n", flags & MCL_FUTURE ? ", with later allocations" : "");
+	}
+}
+
+static void realtime_schedule(int prio) {
+	struct rlimit rl;
+	int max = sched_get_priority_max(SCHED_FIFO);
+
+	if (prio > max) {
+		prio = max;
+	}
+
+	// Without CAP_SYS_NICE, RLIMIT_RTPRIO caps the priority
+	if (geteuid() != 0 && !getrlimit(RLIMIT_RTPRIO, &rl) && rl.rlim_cur != RLIM_INFINITY
+	    && rl.rlim_cur > 0 && rl.rlim_cur < (rlim_t)prio) {
+		prio = rl.rlim_cur;
+	}
+
+	struct sched_param sp = {
+		.sched_priority = prio
+	};
+
+	if (sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK, &sp)) {
+		printf("Scheduling: SCHED_FIFO not allowed, staying at SCHED_OTHER: %s, see RLIMIT_RTPRIO\n", strerror(errno));
+	} else {
+		printf("Scheduling: SCHED_FIFO, priority %d\n", prio);
+	}
+}
+
+void realtime_setup(int prio, const char *cpus) {
+	if (cpus) {
+		realtime_pin(cpus);
+	}
+
+	if (prio) {
+		clients_prefault();
+		prefault_stack();
+		realtime_lock();
+		realtime_schedule(prio);
+	}
+
+	fflush(stdout);
+}
@@ -0,0 +1,281 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+/*
+    Startup: waiting for the devices to be usable, xinput, and the timing
+    of --startup-trace.
+
+    Events written to a device before udev is done with it are lost on the
+    compositor, which only opens the node once udev announces it. Instead
+    of sleeping for a fixed time, we wait until udev has written its
+    database entry of each device node, which it does right before the
+    announcement.
+*/
+
+#include "ydotoold.h"
+
+#include <poll.h>
+
+#include <sys/inotify.h>
+#include <sys/sysmacros.h>
+#include <sys/wait.h>
+
+#define UDEV_DATA_DIR	"/run/udev/data"
+
+static const char *phase_names[STARTUP_PHASES] = {
+	[STARTUP_OPTIONS] = "options",
+	[STARTUP_UINPUT] = "uinput devices",
+	[STARTUP_SOCKETS] = "sockets",
+	[STARTUP_SETUP] = "trace, macros",
+	[STARTUP_SETTLE] = "waiting for udev, verify",
+	[STARTUP_LOOP] = "event loop",
+	[STARTUP_REALTIME] = "real-time setup",
+};
+
+static uint64_t phase_ns[STARTUP_PHASES];
+static enum startup_phase phase_current;
+static uint64_t phase_since;
+static uint64_t startup_begin;
+
+// The time since the last call goes to the phase it started, cheap enough to be always on
+void startup_phase(enum startup_phase phase) {
+	uint64_t now = monotonic_ns();
+
+	if (startup_begin) {
+		phase_ns[phase_current] += now - phase_since;
+	} else {
+		startup_begin = now;
+	}
+
+	phase_current = phase;
+	phase_since = now;
+}
+
+void startup_report() {
+	startup_phase(phase_current);
+
+	puts("Startup trace:");
+
+	for (int i=0; i<STARTUP_PHASES; i++) {
+		printf("  %-24s %9.3f ms\n", phase_names[i], phase_ns[i] / 1e6);
+	}
+
+	printf("  %-24s %9.3f ms\n", "total", (phase_since - startup_begin) / 1e6);
+
+	fflush(stdout);
+}
+
+// Whether udev is done with the device node of a uinput device
+static bool device_settled(int fd_ui) {
+	char path[PATH_MAX];
+	struct stat st;
+
+	if (evdev_node_find(fd_ui, path, sizeof(path)) || stat(path, &st)) {
+		return false;
+	}
+
+	snprintf(path, sizeof(path), UDEV_DATA_DIR "/c%u:%u", major(st.st_rdev), minor(st.st_rdev));
+
+	return access(path, F_OK) == 0;
+}
+
+static uint32_t devices_unsettled() {
+	uint32_t n = 0;
+
+	for (uint32_t i=0; i<instance_count; i++) {
+		struct instance *in = &instances[i];
+
+		if (in->simulated) {
+			continue;
+		}
+
+		n += !device_settled(in->fd_uinput);
+
+		if (in->fd_uinput_abs >= 0) {
+			n += !device_settled(in->fd_uinput_abs);
+		}
+	}
+
+	return n;
+}
+
+void devices_settle(int timeout_ms) {
+	// Without udev, the node is there as soon as the device is
+	if (access(UDEV_DATA_DIR, F_OK)) {
+		return;
+	}
+
+	// Watched before looking, so that an entry written in between still wakes us up
+	int fd_notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (fd_notify >= 0 && inotify_add_watch(fd_notify, UDEV_DATA_DIR, IN_CREATE | IN_MOVED_TO) < 0) {
+		close(fd_notify);
+		fd_notify = -1;
+	}
+
+	uint64_t deadline = monotonic_ns() + (uint64_t)timeout_ms * 1000000;
+	uint32_t pending;
+
+	while ((pending = devices_unsettled())) {
+		uint64_t now = monotonic_ns();
+
+		if (now >= deadline) {
+			printf("udev isn't done with %u device(s) after %d ms, not waiting any longer\n", pending, timeout_ms);
+			break;
+		}
+
+		// Looked at again now and then, in case the node appeared without an entry being written
+		int wait_ms = (deadline - now) / 1000000 + 1;
+		struct pollfd pfd = {.fd = fd_notify, .events = POLLIN};
+
+		if (poll(&pfd, 1, wait_ms < 50 ? wait_ms : 50) > 0) {
+			char buf[4096];
+
+			while (read(fd_notify, buf, sizeof(buf)) > 0) {
+			}
+		}
+	}
+
+	if (fd_notify >= 0) {
+		close(fd_notify);
+	}
+}
+
+// Runs xinput once, quietly, returns its exit status
+static int xinput_run(const char *xinput_path, const char *pointer) {
+	pid_t pid = fork();
+
+	if (pid == 0) {
+		int fd_null = open("/dev/null", O_WRONLY);
+
+		if (fd_null >= 0) {
+			dup2(fd_null, STDOUT_FILENO);
+			dup2(fd_null, STDERR_FILENO);
+		}
+
+		execl(xinput_path, "xinput", "--set-prop", pointer, "libinput Accel Profile Enabled", "0,", "1", NULL);
+		_exit(127);
+	} else if (pid < 0) {
+		return -1;
+	}
+
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+		return -1;
+	}
+
+	return WEXITSTATUS(status);
+}
+
+/*
+    Turn off pointer acceleration in X for the uinput devices. X picks a
+    device up some time after udev announces it, so a child process keeps
+    trying for a while, and startup doesn't wait for it.
+*/
+void xinput_accel_off(const struct instance_config *configs) {
+	const char *xinput_path = "/usr/bin/xinput";
+
+	if (access(xinput_path, X_OK)) {
+		printf("xinput command not found in `%s', not disabling mouse pointer acceleration\n", xinput_path);
+		return;
+	}
+
+	// Nobody waits for the child
+	struct sigaction sa_chld = {
+		.sa_handler = SIG_DFL,
+		.sa_flags = SA_NOCLDWAIT
+	};
+
+	sigaction(SIGCHLD, &sa_chld, NULL);
+
+	// Or what is buffered would be printed twice
+	fflush(stdout);
+
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		perror("failed to fork");
+		return;
+	} else if (pid > 0) {
+		return;
+	}
+
+	// The child waits for xinput after all
+	sa_chld.sa_flags = 0;
+	sigaction(SIGCHLD, &sa_chld, NULL);
+
+	// Don't keep the devices and sockets around if the daemon goes away
+	for (uint32_t i=0; i<instance_count; i++) {
+		struct instance *in = &instances[i];
+
+		close(in->fd_dgram);
+
+		if (in->fd_seq >= 0) {
+			close(in->fd_seq);
+		}
+
+		if (!in->simulated) {
+			close(in->fd_uinput);
+
+			if (in->fd_uinput_abs >= 0) {
+				close(in->fd_uinput_abs);
+			}
+		}
+	}
+
+	uint64_t deadline = monotonic_ns() + (uint64_t)XINPUT_WAIT_MS * 1000000;
+
+	for (uint32_t i=0; i<instance_count; i++) {
+		if (instances[i].simulated) {
+			continue;
+		}
+
+		char pointer[UINPUT_MAX_NAME_SIZE + 8];
+
+		snprintf(pointer, sizeof(pointer), "pointer:%s", configs[i].device_name[0] ? configs[i].device_name : "ydotoold virtual device");
+
+		while (xinput_run(xinput_path, pointer)) {
+			if (monotonic_ns() >= deadline) {
+				fprintf(stderr, "xinput didn't find `%s', mouse pointer acceleration is left on\n", pointer + 8);
+				break;
+			}
+
+			usleep(100 * 1000);
+		}
+	}
+
+	_exit(0);
+}
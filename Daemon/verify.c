@@ -0,0 +1,236 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+/*
+    Delivery verification.
+
+    We open the evdev node of our own device and read back what we wrote to
+    it. The kernel hands events to every reader of the node before write()
+    returns, so right after a write everything has either arrived or is
+    lost: key events that don't show up count as lost.
+
+    The buffer of a reader only holds a few packets' worth of events, so
+    with verification on every frame is written and read back on its own.
+    If our reader's buffer overflows anyway, SYN_DROPPED, what it missed
+    was still delivered to the others and isn't counted as lost.
+
+    Every reader of the node has a buffer of its own, so this checks the
+    daemon's device, not the compositor: what the compositor drops, or a
+    buffer of its own overflowing, isn't seen here.
+
+    Only key events are checked. The input core drops presses of keys that
+    are down and releases of keys that are up, and keys the device doesn't
+    have, so those aren't expected.
+*/
+
+#include "ydotoold.h"
+
+#include <dirent.h>
+
+// Key events written by one uinput write at most
+#define EXPECT_MAX	4096
+
+static int fd_evdev = -1;
+
+static uint8_t key_bits[KEY_CNT / 8];	// Keys the device has
+static uint8_t key_down[KEY_CNT / 8];	// As the input core sees them
+
+static struct {
+	uint16_t code;
+	int32_t value;
+} expect[EXPECT_MAX];
+static size_t expect_len = 0;
+
+static bool bit_test(const uint8_t *bits, uint16_t code) {
+	return bits[code / 8] & (1 << (code % 8));
+}
+
+static void bit_set(uint8_t *bits, uint16_t code, bool on) {
+	if (on) {
+		bits[code / 8] |= 1 << (code % 8);
+	} else {
+		bits[code / 8] &= ~(1 << (code % 8));
+	}
+}
+
+// The eventN node under /sys/devices/virtual/input/<sysname>
+static int node_find(const char *sysname, char *path, size_t len) {
+	char dir_path[PATH_MAX];
+	snprintf(dir_path, sizeof(dir_path), "/sys/devices/virtual/input/%s", sysname);
+
+	DIR *dir = opendir(dir_path);
+
+	if (!dir) {
+		return -1;
+	}
+
+	struct dirent *de;
+	int rc = -1;
+
+	while ((de = readdir(dir))) {
+		if (strncmp(de->d_name, "event", 5) == 0) {
+			snprintf(path, len, "/dev/input/%s", de->d_name);
+			rc = 0;
+			break;
+		}
+	}
+
+	closedir(dir);
+
+	return rc;
+}
+
+// The device node of a uinput device, -1 if the kernel hasn't made it yet
+int evdev_node_find(int fd_ui, char *path, size_t len) {
+	char sysname[64];
+
+	if (ioctl(fd_ui, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) {
+		return -1;
+	}
+
+	return node_find(sysname, path, len);
+}
+
+// Called once devices_settle() is done, the node is there by then
+int verify_setup(int fd_ui) {
+	char path[PATH_MAX];
+
+	if (evdev_node_find(fd_ui, path, sizeof(path))) {
+		fputs("failed to find the device node to verify delivery through\n", stderr);
+		return -1;
+	}
+
+	fd_evdev = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+	if (fd_evdev < 0) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (ioctl(fd_evdev, EVIOCGBIT(EV_KEY, sizeof(key_bits)), key_bits) < 0) {
+		perror("EVIOCGBIT ioctl failed");
+		close(fd_evdev);
+		fd_evdev = -1;
+		return -1;
+	}
+
+	printf("Verifying delivery through %s\n", path);
+
+	return 0;
+}
+
+bool verify_enabled() {
+	return fd_evdev >= 0;
+}
+
+/*
+    A read back event takes the first expected one that matches it, the
+    ones it skips were lost, unless our reader's buffer overflowed.
+*/
+static void verify_match(const struct input_event *ev, bool overflowed) {
+	for (size_t i=0; i<expect_len; i++) {
+		if (expect[i].code == ev->code && expect[i].value == ev->value) {
+			stats.verify_seen++;
+
+			if (!overflowed) {
+				stats.verify_lost += i;
+			}
+
+			expect_len -= i + 1;
+			memmove(&expect[0], &expect[i + 1], expect_len * sizeof(expect[0]));
+			return;
+		}
+	}
+
+	stats.verify_unexpected++;
+}
+
+static void verify_read() {
+	struct input_event buf[64];
+	bool overflowed = false;
+	ssize_t rc;
+
+	while ((rc = read(fd_evdev, buf, sizeof(buf))) > 0) {
+		for (size_t i=0; i<rc / sizeof(buf[0]); i++) {
+			if (buf[i].type == EV_KEY) {
+				verify_match(&buf[i], overflowed);
+			} else if (buf[i].type == EV_SYN && buf[i].code == SYN_DROPPED) {
+				stats.verify_overflows++;
+				overflowed = true;
+			}
+		}
+	}
+
+	// Everything has been delivered by now
+	if (!overflowed) {
+		stats.verify_lost += expect_len;
+	}
+
+	expect_len = 0;
+}
+
+// Events that made it into the device, right after writing them
+void verify_written(const struct input_event *ev, size_t count) {
+	if (fd_evdev < 0) {
+		return;
+	}
+
+	for (size_t i=0; i<count; i++) {
+		uint16_t code = ev[i].code;
+
+		if (ev[i].type != EV_KEY || code >= KEY_CNT || !bit_test(key_bits, code)) {
+			continue;
+		}
+
+		// Autorepeat always passes, anything else only as a change of state
+		if (ev[i].value != 2) {
+			if (bit_test(key_down, code) == !!ev[i].value) {
+				continue;
+			}
+
+			bit_set(key_down, code, ev[i].value);
+		}
+
+		if (expect_len < EXPECT_MAX) {
+			expect[expect_len].code = code;
+			expect[expect_len].value = ev[i].value;
+			expect_len++;
+			stats.verify_expected++;
+		}
+	}
+
+	verify_read();
+}
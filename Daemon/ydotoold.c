@@ -34,45 +34,35 @@
     并将在法律允许的最大范围内被起诉。
 */
 
-#include <assert.h>
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <errno.h>
-#include <time.h>
-#include <signal.h>
-#include <string.h>
-#include <limits.h>
+#include "ydotoold.h"
 
 #include <getopt.h>
 
-#include <unistd.h>
-#include <fcntl.h>
-#include <dirent.h>
-#include <dlfcn.h>
-
-#include <sys/stat.h>
-#include <sys/socket.h>
-#include <sys/stat.h>
-#include <sys/ioctl.h>
-#include <sys/mman.h>
-#include <sys/types.h>
-#include <sys/un.h>
-
-#include <sys/epoll.h>
-
-#include <linux/uinput.h>
+#include <sys/resource.h>
 
 #ifndef VERSION
 #define VERSION "unknown"
 #endif
 
-#define SOCKET_PATH_LEN		108
+// The instance of the command line, and the defaults of the sections of a --config file
+static struct instance_config opt_inst = {
+	.socket_path = "/tmp/.ydotool_socket",
+	.socket_perm = "0600",
+	.setup = ENABLE_REL | ENABLE_KEY
+};
 
-static char opt_socket_path[SOCKET_PATH_LEN] = "/tmp/.ydotool_socket";
-static char opt_socket_perm[16] = "0600";
-static char opt_socket_own[16] = "";
+static bool opt_verify = false;
+static char *opt_config = NULL;
+static char *opt_macro_file = NULL;
+static char *opt_trace = NULL;
+static int opt_realtime = 0;
+static char *opt_cpus = NULL;
+static bool opt_startup_trace = false;
+
+// Long options without a short one
+enum {
+	OPT_STARTUP_TRACE = 256,
+};
 
 static void show_help() {
 	puts(
@@ -86,23 +76,66 @@ static void show_help() {
 		"  -m, --mouse-off            Disable mouse (EV_REL)\n"
 		"  -k, --keyboard-off         Disable keyboard (EV_KEY)\n"
 		"  -T, --touch-on             Enable touchscreen (EV_ABS)\n"
+		"  -K, --keys=PROFILE         Keys the device has: full (default), pc for a PC\n"
+		"                               keyboard and mouse buttons, or buttons\n"
+		"  -A, --absolute=WxH         Add an absolute pointer device covering a screen of\n"
+		"                               W by H pixels, for exact absolute moves\n"
+		"  -c, --coalesce             Merge queued relative motion and wheel frames\n"
+		"                               of a client into one when it falls behind\n"
+		"  -v, --verify               Read the device back and count key events that\n"
+		"                               didn't make it through (verifies the daemon's\n"
+		"                               device, not the compositor)\n"
+		"  -M, --macros=FILE          Load macros from FILE at startup and save them there\n"
+		"                               when they change\n"
+		"  -S, --simulate=PATH        Write events to PATH, a FIFO or file, instead of\n"
+		"                               creating uinput devices (for benchmarks)\n"
+		"  -t, --trace=FILE           Keep the latency of the last frames, saved to\n"
+		"                               FILE on SIGUSR2\n"
+		"  -r, --realtime[=PRIO]      Run at SCHED_FIFO priority PRIO (default: 20) with\n"
+		"                               memory locked and buffers pre-faulted\n"
+		"  -C, --cpus=LIST            Pin to the CPUs in LIST, e.g. 2-3 or 1,5\n"
+		"  -f, --config=FILE          Serve the instances of FILE, each with its own\n"
+		"                               devices and sockets, in one process\n"
+		"      --startup-trace        Print the time each phase of startup took\n"
 		"  -h, --help                 Display this help and exit\n"
 		"  -V, --version              Show version information\n"
+		"\n"
+		"Send SIGUSR1 to print statistics, SIGUSR2 to save the latency trace."
 	);
 }
 
+static volatile sig_atomic_t stats_requested = 0;
+static volatile sig_atomic_t trace_requested = 0;
+
+static void handle_sigusr1(int sig) {
+	stats_requested = 1;
+}
+
+static void handle_sigusr2(int sig) {
+	trace_requested = 1;
+}
+
 static void show_version() {
 	puts("ydotoold version(or hash): ");
 	puts(VERSION);
 }
 
-enum ydotool_uinput_setup_options {
-	ENABLE_KEY = (1 << 0),
-	ENABLE_REL = (1 << 1),
-	ENABLE_ABS = (1 << 2),
-};
+// Whether a key of key_list is declared with a --keys profile
+static bool key_in_profile(int code, enum ydotool_key_profile keys) {
+	bool button = code >= BTN_MOUSE && code <= BTN_TASK;
+
+	switch (keys) {
+		case KEYS_PC:
+			return code <= KEY_COMPOSE || (code >= KEY_F13 && code <= KEY_F24)
+			       || (code >= KEY_NEXTSONG && code <= KEY_STOPCD) || button;
+		case KEYS_BUTTONS:
+			return button;
+		default:
+			return true;
+	}
+}
 
-static void uinput_setup(int fd, enum ydotool_uinput_setup_options setup_opt) {
+static void uinput_setup(int fd, enum ydotool_uinput_setup_options setup_opt, enum ydotool_key_profile keys, const char *name) {
 
 	if (setup_opt & ENABLE_KEY) {
 		if (ioctl(fd, UI_SET_EVBIT, EV_KEY)) {
@@ -112,6 +145,10 @@ static void uinput_setup(int fd, enum ydotool_uinput_setup_options setup_opt) {
 		static const int key_list[] = {KEY_ESC, KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6, KEY_7, KEY_8, KEY_9, KEY_0, KEY_MINUS, KEY_EQUAL, KEY_BACKSPACE, KEY_TAB, KEY_Q, KEY_W, KEY_E, KEY_R, KEY_T, KEY_Y, KEY_U, KEY_I, KEY_O, KEY_P, KEY_LEFTBRACE, KEY_RIGHTBRACE, KEY_ENTER, KEY_LEFTCTRL, KEY_A, KEY_S, KEY_D, KEY_F, KEY_G, KEY_H, KEY_J, KEY_K, KEY_L, KEY_SEMICOLON, KEY_APOSTROPHE, KEY_GRAVE, KEY_LEFTSHIFT, KEY_BACKSLASH, KEY_Z, KEY_X, KEY_C, KEY_V, KEY_B, KEY_N, KEY_M, KEY_COMMA, KEY_DOT, KEY_SLASH, KEY_RIGHTSHIFT, KEY_KPASTERISK, KEY_LEFTALT, KEY_SPACE, KEY_CAPSLOCK, KEY_F1, KEY_F2, KEY_F3, KEY_F4, KEY_F5, KEY_F6, KEY_F7, KEY_F8, KEY_F9, KEY_F10, KEY_NUMLOCK, KEY_SCROLLLOCK, KEY_KP7, KEY_KP8, KEY_KP9, KEY_KPMINUS, KEY_KP4, KEY_KP5, KEY_KP6, KEY_KPPLUS, KEY_KP1, KEY_KP2, KEY_KP3, KEY_KP0, KEY_KPDOT, KEY_ZENKAKUHANKAKU, KEY_102ND, KEY_F11, KEY_F12, KEY_RO, KEY_KATAKANA, KEY_HIRAGANA, KEY_HENKAN, KEY_KATAKANAHIRAGANA, KEY_MUHENKAN, KEY_KPJPCOMMA, KEY_KPENTER, KEY_RIGHTCTRL, KEY_KPSLASH, KEY_SYSRQ, KEY_RIGHTALT, KEY_LINEFEED, KEY_HOME, KEY_UP, KEY_PAGEUP, KEY_LEFT, KEY_RIGHT, KEY_END, KEY_DOWN, KEY_PAGEDOWN, KEY_INSERT, KEY_DELETE, KEY_MACRO, KEY_MUTE, KEY_VOLUMEDOWN, KEY_VOLUMEUP, KEY_POWER, KEY_KPEQUAL, KEY_KPPLUSMINUS, KEY_PAUSE, KEY_SCALE, KEY_KPCOMMA, KEY_HANGEUL, KEY_HANGUEL, KEY_HANJA, KEY_YEN, KEY_LEFTMETA, KEY_RIGHTMETA, KEY_COMPOSE, KEY_STOP, KEY_AGAIN, KEY_PROPS, KEY_UNDO, KEY_FRONT, KEY_COPY, KEY_OPEN, KEY_PASTE, KEY_FIND, KEY_CUT, KEY_HELP, KEY_MENU, KEY_CALC, KEY_SETUP, KEY_SLEEP, KEY_WAKEUP, KEY_FILE, KEY_SENDFILE, KEY_DELETEFILE, KEY_XFER, KEY_PROG1, KEY_PROG2, KEY_WWW, KEY_MSDOS, KEY_COFFEE, KEY_SCREENLOCK, KEY_ROTATE_DISPLAY, KEY_DIRECTION, KEY_CYCLEWINDOWS, KEY_MAIL, KEY_BOOKMARKS, KEY_COMPUTER, KEY_BACK, KEY_FORWARD, KEY_CLOSECD, KEY_EJECTCD, KEY_EJECTCLOSECD, KEY_NEXTSONG, KEY_PLAYPAUSE, KEY_PREVIOUSSONG, KEY_STOPCD, KEY_RECORD, KEY_REWIND, KEY_PHONE, KEY_ISO, KEY_CONFIG, KEY_HOMEPAGE, KEY_REFRESH, KEY_EXIT, KEY_MOVE, KEY_EDIT, KEY_SCROLLUP, KEY_SCROLLDOWN, KEY_KPLEFTPAREN, KEY_KPRIGHTPAREN, KEY_NEW, KEY_REDO, KEY_F13, KEY_F14, KEY_F15, KEY_F16, KEY_F17, KEY_F18, KEY_F19, KEY_F20, KEY_F21, KEY_F22, KEY_F23, KEY_F24, KEY_PLAYCD, KEY_PAUSECD, KEY_PROG3, KEY_PROG4, KEY_DASHBOARD, KEY_SUSPEND, KEY_CLOSE, KEY_PLAY, KEY_FASTFORWARD, KEY_BASSBOOST, KEY_PRINT, KEY_HP, KEY_CAMERA, KEY_SOUND, KEY_QUESTION, KEY_EMAIL, KEY_CHAT, KEY_SEARCH, KEY_CONNECT, KEY_FINANCE, KEY_SPORT, KEY_SHOP, KEY_ALTERASE, KEY_CANCEL, KEY_BRIGHTNESSDOWN, KEY_BRIGHTNESSUP, KEY_MEDIA, KEY_SWITCHVIDEOMODE, KEY_KBDILLUMTOGGLE, KEY_KBDILLUMDOWN, KEY_KBDILLUMUP, KEY_SEND, KEY_REPLY, KEY_FORWARDMAIL, KEY_SAVE, KEY_DOCUMENTS, KEY_BATTERY, KEY_BLUETOOTH, KEY_WLAN, KEY_UWB, KEY_UNKNOWN, KEY_VIDEO_NEXT, KEY_VIDEO_PREV, KEY_BRIGHTNESS_CYCLE, KEY_BRIGHTNESS_AUTO, KEY_BRIGHTNESS_ZERO, KEY_DISPLAY_OFF, KEY_WWAN, KEY_WIMAX, KEY_RFKILL, KEY_MICMUTE, KEY_OK, KEY_SELECT, KEY_GOTO, KEY_CLEAR, KEY_POWER2, KEY_OPTION, KEY_INFO, KEY_TIME, KEY_VENDOR, KEY_ARCHIVE, KEY_PROGRAM, KEY_CHANNEL, KEY_FAVORITES, KEY_EPG, KEY_PVR, KEY_MHP, KEY_LANGUAGE, KEY_TITLE, KEY_SUBTITLE, KEY_ANGLE, KEY_ZOOM, KEY_MODE, KEY_KEYBOARD, KEY_SCREEN, KEY_PC, KEY_TV, KEY_TV2, KEY_VCR, KEY_VCR2, KEY_SAT, KEY_SAT2, KEY_CD, KEY_TAPE, KEY_RADIO, KEY_TUNER, KEY_PLAYER, KEY_TEXT, KEY_DVD, KEY_AUX, KEY_MP3, KEY_AUDIO, KEY_VIDEO, KEY_DIRECTORY, KEY_LIST, KEY_MEMO, KEY_CALENDAR, KEY_RED, KEY_GREEN, KEY_YELLOW, KEY_BLUE, KEY_CHANNELUP, KEY_CHANNELDOWN, KEY_FIRST, KEY_LAST, KEY_AB, KEY_NEXT, KEY_RESTART, KEY_SLOW, KEY_SHUFFLE, KEY_BREAK, KEY_PREVIOUS, KEY_DIGITS, KEY_TEEN, KEY_TWEN, KEY_VIDEOPHONE, KEY_GAMES, KEY_ZOOMIN, KEY_ZOOMOUT, KEY_ZOOMRESET, KEY_WORDPROCESSOR, KEY_EDITOR, KEY_SPREADSHEET, KEY_GRAPHICSEDITOR, KEY_PRESENTATION, KEY_DATABASE, KEY_NEWS, KEY_VOICEMAIL, KEY_ADDRESSBOOK, KEY_MESSENGER, KEY_DISPLAYTOGGLE, KEY_BRIGHTNESS_TOGGLE, KEY_SPELLCHECK, KEY_LOGOFF, KEY_DOLLAR, KEY_EURO, KEY_FRAMEBACK, KEY_FRAMEFORWARD, KEY_CONTEXT_MENU, KEY_MEDIA_REPEAT, KEY_10CHANNELSUP, KEY_10CHANNELSDOWN, KEY_IMAGES, KEY_DEL_EOL, KEY_DEL_EOS, KEY_INS_LINE, KEY_DEL_LINE, KEY_FN, KEY_FN_ESC, KEY_FN_F1, KEY_FN_F2, KEY_FN_F3, KEY_FN_F4, KEY_FN_F5, KEY_FN_F6, KEY_FN_F7, KEY_FN_F8, KEY_FN_F9, KEY_FN_F10, KEY_FN_F11, KEY_FN_F12, KEY_FN_1, KEY_FN_2, KEY_FN_D, KEY_FN_E, KEY_FN_F, KEY_FN_S, KEY_FN_B, KEY_BRL_DOT1, KEY_BRL_DOT2, KEY_BRL_DOT3, KEY_BRL_DOT4, KEY_BRL_DOT5, KEY_BRL_DOT6, KEY_BRL_DOT7, KEY_BRL_DOT8, KEY_BRL_DOT9, KEY_BRL_DOT10, KEY_NUMERIC_0, KEY_NUMERIC_1, KEY_NUMERIC_2, KEY_NUMERIC_3, KEY_NUMERIC_4, KEY_NUMERIC_5, KEY_NUMERIC_6, KEY_NUMERIC_7, KEY_NUMERIC_8, KEY_NUMERIC_9, KEY_NUMERIC_STAR, KEY_NUMERIC_POUND, KEY_NUMERIC_A, KEY_NUMERIC_B, KEY_NUMERIC_C, KEY_NUMERIC_D, KEY_CAMERA_FOCUS, KEY_WPS_BUTTON, KEY_TOUCHPAD_TOGGLE, KEY_TOUCHPAD_ON, KEY_TOUCHPAD_OFF, KEY_CAMERA_ZOOMIN, KEY_CAMERA_ZOOMOUT, KEY_CAMERA_UP, KEY_CAMERA_DOWN, KEY_CAMERA_LEFT, KEY_CAMERA_RIGHT, KEY_ATTENDANT_ON, KEY_ATTENDANT_OFF, KEY_ATTENDANT_TOGGLE, KEY_LIGHTS_TOGGLE, KEY_ALS_TOGGLE, KEY_BUTTONCONFIG, KEY_TASKMANAGER, KEY_JOURNAL, KEY_CONTROLPANEL, KEY_APPSELECT, KEY_SCREENSAVER, KEY_VOICECOMMAND, KEY_BRIGHTNESS_MIN, KEY_BRIGHTNESS_MAX, KEY_KBDINPUTASSIST_PREV, KEY_KBDINPUTASSIST_NEXT, KEY_KBDINPUTASSIST_PREVGROUP, KEY_KBDINPUTASSIST_NEXTGROUP, KEY_KBDINPUTASSIST_ACCEPT, KEY_KBDINPUTASSIST_CANCEL, KEY_RIGHT_UP, KEY_RIGHT_DOWN, KEY_LEFT_UP, KEY_LEFT_DOWN, KEY_ROOT_MENU, KEY_MEDIA_TOP_MENU, KEY_NUMERIC_11, KEY_NUMERIC_12, KEY_AUDIO_DESC, KEY_3D_MODE, KEY_NEXT_FAVORITE, KEY_STOP_RECORD, KEY_PAUSE_RECORD, KEY_VOD, KEY_UNMUTE, KEY_FASTREVERSE, KEY_SLOWREVERSE, KEY_DATA, KEY_MIN_INTERESTING, BTN_MISC, BTN_0, BTN_1, BTN_2, BTN_3, BTN_4, BTN_5, BTN_6, BTN_7, BTN_8, BTN_9, BTN_MOUSE, BTN_LEFT, BTN_RIGHT, BTN_MIDDLE, BTN_SIDE, BTN_EXTRA, BTN_FORWARD, BTN_BACK, BTN_TASK, BTN_JOYSTICK, BTN_TRIGGER, BTN_THUMB, BTN_THUMB2, BTN_TOP, BTN_TOP2, BTN_PINKIE, BTN_BASE, BTN_BASE2, BTN_BASE3, BTN_BASE4, BTN_BASE5, BTN_BASE6, BTN_DEAD, BTN_GAMEPAD, BTN_SOUTH, BTN_A, BTN_EAST, BTN_B, BTN_C, BTN_NORTH, BTN_X, BTN_WEST, BTN_Y, BTN_Z, BTN_TL, BTN_TR, BTN_TL2, BTN_TR2, BTN_SELECT, BTN_START, BTN_MODE, BTN_THUMBL, BTN_THUMBR, BTN_DIGI, BTN_TOOL_PEN, BTN_TOOL_RUBBER, BTN_TOOL_BRUSH, BTN_TOOL_PENCIL, BTN_TOOL_AIRBRUSH, BTN_TOOL_FINGER, BTN_TOOL_MOUSE, BTN_TOOL_LENS, BTN_TOOL_QUINTTAP, BTN_TOUCH, BTN_STYLUS, BTN_STYLUS2, BTN_TOOL_DOUBLETAP, BTN_TOOL_TRIPLETAP, BTN_TOOL_QUADTAP, BTN_WHEEL, BTN_GEAR_DOWN, BTN_GEAR_UP, BTN_DPAD_UP, BTN_DPAD_DOWN, BTN_DPAD_LEFT, BTN_DPAD_RIGHT, BTN_TRIGGER_HAPPY, BTN_TRIGGER_HAPPY1, BTN_TRIGGER_HAPPY2, BTN_TRIGGER_HAPPY3, BTN_TRIGGER_HAPPY4, BTN_TRIGGER_HAPPY5, BTN_TRIGGER_HAPPY6, BTN_TRIGGER_HAPPY7, BTN_TRIGGER_HAPPY8, BTN_TRIGGER_HAPPY9, BTN_TRIGGER_HAPPY10, BTN_TRIGGER_HAPPY11, BTN_TRIGGER_HAPPY12, BTN_TRIGGER_HAPPY13, BTN_TRIGGER_HAPPY14, BTN_TRIGGER_HAPPY15, BTN_TRIGGER_HAPPY16, BTN_TRIGGER_HAPPY17, BTN_TRIGGER_HAPPY18, BTN_TRIGGER_HAPPY19, BTN_TRIGGER_HAPPY20, BTN_TRIGGER_HAPPY21, BTN_TRIGGER_HAPPY22, BTN_TRIGGER_HAPPY23, BTN_TRIGGER_HAPPY24, BTN_TRIGGER_HAPPY25, BTN_TRIGGER_HAPPY26, BTN_TRIGGER_HAPPY27, BTN_TRIGGER_HAPPY28, BTN_TRIGGER_HAPPY29, BTN_TRIGGER_HAPPY30, BTN_TRIGGER_HAPPY31, BTN_TRIGGER_HAPPY32, BTN_TRIGGER_HAPPY33, BTN_TRIGGER_HAPPY34, BTN_TRIGGER_HAPPY35, BTN_TRIGGER_HAPPY36, BTN_TRIGGER_HAPPY37, BTN_TRIGGER_HAPPY38, BTN_TRIGGER_HAPPY39, BTN_TRIGGER_HAPPY40};
 
 		for (int i=0; i<sizeof(key_list)/sizeof(int); i++) {
+			if (!key_in_profile(key_list[i], keys)) {
+				continue;
+			}
+
 			if (ioctl(fd, UI_SET_KEYBIT, key_list[i])) {
 				fprintf(stderr, "UI_SET_KEYBIT %d failed\n", i);
 
@@ -150,7 +187,7 @@ static void uinput_setup(int fd, enum ydotool_uinput_setup_options setup_opt) {
 		}
 	}
 
-	static const struct uinput_setup usetup = {
+	struct uinput_setup usetup = {
 		.name = "ydotoold virtual device",
 		.id = {
 			.bustype = BUS_VIRTUAL,
@@ -160,6 +197,10 @@ static void uinput_setup(int fd, enum ydotool_uinput_setup_options setup_opt) {
 		}
 	};
 
+	if (name[0]) {
+		snprintf(usetup.name, sizeof(usetup.name), "%s", name);
+	}
+
 	if (ioctl(fd, UI_DEV_SETUP, &usetup)) {
 		perror("UI_DEV_SETUP ioctl failed");
 		exit(2);
@@ -172,16 +213,266 @@ static void uinput_setup(int fd, enum ydotool_uinput_setup_options setup_opt) {
 
 }
 
+/*
+    Second device for absolute pointer moves, like the tablet of a virtual
+    machine. Compositors map the axis ranges onto the screen, so with the
+    screen size as the range, a position is in pixels.
+*/
+static void uinput_setup_abs(int fd, int width, int height, const char *name) {
+	if (ioctl(fd, UI_SET_EVBIT, EV_ABS)) {
+		fprintf(stderr, "UI_SET_EVBIT %s failed\n", "EV_ABS");
+	}
+
+	// Without buttons udev doesn't take it for a pointer
+	if (ioctl(fd, UI_SET_EVBIT, EV_KEY)) {
+		fprintf(stderr, "UI_SET_EVBIT %s failed\n", "EV_KEY");
+	}
+
+	static const int btn_list[] = {BTN_LEFT, BTN_RIGHT, BTN_MIDDLE};
+
+	for (int i=0; i<sizeof(btn_list)/sizeof(int); i++) {
+		if (ioctl(fd, UI_SET_KEYBIT, btn_list[i])) {
+			fprintf(stderr, "UI_SET_KEYBIT %d failed\n", i);
+		}
+	}
+
+	const struct uinput_abs_setup abs_list[] = {
+		{.code = ABS_X, .absinfo = {.minimum = 0, .maximum = width - 1}},
+		{.code = ABS_Y, .absinfo = {.minimum = 0, .maximum = height - 1}},
+	};
+
+	for (int i=0; i<sizeof(abs_list)/sizeof(abs_list[0]); i++) {
+		if (ioctl(fd, UI_ABS_SETUP, &abs_list[i])) {
+			perror("UI_ABS_SETUP ioctl failed");
+			exit(2);
+		}
+	}
+
+	struct uinput_setup usetup = {
+		.name = "ydotoold virtual absolute pointer",
+		.id = {
+			.bustype = BUS_VIRTUAL,
+			.vendor = 0x2333,
+			.product = 0x6667,
+			.version = 1
+		}
+	};
+
+	if (name[0]) {
+		snprintf(usetup.name, sizeof(usetup.name), "%.*s absolute pointer", UINPUT_MAX_NAME_SIZE - 18, name);
+	}
+
+	if (ioctl(fd, UI_DEV_SETUP, &usetup)) {
+		perror("UI_DEV_SETUP ioctl failed");
+		exit(2);
+	}
+
+	if (ioctl(fd, UI_DEV_CREATE)) {
+		perror("UI_DEV_CREATE ioctl failed");
+		exit(2);
+	}
+}
+
+int fd_epoll = -1;
+
+struct instance instances[INSTANCES_MAX];
+uint32_t instance_count = 0;
+
+/*
+    Remove a socket file left behind by a daemon that is gone. Exits if
+    another daemon is still listening on it.
+*/
+static void socket_remove_stale(const char *path, int type) {
+	struct stat sbuf;
+
+	if (stat(path, &sbuf)) {
+		return;
+	}
+
+	int fd_sot = socket(AF_UNIX, type, 0);
+
+	if (fd_sot < 0) {
+		perror("failed to create socket for daemon collision detection");
+		exit(2);
+	}
+
+	struct sockaddr_un sa = {
+		.sun_family = AF_UNIX
+	};
+
+	strncpy(sa.sun_path, path, sizeof(sa.sun_path)-1);
+
+	if (connect(fd_sot, (const struct sockaddr *) &sa, sizeof(sa))) {
+		close(fd_sot);
+
+		puts("Removing old stale socket");
+
+		if (unlink(path)) {
+			perror("failed remove old stale socket");
+			exit(2);
+		}
+	} else {
+		puts("error: Another ydotoold is running with the same socket.");
+		exit(2);
+	}
+}
+
+static int socket_create(const char *path, int type, const struct instance_config *cfg) {
+	socket_remove_stale(path, type);
+
+	int fd = socket(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (fd < 0) {
+		perror("failed to create socket");
+		exit(2);
+	}
+
+	struct sockaddr_un sa = {
+		.sun_family = AF_UNIX
+	};
+
+	strncpy(sa.sun_path, path, sizeof(sa.sun_path)-1);
+
+	if (bind(fd, (const struct sockaddr *) &sa, sizeof(sa))) {
+		perror("failed to bind socket");
+		exit(2);
+	}
+
+	if (chmod(path, strtol(cfg->socket_perm, NULL, 8))) {
+		perror("failed to change socket permission");
+		exit(2);
+	}
+
+	if (cfg->socket_own[0]) {
+		const char *gid_pos = strchr(cfg->socket_own, ':');
+
+		if (!gid_pos) {
+			puts("invalid ownership specification");
+			exit(2);
+		}
+
+		gid_pos++;
+
+		uid_t uid = strtol(cfg->socket_own, NULL, 10);
+		gid_t gid = strtol(gid_pos, NULL, 10);
+
+		if (chown(path, uid, gid)) {
+			perror("failed to change socket ownership");
+			exit(2);
+		}
+	}
+
+	return fd;
+}
+
+/*
+    Open the devices and sockets of an instance, exits on failure like the
+    rest of the setup.
+*/
+static void instance_open(struct instance *in, const struct instance_config *cfg) {
+	startup_phase(STARTUP_UINPUT);
+
+	in->name = cfg->name;
+	in->fd_uinput_abs = -1;
+	in->fd_seq = -1;
+
+	if (cfg->simulate) {
+		// Blocks until a FIFO has a reader
+		in->fd_uinput = open(cfg->simulate, O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+
+		if (in->fd_uinput < 0) {
+			perror("failed to open the simulated device");
+			exit(2);
+		}
+
+		in->simulated = true;
+	} else {
+		in->fd_uinput = open("/dev/uinput", O_WRONLY);
+
+		if (in->fd_uinput < 0) {
+			perror("failed to open uinput device");
+			exit(2);
+		}
+	}
+
+	startup_phase(STARTUP_SOCKETS);
+
+	printf("Socket path: %s\n", cfg->socket_path);
+
+	in->fd_dgram = socket_create(cfg->socket_path, SOCK_DGRAM, cfg);
+
+	// Connection-oriented clients get a SOCK_SEQPACKET socket next to the datagram one
+	char seq_socket_path[SOCKET_PATH_LEN];
+
+	if (snprintf(seq_socket_path, sizeof(seq_socket_path), "%s" YDOTOOL_SEQ_SOCKET_SUFFIX, cfg->socket_path) < sizeof(seq_socket_path)) {
+		in->fd_seq = socket_create(seq_socket_path, SOCK_SEQPACKET, cfg);
+
+		if (listen(in->fd_seq, 16)) {
+			perror("failed to listen on socket");
+			exit(2);
+		}
+
+		printf("Connection socket path: %s\n", seq_socket_path);
+	} else {
+		puts("Socket path too long for a connection socket, only datagrams are accepted");
+	}
+
+	printf("Socket permission: %s\n", cfg->socket_perm);
+
+	if (cfg->socket_own[0]) {
+		printf("Socket ownership: %s\n", cfg->socket_own);
+	}
+
+	startup_phase(STARTUP_UINPUT);
+
+	in->abs_on_main = cfg->setup & ENABLE_ABS;
+
+	if (in->simulated) {
+		printf("Simulated device: %s\n", cfg->simulate);
+	} else {
+		uinput_setup(in->fd_uinput, cfg->setup, cfg->keys, cfg->device_name);
+
+		if (cfg->keys != KEYS_FULL && (cfg->setup & ENABLE_KEY)) {
+			printf("Keys: %s\n", cfg->keys == KEYS_PC ? "pc" : "buttons");
+		}
+	}
+
+	if (cfg->device_name[0]) {
+		printf("Device name: %s\n", cfg->device_name);
+	}
+
+	if (cfg->abs_width && in->simulated) {
+		// Both devices write into the same file
+		in->fd_uinput_abs = in->fd_uinput;
+		in->abs_on_main = false;
+	} else if (cfg->abs_width) {
+		in->fd_uinput_abs = open("/dev/uinput", O_WRONLY | O_CLOEXEC);
+
+		if (in->fd_uinput_abs < 0) {
+			perror("failed to open uinput device");
+			exit(2);
+		}
+
+		uinput_setup_abs(in->fd_uinput_abs, cfg->abs_width, cfg->abs_height, cfg->device_name);
+
+		printf("Absolute pointer: %dx%d\n", cfg->abs_width, cfg->abs_height);
+
+		if (in->abs_on_main) {
+			puts("ABS_X and ABS_Y go to the absolute pointer, not the touchscreen");
+			in->abs_on_main = false;
+		}
+	}
+}
+
 int main(int argc, char **argv) {
+	startup_phase(STARTUP_OPTIONS);
 
 	char *env_xrd = getenv("XDG_RUNTIME_DIR");
 
 	if (env_xrd) {
-		snprintf(opt_socket_path, SOCKET_PATH_LEN-1, "%s/.ydotool_socket", env_xrd);
+		snprintf(opt_inst.socket_path, SOCKET_PATH_LEN-1, "%s/.ydotool_socket", env_xrd);
 	}
 
-	enum ydotool_uinput_setup_options opt_ui_setup = ENABLE_REL | ENABLE_KEY;
-
 	while (1) {
 		int c;
 
@@ -194,12 +485,23 @@ int main(int argc, char **argv) {
 			{"mouse-off", no_argument, 0, 'm'},
 			{"keyboard-off", no_argument, 0, 'k'},
 			{"touch-on", no_argument, 0, 'T'},
+			{"coalesce", no_argument, 0, 'c'},
+			{"absolute", required_argument, 0, 'A'},
+			{"verify", no_argument, 0, 'v'},
+			{"macros", required_argument, 0, 'M'},
+			{"simulate", required_argument, 0, 'S'},
+			{"trace", required_argument, 0, 't'},
+			{"realtime", optional_argument, 0, 'r'},
+			{"cpus", required_argument, 0, 'C'},
+			{"config", required_argument, 0, 'f'},
+			{"keys", required_argument, 0, 'K'},
+			{"startup-trace", no_argument, 0, OPT_STARTUP_TRACE},
 			{0, 0, 0, 0}
 		};
 		/* getopt_long stores the option index here. */
 		int option_index = 0;
 
-		c = getopt_long (argc, argv, "hVp:P:o:mkT",
+		c = getopt_long (argc, argv, "hVp:P:o:mkTK:cA:vM:S:t:r::C:f:",
 				 long_options, &option_index);
 
 		/* Detect the end of the options. */
@@ -217,27 +519,88 @@ int main(int argc, char **argv) {
 				printf ("\n");
 				break;
 			case 'p':
-				strncpy(opt_socket_path, optarg, sizeof(opt_socket_path)-1);
+				strncpy(opt_inst.socket_path, optarg, sizeof(opt_inst.socket_path)-1);
 				break;
 
 			case 'P':
-				strncpy(opt_socket_perm, optarg, sizeof(opt_socket_perm)-1);
+				strncpy(opt_inst.socket_perm, optarg, sizeof(opt_inst.socket_perm)-1);
 				break;
 
 			case 'o':
-				strncpy(opt_socket_own, optarg, sizeof(opt_socket_perm)-1);
+				strncpy(opt_inst.socket_own, optarg, sizeof(opt_inst.socket_own)-1);
 				break;
 
 			case 'm':
-				opt_ui_setup &= ~ENABLE_REL;
+				opt_inst.setup &= ~ENABLE_REL;
 				break;
 
 			case 'k':
-				opt_ui_setup &= ~ENABLE_KEY;
+				opt_inst.setup &= ~ENABLE_KEY;
 				break;
 
 			case 'T':
-				opt_ui_setup |= ENABLE_ABS;
+				opt_inst.setup |= ENABLE_ABS;
+				break;
+
+			case 'K':
+				if (key_profile_parse(optarg, &opt_inst.keys)) {
+					printf("Invalid key profile: %s\n", optarg);
+					exit(1);
+				}
+				break;
+
+			case OPT_STARTUP_TRACE:
+				opt_startup_trace = true;
+				break;
+
+			case 'c':
+				coalesce_rel = true;
+				break;
+
+			case 'v':
+				opt_verify = true;
+				break;
+
+			case 'M':
+				opt_macro_file = optarg;
+				break;
+
+			case 'S':
+				opt_inst.simulate = optarg;
+				break;
+
+			case 'f':
+				opt_config = optarg;
+				break;
+
+			case 't':
+				opt_trace = optarg;
+				break;
+
+			case 'r':
+				opt_realtime = optarg ? atoi(optarg) : REALTIME_PRIO_DEFAULT;
+
+				if (opt_realtime < 1) {
+					printf("Invalid real-time priority: %s\n", optarg);
+					exit(1);
+				}
+				break;
+
+			case 'C':
+				if (realtime_cpus_check(optarg)) {
+					printf("Invalid CPU list: %s\n", optarg);
+					exit(1);
+				}
+
+				opt_cpus = optarg;
+				break;
+
+			case 'A':
+				if (sscanf(optarg, "%dx%d", &opt_inst.abs_width, &opt_inst.abs_height) != 2
+				    || opt_inst.abs_width < 2 || opt_inst.abs_height < 2) {
+					printf("Invalid screen size: %s\n", optarg);
+					exit(1);
+				}
 				break;
 
 			case 'h':
@@ -263,123 +626,163 @@ int main(int argc, char **argv) {
 		puts("You're advised to run this program as root, or YMMV.");
 	}
 
-	int fd_ui = open("/dev/uinput", O_WRONLY);
+	static struct instance_config configs[INSTANCES_MAX];
 
-	if (fd_ui < 0) {
-		perror("failed to open uinput device");
-		exit(2);
+	if (opt_config) {
+		int count = config_load(opt_config, &opt_inst, configs);
+
+		if (count < 0) {
+			exit(1);
+		}
+
+		instance_count = count;
+	} else {
+		configs[0] = opt_inst;
+		instance_count = 1;
 	}
 
-	printf("Socket path: %s\n", opt_socket_path);
+	// A few fds for each instance, many of them would run out of the usual 1024
+	if (instance_count > 1) {
+		struct rlimit rl;
 
-	struct stat sbuf;
+		if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < rl.rlim_max) {
+			rl.rlim_cur = rl.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &rl);
+		}
+	}
 
-	if (stat(opt_socket_path, &sbuf) == 0) {
+	bool uinput_devices = false;
 
-		int fd_sot = socket(AF_UNIX, SOCK_DGRAM, 0);
+	for (uint32_t i=0; i<instance_count; i++) {
+		if (opt_config) {
+			printf("Instance: %s\n", configs[i].name);
+		}
 
-		if (fd_sot < 0) {
-			perror("failed to create socket for daemon collision detection");
-			exit(2);
+		instance_open(&instances[i], &configs[i]);
+
+		if (!instances[i].simulated) {
+			uinput_devices = true;
 		}
+	}
 
-		struct sockaddr_un sa = {
-			.sun_family = AF_UNIX
-		};
+	startup_phase(STARTUP_SETUP);
 
-		strncpy(sa.sun_path, opt_socket_path, sizeof(sa.sun_path)-1);
+	// Doesn't hold up startup, it keeps trying in the background
+	if (uinput_devices && getenv("DISPLAY")) {
+		xinput_accel_off(configs);
+	}
 
-		if (connect(fd_sot, (const struct sockaddr *) &sa, sizeof(sa))) {
-			close(fd_sot);
+	if (opt_trace) {
+		if (latency_trace_setup(opt_trace)) {
+			perror("failed to allocate the latency trace");
+			exit(2);
+		}
 
-			puts("Removing old stale socket");
+		printf("Latency trace: the last %d frames, saved to %s on SIGUSR2\n", LATENCY_TRACE_MAX, opt_trace);
+	}
 
-			if (unlink(opt_socket_path)) {
-				perror("failed remove old stale socket");
-				exit(2);
-			}
+	if (opt_macro_file) {
+		if (macros_load(opt_macro_file)) {
+			printf("failed to load macros from `%s', they won't be saved: %s\n", opt_macro_file, strerror(errno));
 		} else {
-			puts("error: Another ydotoold is running with the same socket.");
-			exit(2);
+			printf("Macros: %u loaded from %s\n", macros_count(), opt_macro_file);
 		}
 	}
 
-	int fd_so = socket(AF_UNIX, SOCK_DGRAM, 0);
+	startup_phase(STARTUP_SETTLE);
 
-	if (fd_so < 0) {
-		perror("failed to create socket");
-		exit(2);
+	// Nothing picks up a simulated device
+	if (uinput_devices) {
+		devices_settle(DEVICE_SETTLE_MS);
 	}
 
-	struct sockaddr_un sa = {
-		.sun_family = AF_UNIX
+	// The device of the first instance is read back, through the node udev is done with
+	if (opt_verify && instances[0].simulated) {
+		puts("Delivery verification needs a uinput device, it is off");
+	} else if (opt_verify && verify_setup(instances[0].fd_uinput)) {
+		puts("Delivery verification is off");
+	}
+
+	startup_phase(STARTUP_LOOP);
+
+	puts("READY");
+
+	struct sigaction sa_usr1 = {
+		.sa_handler = handle_sigusr1
 	};
 
-	strncpy(sa.sun_path, opt_socket_path, sizeof(sa.sun_path)-1);
+	// No SA_RESTART, so that a blocked epoll_wait() returns and the stats get printed
+	sigaction(SIGUSR1, &sa_usr1, NULL);
 
-	if (bind(fd_so, (const struct sockaddr *) &sa, sizeof(sa))) {
-		perror("failed to bind socket");
+	struct sigaction sa_usr2 = {
+		.sa_handler = handle_sigusr2
+	};
+
+	sigaction(SIGUSR2, &sa_usr2, NULL);
+
+	int fd_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if (fd_timer < 0) {
+		perror("failed to create timerfd");
 		exit(2);
 	}
 
+	fd_epoll = epoll_create1(EPOLL_CLOEXEC);
 
-	if (chmod(opt_socket_path, strtol(opt_socket_perm, NULL, 8))) {
-		perror("failed to change socket permission");
+	if (fd_epoll < 0) {
+		perror("failed to create epoll instance");
 		exit(2);
 	}
 
-	printf("Socket permission: %s\n", opt_socket_perm);
+	clients_init(fd_timer);
 
-	if (opt_socket_own[0]) {
-		char *gid_pos = strchr(opt_socket_own, ':');
+	startup_phase(STARTUP_REALTIME);
 
-		if (!gid_pos) {
-			puts("invalid ownership specification");
-			exit(2);
-		}
-
-		gid_pos++;
+	// Last, so that setting up isn't run at real-time priority
+	realtime_setup(opt_realtime, opt_cpus);
 
-		uid_t uid = strtol(opt_socket_own, NULL, 10);
-		gid_t gid = strtol(gid_pos, NULL, 10);
+	if (opt_startup_trace) {
+		startup_report();
+	}
 
-		if (chown(opt_socket_path, uid, gid)) {
-			perror("failed to change socket ownership");
-			exit(2);
-		}
+	while (1) {
+		struct epoll_event events[16];
 
-		printf("Socket ownership: UID=%d, GID=%d\n", uid, gid);
-	}
+		int n = epoll_wait(fd_epoll, events, 16, -1);
 
-	uinput_setup(fd_ui, opt_ui_setup);
+		uint64_t woke = metrics_wakeup();
 
-	sleep(1);
+		if (stats_requested) {
+			stats_requested = 0;
+			show_stats();
+		}
 
-	const char *xinput_path = "/usr/bin/xinput";
+		if (trace_requested) {
+			trace_requested = 0;
+			latency_trace_save();
+		}
 
-	if (getenv("DISPLAY")) {
-		if (stat(xinput_path, &sbuf) == 0) {
-			pid_t npid = vfork();
+		for (int i=0; i<n; i++) {
+			uint64_t data = events[i].data.u64;
 
-			if (npid == 0) {
-				execl(xinput_path, "xinput", "--set-prop", "pointer:ydotoold virtual device", "libinput Accel Profile Enabled", "0,", "1", NULL);
-				perror("failed to run xinput command");
-				_exit(2);
-			} else if (npid == -1) {
-				perror("failed to fork");
+			switch (EP_KIND(data)) {
+				case EP_CLIENT:
+					clients_readable(EP_INDEX(data));
+					break;
+				case EP_LISTEN:
+					clients_accept(EP_INDEX(data));
+					break;
+				case EP_TIMER:
+					clients_timer_expired();
+					break;
+				case EP_DOORBELL:
+					clients_doorbell(EP_INDEX(data));
+					break;
 			}
-		} else {
-			printf("xinput command not found in `%s', not disabling mouser pointer acceleration", xinput_path);
 		}
-	}
 
-	puts("READY");
+		clients_run();
 
-	struct input_event uev;
-
-	while (1) {
-		if (recv(fd_so, &uev, sizeof(uev), 0) == sizeof(uev)) {
-			write(fd_ui, &uev, sizeof(uev));
-		}
+		metrics_wakeup_end(woke);
 	}
 }
@@ -0,0 +1,332 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+#pragma once
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <limits.h>
+#include <inttypes.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include <linux/uinput.h>
+
+#include "protocol.h"
+
+// Max datagrams drained from a socket per wakeup
+#define RECV_BATCH_MAX		32
+
+// Capacity of the timed playback queue of a client in events, must be a power of 2
+#define TIMED_QUEUE_MAX		32768
+
+// Client slots of all instances, including the datagram slot of each
+#define CLIENTS_MAX		1024
+
+// Instances of a --config file, each with its own devices and sockets
+#define INSTANCES_MAX		256
+#define INSTANCE_NAME_MAX	64
+
+#define SOCKET_PATH_LEN		108
+
+// Capacity of a client queue in events, must be a power of 2
+#define CLIENT_QUEUE_MAX	2048
+
+// Delivery barriers that can be waited on at the same time
+#define SYNC_PENDING_MAX	64
+
+// Buckets of the latency histograms, see metrics.c
+#define HIST_BUCKETS		24
+
+// Frames kept by the latency trace, must be a power of 2
+#define LATENCY_TRACE_MAX	65536
+
+// SCHED_FIFO priority of --realtime without one
+#define REALTIME_PRIO_DEFAULT	20
+
+// Longest wait at startup for udev to be done with the new devices
+#define DEVICE_SETTLE_MS	1000
+
+// How long xinput keeps being retried until X has picked up a device
+#define XINPUT_WAIT_MS		5000
+
+// Named macros, and the events of all of them together
+#define MACROS_MAX		256
+#define MACRO_ARENA_MAX		65536
+
+// What an epoll event refers to, kept in the upper half of epoll_data.u64
+enum {
+	EP_CLIENT = 1,
+	EP_LISTEN,
+	EP_TIMER,
+	EP_DOORBELL,
+};
+
+// Output devices
+enum {
+	DEV_MAIN = 1,		// Keyboard, mouse, and touchscreen if enabled
+	DEV_ABS = 2,		// Absolute pointer, if enabled
+};
+
+enum ydotool_uinput_setup_options {
+	ENABLE_KEY = (1 << 0),
+	ENABLE_REL = (1 << 1),
+	ENABLE_ABS = (1 << 2),
+};
+
+// The keys and buttons a device declares, see --keys
+enum ydotool_key_profile {
+	KEYS_FULL = 0,		// Every key code the kernel has a name for
+	KEYS_PC,		// A PC keyboard with media keys, and mouse buttons
+	KEYS_BUTTONS,		// Mouse buttons only
+};
+
+// Phases of startup timed by --startup-trace
+enum startup_phase {
+	STARTUP_OPTIONS,
+	STARTUP_UINPUT,
+	STARTUP_SOCKETS,
+	STARTUP_SETUP,		// Trace, macros
+	STARTUP_SETTLE,		// Waiting for udev to be done with the devices, verification
+	STARTUP_LOOP,
+	STARTUP_REALTIME,
+	STARTUP_PHASES
+};
+
+// What an instance is made of, from the command line or a section of the --config file
+struct instance_config {
+	char name[INSTANCE_NAME_MAX];
+	char socket_path[SOCKET_PATH_LEN];
+	char socket_perm[16];
+	char socket_own[16];
+	char device_name[UINPUT_MAX_NAME_SIZE];	// Empty for the default names
+	enum ydotool_uinput_setup_options setup;
+	enum ydotool_key_profile keys;
+	int abs_width;			// 0 for no absolute pointer
+	int abs_height;
+	char *simulate;			// Write to this file instead of uinput devices
+};
+
+struct timed_queue;
+
+/*
+    A virtual device with its sockets. Instances share the event loop and
+    the pool of client slots, but each has its own devices, timed playback
+    and held keys, so one doesn't wait for another.
+*/
+struct instance {
+	const char *name;
+	int fd_uinput;
+	int fd_uinput_abs;		// -1 if there is no absolute pointer
+	bool abs_on_main;		// ABS_X and ABS_Y go to the touchscreen
+	bool simulated;
+	int fd_dgram;
+	int fd_seq;			// -1 if the path is too long for a connection socket
+
+	uint32_t legacy;		// Its datagram client slot, the instance's index
+	int kbd_owner;			// Client holding keys down, -1 if none
+};
+
+#define EP_DATA(kind, idx)	(((uint64_t)(kind) << 32) | (idx))
+#define EP_KIND(data)		((uint32_t)((data) >> 32))
+#define EP_INDEX(data)		((uint32_t)(data))
+
+// Per client, since the slot was taken
+struct client_counters {
+	uint64_t datagrams;
+	uint64_t bytes;
+	uint64_t events;
+	uint64_t frames;	// Written, merged ones count once
+};
+
+struct client {
+	bool active;
+	bool closing;		// Peer is gone, the slot is freed once the queue is drained
+	bool polling;		// fd is in the epoll set
+	bool busy;		// Peer was told that its queue is full
+	bool release_on_close;	// See YDOTOOL_CTL_RELEASE_ON_CLOSE
+	int fd;
+	uint32_t generation;	// Tells reuses of the slot apart
+
+	struct instance *inst;
+	struct input_event *queue;	// CLIENT_QUEUE_MAX events, allocated when the slot is first taken
+	uint32_t head;		// Free running, masked on access
+	uint32_t tail;
+	uint32_t frames;	// Complete frames in the queue
+
+	// Shared memory ring, feeds the queue when present
+	struct ydotool_ring *ring;
+	uint32_t ring_size;	// Our copy, the client could change the shared one
+	uint32_t ring_head;
+	int fd_doorbell;
+
+	// Keys this client is holding down
+	uint8_t keys_down[KEY_CNT / 8];
+	int keys_held;
+
+	// Its timed playback, the datagram senders share it
+	struct timed_queue *timed_queue;	// Allocated when first used
+	uint64_t timed_base;	// Deadline of offset 0 of the current stream
+	uint64_t timed_last;	// Latest deadline it queued
+
+	pid_t pid;		// Of the peer of a connection, 0 if unknown
+	uint64_t since;		// When the slot was taken, CLOCK_MONOTONIC in ns
+	struct client_counters counters;
+};
+
+struct daemon_stats {
+	uint64_t wakeups;
+	uint64_t datagrams;
+	uint64_t datagrams_dropped;	// Not whole events, or truncated
+	uint64_t bytes;
+	uint64_t events;
+	uint64_t writes;
+	uint64_t events_written;
+	uint64_t timed_events;
+	uint64_t timed_rejected;	// Timed datagrams the client's timed queue had no room for
+	uint64_t frames;
+	uint64_t deferred;	// Times a frame had to wait for another client's held keys
+	uint64_t connections;
+	uint64_t write_errors;
+	uint64_t syncs;
+	uint64_t busy;		// Times a connection was told that its queue is full
+	uint64_t rings;
+	uint64_t ring_events;
+	uint64_t doorbells;
+	uint64_t coalesced;	// Frames merged into the one before them
+	uint64_t coalesced_events;	// Events that were not written because of it
+	uint64_t verify_expected;	// Key events written that the device must pass on
+	uint64_t verify_seen;		// ... and read back from it
+	uint64_t verify_lost;		// ... not read back
+	uint64_t verify_unexpected;	// Read back without having been written
+	uint64_t verify_overflows;	// SYN_DROPPED, the read back buffer overflowed
+	uint64_t macro_plays;
+	uint64_t macro_events;		// Queued for timed playback by them
+};
+
+extern struct daemon_stats stats;
+
+struct histogram {
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t bucket[HIST_BUCKETS];	// Values below 2^(10 + i) ns, not cumulative
+};
+
+extern struct histogram hist_write;
+extern struct histogram hist_queue;
+extern struct histogram hist_wakeup;
+
+// CLOCK_MONOTONIC at the start of the current wakeup, in µs, wraps around
+extern uint32_t wake_us;
+
+extern bool coalesce_rel;
+
+extern int fd_epoll;
+
+extern struct instance instances[INSTANCES_MAX];
+extern uint32_t instance_count;
+
+extern int config_load(const char *path, const struct instance_config *defaults, struct instance_config *out);
+extern int key_profile_parse(const char *name, enum ydotool_key_profile *keys);
+
+extern void clients_init(int fd_timer);
+extern void clients_accept(uint32_t instance);
+extern void clients_readable(uint32_t idx);
+extern void clients_timer_expired();
+extern void clients_doorbell(uint32_t idx);
+extern void clients_run();
+extern void clients_prefault();
+
+extern int evdev_node_find(int fd_ui, char *path, size_t len);
+extern int verify_setup(int fd_ui);
+extern void verify_written(const struct input_event *ev, size_t count);
+extern bool verify_enabled();
+
+extern int macros_load(const char *path);
+extern int macro_name_get(const struct input_event *rec, size_t count, char *name);
+extern int macro_define(uint32_t client, uint32_t generation, const struct input_event *rec, size_t count);
+extern const struct input_event *macro_find(const char *name, uint32_t *len);
+extern void macro_client_gone(uint32_t client);
+extern uint32_t macros_count();
+extern uint32_t macros_events();
+
+extern void clients_metrics(FILE *fp);
+extern uint64_t monotonic_ns();
+
+extern void hist_add(struct histogram *h, uint64_t ns);
+extern uint64_t metrics_wakeup();
+extern void metrics_wakeup_end(uint64_t woke);
+extern void metric_header(FILE *fp, const char *name, const char *type, const char *help);
+extern int metrics_memfd(size_t *len);
+
+extern void prefault(void *buf, size_t len);
+extern int realtime_cpus_check(const char *list);
+extern void realtime_setup(int prio, const char *cpus);
+
+extern void startup_phase(enum startup_phase phase);
+extern void startup_report();
+extern void devices_settle(int timeout_ms);
+extern void xinput_accel_off(const struct instance_config *configs);
+
+extern bool tracing;
+
+extern int latency_trace_setup(const char *path);
+extern uint32_t latency_frame_queued(uint32_t client, const struct input_event *syn, bool stamped);
+extern void latency_frame_scheduled(uint32_t seq, uint32_t events);
+extern void latency_frames_written(uint64_t start, uint64_t end);
+extern int latency_trace_memfd(size_t *len);
+extern void latency_trace_save();
+
+extern void show_stats();
@@ -0,0 +1,167 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+#pragma once
+
+// Library internals, not installed
+
+#include "libydotool.h"
+#include "protocol.h"
+
+#include <stddef.h>
+
+// Ring size when the caller doesn't pick one, in events
+#define RING_SIZE_DEFAULT	4096
+
+/*
+    Keyboard layout cache, compiled from XKB by keymap.c and mapped
+    read-only. A directory of 256 code point pages is followed by the pages
+    that have any key, so a lookup is two loads.
+*/
+#define KEYMAP_MAGIC		0x4d4b4459	// "YDKM"
+#define KEYMAP_VERSION		1
+#define KEYMAP_PAGES		0x1100		// Up to U+10FFFF
+
+// Modifiers held for a key
+#define KEYMAP_MOD_SHIFT	0x01
+#define KEYMAP_MOD_ALTGR	0x02		// ISO_Level3_Shift, on right Alt
+#define KEYMAP_MOD_CTRL		0x04		// Only used for Ctrl+Shift+U
+
+struct keymap_entry {
+	uint16_t code;		// Key code, 0 if the layout can't produce the character
+	uint8_t mods;
+	uint8_t reserved;
+};
+
+struct keymap_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t pages;
+	uint32_t reserved;
+	char layout[64];
+	char variant[64];
+	uint16_t dir[KEYMAP_PAGES];	// 1 + index of the page for code points (i << 8) to (i << 8 | 255), 0 for none
+};
+
+#define KEYMAP_PAGE(h, n)	((const struct keymap_entry *)((h) + 1) + (size_t)(n) * 256)
+#define KEYMAP_BYTES(pages)	(sizeof(struct keymap_header) + (size_t)(pages) * 256 * sizeof(struct keymap_entry))
+
+struct pacer {
+	bool started;
+	uint64_t deadline;	// Current deadline, in ns
+	uint64_t spin_ns;	// Busy-wait this long before each deadline
+
+	bool record;
+	uint64_t last_wake;
+	uint64_t waits;
+	uint64_t requested_ns;	// Sum of requested intervals
+	uint64_t achieved_ns;	// Sum of achieved intervals
+	uint64_t lateness_max;
+	uint32_t samples_len;
+	uint32_t *samples;	// Wake-up lateness, in ns
+};
+
+struct ydotool {
+	int fd;
+	bool connected;		// SOCK_SEQPACKET, the daemon can reply
+	bool nonblocking;
+	bool trace_stamps;	// Stamp frames with the time they're sent, for ydotoold --trace
+	bool busy;		// The daemon stopped reading from us
+
+	int32_t sync_seq;	// Sequence number of the last delivery barrier
+	bool acked;		// The barrier has been acknowledged
+	int ack_status;
+
+	int32_t verify_seq;	// Last verification barrier answered
+	bool verify_on;		// The daemon reads its device back
+	uint64_t verify_lost;	// Key events it found missing
+
+	struct ydotool_ring *ring;	// Shared memory transport, NULL when unused
+	uint32_t ring_size;
+	uint32_t ring_tail;
+	int fd_doorbell;
+	int ring_reply;			// 1 if the daemon took the ring, -errno if not, 0 before it answers
+
+	bool timed;
+	bool timed_started;
+	uint64_t timed_offset_us;	// Offset of the events being built from the start of a timed stream
+	int timed_status;		// errno of the last timed datagram the daemon dropped, until a barrier reports it
+
+	// Defining a macro: frames are sent like a timed stream, to be stored under the name
+	bool macro;
+	char macro_name[YDOTOOL_MACRO_NAME_MAX];
+	int macro_reply;		// 1 if the daemon did it, -errno if not, 0 before it answers
+	struct {
+		bool timed;
+		bool timed_started;
+		uint64_t timed_offset_us;
+	} macro_saved;			// Timed state to go back to
+
+	uint16_t memfd_wanted;		// Request waiting for an answer in a memfd, 0 for none
+	int memfd_reply;		// 1 if it came with a memfd, -errno if not, 0 before
+	int memfd_fd;
+	uint64_t memfd_len;
+
+	struct input_event frame_buf[YDOTOOL_FRAME_MAX];
+	int frame_len;
+	int frame_start;		// Index of the first event of the frame being built
+
+	struct pacer pacer;
+
+	const struct keymap_header *keymap;	// Mapped layout cache, NULL for the built-in US layout
+	size_t keymap_len;
+	enum ydotool_type_fallback type_fallback;
+	int rollover;			// Most keys down at once when typing text, 0 for one at a time
+
+	uint32_t utf8_cp;		// UTF-8 sequence being collected by ydotool_type_char()
+	uint32_t utf8_min;		// Smallest code point for its length, to reject overlong ones
+	int utf8_need;			// Continuation bytes still missing
+};
+
+extern int pacer_setup(struct pacer *p, uint32_t spin_us, bool record);
+extern void pacer_free(struct pacer *p);
+extern void pacer_restart(struct pacer *p);
+extern void pacer_wait_us(struct pacer *p, uint64_t us);
+extern void pacer_report(struct pacer *p, FILE *fp);
+
+extern uint64_t monotonic_ns();
+
+extern int replies_wait(struct ydotool *yd, uint64_t deadline);
+
+extern int ring_send(struct ydotool *yd, const struct input_event *ev, uint32_t count);
+extern void ring_free(struct ydotool *yd);
+
+extern void keymap_free(struct ydotool *yd);
@@ -0,0 +1,456 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+/*
+    Keyboard layouts for typing.
+
+    A layout is compiled from XKB with libxkbcommon into a table from code
+    point to key and modifiers (see struct keymap_header), written to a
+    cache file once, and mapped read-only from then on, so typing doesn't
+    parse a keymap each time. Only the first group and the Shift and
+    AltGr levels are used; characters that need dead keys or other
+    modifiers are left out and go to the typing fallback.
+*/
+
+#define _GNU_SOURCE
+
+#include "internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_XKBCOMMON
+#include <xkbcommon/xkbcommon.h>
+#endif
+
+void keymap_free(struct ydotool *yd) {
+	if (yd->keymap) {
+		munmap((void *)yd->keymap, yd->keymap_len);
+		yd->keymap = NULL;
+		yd->keymap_len = 0;
+	}
+}
+
+static int keymap_check(const struct keymap_header *h, size_t len) {
+	if (len < sizeof(*h) || h->magic != KEYMAP_MAGIC) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// Written by another version, compile it again
+	if (h->version != KEYMAP_VERSION) {
+		errno = ESTALE;
+		return -1;
+	}
+
+	if (h->pages > KEYMAP_PAGES || len != KEYMAP_BYTES(h->pages)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (int i=0; i<KEYMAP_PAGES; i++) {
+		if (h->dir[i] > h->pages) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int ydotool_keymap_load(struct ydotool *yd, const char *path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	struct stat st;
+	void *map = MAP_FAILED;
+
+	if (fstat(fd, &st) == 0) {
+		if (st.st_size < sizeof(struct keymap_header)) {
+			errno = EINVAL;
+		} else {
+			map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+	}
+
+	int err = errno;
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		errno = err;
+		return -1;
+	}
+
+	if (keymap_check(map, st.st_size)) {
+		err = errno;
+		munmap(map, st.st_size);
+		errno = err;
+		return -1;
+	}
+
+	keymap_free(yd);
+	yd->keymap = map;
+	yd->keymap_len = st.st_size;
+
+	return 0;
+}
+
+#ifdef HAVE_XKBCOMMON
+
+static bool key_is_keypad(uint16_t code) {
+	switch (code) {
+		case KEY_KP7 ... KEY_KPDOT:
+		case KEY_KPASTERISK:
+		case KEY_KPENTER:
+		case KEY_KPSLASH:
+		case KEY_KPEQUAL:
+		case KEY_KPPLUSMINUS:
+		case KEY_KPCOMMA:
+		case KEY_KPJPCOMMA:
+		case KEY_KPLEFTPAREN:
+		case KEY_KPRIGHTPAREN:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*
+    Smallest mask of a level that only has Shift and AltGr in it. Level 1
+    is reached without modifiers even if the key type doesn't say so.
+*/
+static int level_mods(struct xkb_keymap *km, xkb_keycode_t key, xkb_level_index_t level,
+		      xkb_mod_mask_t shift, xkb_mod_mask_t altgr, uint8_t *mods) {
+	xkb_mod_mask_t masks[16];
+	size_t n = xkb_keymap_key_get_mods_for_level(km, key, 0, level, masks, 16);
+	int best = -1;
+
+	if (n == 0 && level == 0) {
+		masks[n++] = 0;
+	}
+
+	for (size_t i=0; i<n; i++) {
+		if (masks[i] & ~(shift | altgr)) {
+			continue;
+		}
+
+		int m = (masks[i] & shift ? KEYMAP_MOD_SHIFT : 0) | (masks[i] & altgr ? KEYMAP_MOD_ALTGR : 0);
+
+		if (best < 0 || __builtin_popcount(m) < __builtin_popcount(best)) {
+			best = m;
+		}
+	}
+
+	if (best < 0) {
+		return -1;
+	}
+
+	*mods = best;
+
+	return 0;
+}
+
+// Resolve every code point the layout can produce, the plainest key wins
+static int keymap_resolve(struct xkb_keymap *km, struct keymap_entry *cps) {
+	uint8_t *rank = malloc(KEYMAP_PAGES * 256);
+
+	if (!rank) {
+		return -1;
+	}
+
+	xkb_mod_index_t i_shift = xkb_keymap_mod_get_index(km, XKB_MOD_NAME_SHIFT);
+	xkb_mod_index_t i_altgr = xkb_keymap_mod_get_index(km, "Mod5");
+	xkb_mod_mask_t shift = i_shift == XKB_MOD_INVALID ? 0 : 1u << i_shift;
+	xkb_mod_mask_t altgr = i_altgr == XKB_MOD_INVALID ? 0 : 1u << i_altgr;
+
+	for (xkb_keycode_t key = xkb_keymap_min_keycode(km); key <= xkb_keymap_max_keycode(km); key++) {
+		// XKB key codes are evdev ones plus 8
+		if (key <= 8 || key - 8 > KEY_MAX || xkb_keymap_num_layouts_for_key(km, key) == 0) {
+			continue;
+		}
+
+		uint16_t code = key - 8;
+		xkb_level_index_t levels = xkb_keymap_num_levels_for_key(km, key, 0);
+
+		for (xkb_level_index_t level = 0; level < levels; level++) {
+			const xkb_keysym_t *syms;
+			uint8_t mods;
+
+			if (xkb_keymap_key_get_syms_by_level(km, key, 0, level, &syms) != 1
+			    || level_mods(km, key, level, shift, altgr, &mods)) {
+				continue;
+			}
+
+			uint32_t cp = xkb_keysym_to_utf32(syms[0]);
+
+			if (cp == 0 || cp >= KEYMAP_PAGES * 256) {
+				continue;
+			}
+
+			// X11 clients only see key codes up to 247, keypad keys are special to some programs
+			int r = (code > 247 ? 8 : 0) + (key_is_keypad(code) ? 4 : 0) + __builtin_popcount(mods);
+
+			if (!cps[cp].code || r < rank[cp]) {
+				cps[cp].code = code;
+				cps[cp].mods = mods;
+				rank[cp] = r;
+			}
+		}
+	}
+
+	// Return gives '\r', but a new line is what one types it for
+	if (!cps['\n'].code) {
+		cps['\n'] = cps['\r'];
+	}
+
+	free(rank);
+
+	return 0;
+}
+
+static int keymap_write(const char *layout, const char *variant, const struct keymap_entry *cps, const char *path) {
+	struct keymap_header *h = calloc(1, sizeof(*h));
+
+	if (!h) {
+		return -1;
+	}
+
+	h->magic = KEYMAP_MAGIC;
+	h->version = KEYMAP_VERSION;
+	snprintf(h->layout, sizeof(h->layout), "%s", layout);
+	snprintf(h->variant, sizeof(h->variant), "%s", variant ? variant : "");
+
+	for (int i=0; i<KEYMAP_PAGES; i++) {
+		for (int j=0; j<256; j++) {
+			if (cps[i * 256 + j].code) {
+				h->dir[i] = ++h->pages;
+				break;
+			}
+		}
+	}
+
+	// Written aside and renamed into place, a reader never sees half of it
+	char tmp_path[PATH_MAX];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+
+	int fd = mkostemp(tmp_path, O_CLOEXEC);
+
+	if (fd < 0) {
+		int err = errno;
+		free(h);
+		errno = err;
+		return -1;
+	}
+
+	errno = 0;
+
+	FILE *fp = fdopen(fd, "w");
+	bool ok = fp && fwrite(h, sizeof(*h), 1, fp) == 1;
+
+	for (int i=0; ok && i<KEYMAP_PAGES; i++) {
+		if (h->dir[i]) {
+			ok = fwrite(&cps[i * 256], sizeof(*cps), 256, fp) == 256;
+		}
+	}
+
+	if (!fp) {
+		close(fd);
+	} else if (fclose(fp)) {
+		ok = false;
+	}
+
+	if (ok && rename(tmp_path, path) == 0) {
+		free(h);
+		return 0;
+	}
+
+	int err = errno ? errno : EIO;
+	unlink(tmp_path);
+	free(h);
+	errno = err;
+	return -1;
+}
+
+int ydotool_keymap_compile(const char *layout, const char *variant, const char *path) {
+	if (strlen(layout) >= sizeof(((struct keymap_header *)0)->layout)
+	    || (variant && strlen(variant) >= sizeof(((struct keymap_header *)0)->variant))) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	struct xkb_context *ctx = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+
+	if (!ctx) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	const struct xkb_rule_names names = {
+		.layout = layout,
+		.variant = variant
+	};
+
+	struct xkb_keymap *km = xkb_keymap_new_from_names(ctx, &names, XKB_KEYMAP_COMPILE_NO_FLAGS);
+	struct keymap_entry *cps = NULL;
+	int rc = -1;
+
+	if (!km) {
+		errno = ENOENT;
+	} else if ((cps = calloc(KEYMAP_PAGES * 256, sizeof(*cps)))) {
+		rc = keymap_resolve(km, cps);
+
+		if (rc == 0) {
+			rc = keymap_write(layout, variant, cps, path);
+		}
+	}
+
+	int err = errno;
+	free(cps);
+	xkb_keymap_unref(km);
+	xkb_context_unref(ctx);
+	errno = err;
+
+	return rc;
+}
+
+#else
+
+int ydotool_keymap_compile(const char *layout, const char *variant, const char *path) {
+	errno = ENOTSUP;
+	return -1;
+}
+
+#endif
+
+int ydotool_cache_path(const char *name, char *buf, size_t len) {
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	int n;
+
+	if (xdg && *xdg) {
+		n = snprintf(buf, len, "%s", xdg);
+	} else if (home && *home) {
+		n = snprintf(buf, len, "%s/.cache", home);
+	} else {
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (n + sizeof("/ydotool/") + strlen(name) > len) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if (mkdir(buf, 0700) && errno != EEXIST) {
+		return -1;
+	}
+
+	strcat(buf, "/ydotool");
+
+	if (mkdir(buf, 0700) && errno != EEXIST) {
+		return -1;
+	}
+
+	strcat(buf, "/");
+	strcat(buf, name);
+
+	return 0;
+}
+
+static bool name_ok(const char *s) {
+	for (; *s; s++) {
+		if (*s == '/' || (*s == '.' && s[1] == '.')) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int ydotool_set_layout(struct ydotool *yd, const char *layout, const char *variant) {
+	if (!layout) {
+		keymap_free(yd);
+		return 0;
+	}
+
+	if (variant && !*variant) {
+		variant = NULL;
+	}
+
+	if (!*layout || !name_ok(layout) || (variant && !name_ok(variant))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	char name[NAME_MAX + 1];
+	char path[PATH_MAX];
+
+	if (snprintf(name, sizeof(name), "keymap-%s%s%s", layout, variant ? "-" : "", variant ? variant : "") >= sizeof(name)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if (ydotool_cache_path(name, path, sizeof(path))) {
+		return -1;
+	}
+
+	if (ydotool_keymap_load(yd, path) == 0) {
+		if (strcmp(yd->keymap->layout, layout) == 0 && strcmp(yd->keymap->variant, variant ? variant : "") == 0) {
+			return 0;
+		}
+
+		// Another layout under the same name, e.g. "a-b" without variant and "a" with "b"
+		keymap_free(yd);
+	} else if (errno != ENOENT && errno != ESTALE && errno != EINVAL) {
+		return -1;
+	}
+
+	if (ydotool_keymap_compile(layout, variant, path)) {
+		return -1;
+	}
+
+	return ydotool_keymap_load(yd, path);
+}
@@ -0,0 +1,897 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+/*
+    Connection to ydotoold and the frame builder.
+*/
+
+#include "internal.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <poll.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+int ydotool_api_version() {
+	return YDOTOOL_API_VERSION;
+}
+
+void ydotool_default_socket_path(char *buf, size_t len) {
+	char *env_ys = getenv("YDOTOOL_SOCKET");
+	char *env_xrd = getenv("XDG_RUNTIME_DIR");
+
+	if (env_ys) {
+		snprintf(buf, len, "%s", env_ys);
+	} else if (env_xrd) {
+		snprintf(buf, len, "%s/.ydotool_socket", env_xrd);
+	} else {
+		snprintf(buf, len, "%s", "/tmp/.ydotool_socket");
+	}
+}
+
+// Control records in front of the events of every datagram
+static int frame_header_len(const struct ydotool *yd) {
+	if (yd->macro) {
+		return 1 + YDOTOOL_MACRO_NAME_RECORDS;
+	}
+
+	return yd->timed ? 1 : 0;
+}
+
+static void frame_reset(struct ydotool *yd) {
+	yd->frame_len = 0;
+
+	if (yd->macro) {
+		yd->frame_buf[yd->frame_len++] = (struct input_event) {
+			.type = YDOTOOL_EV_CTL,
+			.code = YDOTOOL_CTL_MACRO_DEFINE,
+			.value = yd->timed_started ? 0 : YDOTOOL_MACRO_BEGIN
+		};
+
+		memset(&yd->frame_buf[1], 0, YDOTOOL_MACRO_NAME_RECORDS * sizeof(struct input_event));
+		memcpy(&yd->frame_buf[1], yd->macro_name, YDOTOOL_MACRO_NAME_MAX);
+
+		yd->frame_len += YDOTOOL_MACRO_NAME_RECORDS;
+	} else if (yd->timed) {
+		yd->frame_buf[yd->frame_len++] = (struct input_event) {
+			.type = YDOTOOL_EV_CTL,
+			.code = YDOTOOL_CTL_TIMED,
+			.value = yd->timed_started ? 0 : YDOTOOL_TIMED_BEGIN
+		};
+	}
+
+	yd->frame_start = yd->frame_len;
+}
+
+// The first fd passed along with a reply, closing any others, -1 if none
+static int reply_take_fd(struct msghdr *mh) {
+	int fd = -1;
+
+	for (struct cmsghdr *cm = CMSG_FIRSTHDR(mh); cm; cm = CMSG_NXTHDR(mh, cm)) {
+		if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+			continue;
+		}
+
+		for (size_t i=0; i<(cm->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++) {
+			int got;
+
+			memcpy(&got, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+
+			if (fd < 0) {
+				fd = got;
+			} else {
+				close(got);
+			}
+		}
+	}
+
+	return fd;
+}
+
+// Handle whatever the daemon has sent us, without waiting
+static int replies_receive(struct ydotool *yd) {
+	if (!yd->connected) {
+		return 0;
+	}
+
+	while (1) {
+		struct input_event ev;
+		union {
+			char buf[CMSG_SPACE(sizeof(int))];
+			struct cmsghdr align;
+		} cmsg;
+		struct iovec iov = {
+			.iov_base = &ev,
+			.iov_len = sizeof(ev)
+		};
+		struct msghdr mh = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = cmsg.buf,
+			.msg_controllen = sizeof(cmsg.buf)
+		};
+
+		ssize_t len = recvmsg(yd->fd, &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+
+		if (len == 0) {
+			errno = ECONNRESET;
+			return -1;
+		}
+
+		if (len < 0) {
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		}
+
+		int fd = reply_take_fd(&mh);
+
+		if (len != sizeof(ev) || ev.type != YDOTOOL_EV_CTL) {
+			if (fd >= 0) {
+				close(fd);
+			}
+			continue;
+		}
+
+		switch (ev.code) {
+			case YDOTOOL_CTL_ACK:
+				if (ev.value == yd->sync_seq) {
+					yd->acked = true;
+					yd->ack_status = ev.input_event_sec;
+				}
+				break;
+
+			case YDOTOOL_CTL_BUSY:
+				yd->busy = ev.value;
+				break;
+
+			case YDOTOOL_CTL_TIMED:
+				if (!ev.value) {
+					yd->timed_status = ev.input_event_sec;
+				}
+				break;
+
+			case YDOTOOL_CTL_RING:
+				yd->ring_reply = ev.value ? 1 : -(int)ev.input_event_sec;
+				break;
+
+			case YDOTOOL_CTL_VERIFY:
+				yd->verify_seq = ev.value;
+				yd->verify_lost = ev.input_event_sec;
+				yd->verify_on = ev.input_event_usec;
+				break;
+
+			case YDOTOOL_CTL_MACRO_DEFINE:
+			case YDOTOOL_CTL_MACRO_PLAY:
+				yd->macro_reply = ev.value ? 1 : -(int)ev.input_event_sec;
+				break;
+
+			case YDOTOOL_CTL_STATS:
+			case YDOTOOL_CTL_TRACE:
+				if (yd->memfd_wanted != ev.code) {
+					break;
+				}
+
+				if (ev.value && fd >= 0) {
+					yd->memfd_fd = fd;
+					yd->memfd_len = ev.input_event_sec;
+					yd->memfd_reply = 1;
+					fd = -1;
+				} else {
+					yd->memfd_reply = ev.value ? -EBADF : -(int)ev.input_event_sec;
+				}
+				break;
+		}
+
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+}
+
+// Wait for a reply until the deadline (0 for none), and handle it
+int replies_wait(struct ydotool *yd, uint64_t deadline) {
+	int timeout_ms = -1;
+
+	if (deadline) {
+		uint64_t now = monotonic_ns();
+
+		if (now >= deadline) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+
+		timeout_ms = (deadline - now + 999999) / 1000000;
+	}
+
+	struct pollfd pfd = {
+		.fd = yd->fd,
+		.events = POLLIN
+	};
+
+	if (poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR) {
+		return -1;
+	}
+
+	return replies_receive(yd);
+}
+
+/*
+    In non-blocking mode a frame the daemon can't take stays in the buffer,
+    and the caller tries again later.
+*/
+static int frame_send(struct ydotool *yd) {
+	int hdr_len = frame_header_len(yd);
+	int rc = 0;
+
+	if (yd->frame_len > hdr_len) {
+		size_t len = yd->frame_len * sizeof(struct input_event);
+
+		if (yd->nonblocking && ydotool_busy(yd)) {
+			errno = EAGAIN;
+			return -1;
+		}
+
+		// The daemon only looks at the SYN_REPORT's stamp
+		if (yd->trace_stamps && !hdr_len) {
+			struct timespec ts;
+			struct input_event *syn = &yd->frame_buf[yd->frame_len - 1];
+
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			syn->input_event_sec = ts.tv_sec;
+			syn->input_event_usec = ts.tv_nsec / 1000;
+		}
+
+		if (yd->ring) {
+			if (ring_send(yd, yd->frame_buf, yd->frame_len)) {
+				if (errno == EAGAIN) {
+					return -1;
+				}
+
+				rc = -1;
+			}
+		} else {
+			ssize_t sent = send(yd->fd, yd->frame_buf, len, MSG_NOSIGNAL | (yd->nonblocking ? MSG_DONTWAIT : 0));
+
+			if (sent < 0 && errno == EAGAIN) {
+				return -1;
+			}
+
+			if (sent != len) {
+				rc = -1;
+			}
+		}
+
+		if (yd->timed) {
+			yd->timed_started = true;
+		}
+	}
+
+	frame_reset(yd);
+
+	return rc;
+}
+
+static int socket_connect(const char *path, int type) {
+	struct sockaddr_un sa = {
+		.sun_family = AF_UNIX
+	};
+
+	if (snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", path) >= sizeof(sa.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	int fd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (connect(fd, (const struct sockaddr *) &sa, sizeof(sa))) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+    Prefer a connection, so the daemon gives us our own queue. Daemons
+    without the connection socket only take datagrams.
+*/
+struct ydotool *ydotool_connect(const char *socket_path) {
+	char path[108];
+	char seq_path[sizeof(path) + sizeof(YDOTOOL_SEQ_SOCKET_SUFFIX)];
+
+	if (socket_path) {
+		snprintf(path, sizeof(path), "%s", socket_path);
+	} else {
+		ydotool_default_socket_path(path, sizeof(path));
+	}
+
+	snprintf(seq_path, sizeof(seq_path), "%s" YDOTOOL_SEQ_SOCKET_SUFFIX, path);
+
+	struct ydotool *yd = calloc(1, sizeof(struct ydotool));
+
+	if (!yd) {
+		return NULL;
+	}
+
+	yd->fd = socket_connect(seq_path, SOCK_SEQPACKET);
+	yd->connected = yd->fd >= 0;
+
+	if (yd->fd < 0) {
+		yd->fd = socket_connect(path, SOCK_DGRAM);
+	}
+
+	if (yd->fd < 0) {
+		int err = errno;
+		free(yd);
+		errno = err;
+		return NULL;
+	}
+
+	frame_reset(yd);
+
+	if (getenv("YDOTOOL_TRACE")) {
+		yd->trace_stamps = true;
+	}
+
+	return yd;
+}
+
+void ydotool_disconnect(struct ydotool *yd) {
+	if (!yd) {
+		return;
+	}
+
+	ydotool_sync(yd);
+
+	ring_free(yd);
+	keymap_free(yd);
+	close(yd->fd);
+	pacer_free(&yd->pacer);
+	free(yd);
+}
+
+int ydotool_fd(const struct ydotool *yd) {
+	return yd->fd;
+}
+
+int ydotool_set_timed(struct ydotool *yd, bool timed) {
+	if (yd->timed_started || yd->ring || yd->macro || yd->frame_len > frame_header_len(yd)) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	yd->timed = timed;
+	frame_reset(yd);
+
+	return 0;
+}
+
+int ydotool_set_nonblocking(struct ydotool *yd, bool nonblocking) {
+	yd->nonblocking = nonblocking;
+
+	return 0;
+}
+
+int ydotool_set_trace_stamps(struct ydotool *yd, bool stamps) {
+	yd->trace_stamps = stamps;
+
+	return 0;
+}
+
+int ydotool_set_release_on_close(struct ydotool *yd, bool release) {
+	if (!yd->connected) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	struct input_event rec = {
+		.type = YDOTOOL_EV_CTL,
+		.code = YDOTOOL_CTL_RELEASE_ON_CLOSE,
+		.value = release
+	};
+
+	return send(yd->fd, &rec, sizeof(rec), MSG_NOSIGNAL) == sizeof(rec) ? 0 : -1;
+}
+
+bool ydotool_busy(struct ydotool *yd) {
+	replies_receive(yd);
+
+	return yd->busy;
+}
+
+int ydotool_set_pacing(struct ydotool *yd, uint32_t spin_us, bool record) {
+	return pacer_setup(&yd->pacer, spin_us, record);
+}
+
+void ydotool_pacing_restart(struct ydotool *yd) {
+	pacer_restart(&yd->pacer);
+}
+
+void ydotool_timing_report(struct ydotool *yd, FILE *fp) {
+	if (yd->timed) {
+		fputs("Timing report: not available in timed mode, the daemon keeps the timing\n", fp);
+	} else {
+		pacer_report(&yd->pacer, fp);
+	}
+}
+
+/*
+    Append an event to the pending frame. Nothing is sent until
+    ydotool_frame_flush(), unless the frame outgrows a single datagram.
+*/
+int ydotool_frame_add(struct ydotool *yd, uint16_t type, uint16_t code, int32_t value) {
+	int rc = 0;
+
+	// The last slot is kept for the SYN_REPORT
+	int room = type == EV_SYN && code == SYN_REPORT ? YDOTOOL_FRAME_MAX : YDOTOOL_FRAME_MAX - 1;
+
+	if (yd->frame_len >= room && frame_send(yd)) {
+		// Still full, the daemon is busy
+		if (yd->frame_len >= room) {
+			return -1;
+		}
+
+		rc = -1;
+	}
+
+	yd->frame_buf[yd->frame_len++] = (struct input_event) {
+		.input_event_sec = yd->timed_offset_us / 1000000,
+		.input_event_usec = yd->timed_offset_us % 1000000,
+		.type = type,
+		.code = code,
+		.value = value
+	};
+
+	return rc;
+}
+
+/*
+    Terminate the pending frame with a SYN_REPORT and send it to the daemon
+    as one datagram. In timed mode frames are packed together and sent when
+    the datagram is full, the daemon takes care of the timing.
+*/
+int ydotool_frame_flush(struct ydotool *yd) {
+	int rc = 0;
+
+	if (yd->frame_len > yd->frame_start) {
+		rc = ydotool_frame_add(yd, EV_SYN, SYN_REPORT, 0);
+		yd->frame_start = yd->frame_len;
+	}
+
+	if (yd->timed) {
+		return rc;
+	}
+
+	// Also sends what a busy daemon didn't take last time
+	return frame_send(yd) || rc ? -1 : 0;
+}
+
+int ydotool_sync(struct ydotool *yd) {
+	if (ydotool_frame_flush(yd)) {
+		return -1;
+	}
+
+	return frame_send(yd);
+}
+
+static int barrier_send(struct ydotool *yd, uint16_t code, int32_t seq, uint64_t deadline) {
+	// The barrier goes in a datagram of its own, after everything buffered
+	while (ydotool_sync(yd)) {
+		if (errno != EAGAIN || replies_wait(yd, deadline)) {
+			return -1;
+		}
+	}
+
+	struct input_event ev = {
+		.type = YDOTOOL_EV_CTL,
+		.code = code,
+		.value = seq
+	};
+
+	if (send(yd->fd, &ev, sizeof(ev), MSG_NOSIGNAL) != sizeof(ev)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static int flush_until(struct ydotool *yd, uint64_t deadline) {
+	yd->acked = false;
+
+	if (barrier_send(yd, YDOTOOL_CTL_SYNC, ++yd->sync_seq, deadline)) {
+		return -1;
+	}
+
+	while (!yd->acked) {
+		if (replies_wait(yd, deadline)) {
+			return -1;
+		}
+	}
+
+	if (yd->ack_status) {
+		errno = yd->ack_status;
+		return -1;
+	}
+
+	// Part of the timed stream will never play
+	if (yd->timed_status) {
+		errno = yd->timed_status;
+		yd->timed_status = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint64_t deadline_after(int timeout_ms) {
+	return timeout_ms < 0 ? 0 : monotonic_ns() + (uint64_t)timeout_ms * 1000000;
+}
+
+int ydotool_flush(struct ydotool *yd, int timeout_ms) {
+	if (!yd->connected) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	return flush_until(yd, deadline_after(timeout_ms));
+}
+
+/*
+    The verification barrier is followed by a plain one: a daemon that
+    knows it answers it first, one that doesn't only answers the second.
+*/
+int ydotool_verify(struct ydotool *yd, int timeout_ms, uint64_t *lost) {
+	if (!yd->connected) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	uint64_t deadline = deadline_after(timeout_ms);
+	int32_t seq = ++yd->sync_seq;
+
+	if (barrier_send(yd, YDOTOOL_CTL_VERIFY, seq, deadline) || flush_until(yd, deadline)) {
+		return -1;
+	}
+
+	if (yd->verify_seq != seq || !yd->verify_on) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	*lost = yd->verify_lost;
+
+	return 0;
+}
+
+/*
+    Metrics and the latency trace are answered as soon as the daemon reads
+    the request, the barrier after it tells an older daemon apart, as for
+    macros below. The contents come in a memfd, copied to fp.
+*/
+static int memfd_request(struct ydotool *yd, uint16_t code, FILE *fp) {
+	if (!yd->connected) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	struct input_event rec = {
+		.type = YDOTOOL_EV_CTL,
+		.code = code
+	};
+
+	yd->memfd_wanted = code;
+	yd->memfd_reply = 0;
+	yd->acked = false;
+
+	int rc = 0;
+
+	if (send(yd->fd, &rec, sizeof(rec), MSG_NOSIGNAL) != sizeof(rec)
+	    || barrier_send(yd, YDOTOOL_CTL_SYNC, ++yd->sync_seq, 0)) {
+		rc = -1;
+	}
+
+	while (!rc && !yd->memfd_reply && !yd->acked) {
+		rc = replies_wait(yd, 0);
+	}
+
+	yd->memfd_wanted = 0;
+
+	if (rc) {
+		return -1;
+	}
+
+	if (yd->memfd_reply <= 0) {
+		errno = yd->memfd_reply ? -yd->memfd_reply : ENOTSUP;
+		return -1;
+	}
+
+	// The daemon's writing left the offset at the end
+	char buf[4096];
+	size_t off = 0;
+
+	while (off < yd->memfd_len) {
+		ssize_t n = pread(yd->memfd_fd, buf, sizeof(buf), off);
+
+		if (n <= 0) {
+			if (n == 0) {
+				errno = EIO;
+			}
+			rc = -1;
+			break;
+		}
+
+		if (n > yd->memfd_len - off) {
+			n = yd->memfd_len - off;
+		}
+
+		if (fwrite(buf, 1, n, fp) != n) {
+			rc = -1;
+			break;
+		}
+
+		off += n;
+	}
+
+	close(yd->memfd_fd);
+
+	return rc;
+}
+
+int ydotool_stats(struct ydotool *yd, FILE *fp) {
+	return memfd_request(yd, YDOTOOL_CTL_STATS, fp);
+}
+
+int ydotool_latency_trace(struct ydotool *yd, FILE *fp) {
+	return memfd_request(yd, YDOTOOL_CTL_TRACE, fp);
+}
+
+/*
+    A macro request is followed by a plain barrier, like the verification
+    barrier. A daemon that knows macros answers the request as soon as it
+    reads it, one that doesn't only answers the barrier.
+*/
+static int macro_request(struct ydotool *yd, const struct input_event *rec, size_t count) {
+	yd->macro_reply = 0;
+	yd->acked = false;
+
+	if (send(yd->fd, rec, count * sizeof(struct input_event), MSG_NOSIGNAL) != count * sizeof(struct input_event)
+	    || barrier_send(yd, YDOTOOL_CTL_SYNC, ++yd->sync_seq, 0)) {
+		return -1;
+	}
+
+	while (!yd->macro_reply && !yd->acked) {
+		if (replies_wait(yd, 0)) {
+			return -1;
+		}
+	}
+
+	if (yd->macro_reply <= 0) {
+		errno = yd->macro_reply ? -yd->macro_reply : ENOTSUP;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int macro_name_ok(const char *name) {
+	if (!name[0] || strlen(name) >= YDOTOOL_MACRO_NAME_MAX) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+    The events and delays up to ydotool_macro_end() are built like a timed
+    stream and sent to the daemon, which keeps them instead of playing them.
+*/
+int ydotool_macro_begin(struct ydotool *yd, const char *name) {
+	if (!yd->connected) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	if (!macro_name_ok(name)) {
+		return -1;
+	}
+
+	// Timed streams go over the socket, a ring would take them as plain events
+	if (yd->macro || yd->ring) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	// What was built so far is not part of it
+	if (ydotool_sync(yd)) {
+		return -1;
+	}
+
+	yd->macro_saved.timed = yd->timed;
+	yd->macro_saved.timed_started = yd->timed_started;
+	yd->macro_saved.timed_offset_us = yd->timed_offset_us;
+
+	yd->macro = true;
+	yd->timed = true;
+	yd->timed_started = false;
+	yd->timed_offset_us = 0;
+
+	memset(yd->macro_name, 0, sizeof(yd->macro_name));
+	strcpy(yd->macro_name, name);
+
+	frame_reset(yd);
+
+	return 0;
+}
+
+int ydotool_macro_end(struct ydotool *yd) {
+	if (!yd->macro) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	ydotool_frame_flush(yd);
+
+	// The last datagram carries the end mark, with or without events
+	struct input_event last[YDOTOOL_FRAME_MAX];
+	size_t count = yd->frame_len;
+
+	memcpy(last, yd->frame_buf, count * sizeof(struct input_event));
+	last[0].value |= YDOTOOL_MACRO_END;
+
+	yd->macro = false;
+	yd->timed = yd->macro_saved.timed;
+	yd->timed_started = yd->macro_saved.timed_started;
+	yd->timed_offset_us = yd->macro_saved.timed_offset_us;
+
+	frame_reset(yd);
+
+	return macro_request(yd, last, count);
+}
+
+int ydotool_macro_play(struct ydotool *yd, const char *name) {
+	if (!macro_name_ok(name)) {
+		return -1;
+	}
+
+	// Our own events go out first, and the request in a datagram of its own
+	if (ydotool_sync(yd)) {
+		return -1;
+	}
+
+	struct input_event rec[1 + YDOTOOL_MACRO_NAME_RECORDS] = {
+		{
+			.type = YDOTOOL_EV_CTL,
+			.code = YDOTOOL_CTL_MACRO_PLAY
+		}
+	};
+
+	memcpy(&rec[1], name, strlen(name));
+
+	// Nothing comes back over a datagram socket
+	if (!yd->connected) {
+		return send(yd->fd, rec, sizeof(rec), MSG_NOSIGNAL) == sizeof(rec) ? 0 : -1;
+	}
+
+	return macro_request(yd, rec, sizeof(rec) / sizeof(rec[0]));
+}
+
+/*
+    Wait between frames. In timed mode this only moves the timestamp of the
+    following events forward.
+*/
+int ydotool_delay_us(struct ydotool *yd, uint64_t us) {
+	if (!us) {
+		return 0;
+	}
+
+	if (yd->timed) {
+		yd->timed_offset_us += us;
+	} else {
+		pacer_wait_us(&yd->pacer, us);
+	}
+
+	return 0;
+}
+
+int ydotool_delay_ms(struct ydotool *yd, int ms) {
+	if (ms <= 0) {
+		return 0;
+	}
+
+	return ydotool_delay_us(yd, (uint64_t)ms * 1000);
+}
+
+int ydotool_key(struct ydotool *yd, uint16_t code, int32_t value) {
+	ydotool_frame_add(yd, EV_KEY, code, value);
+
+	return ydotool_frame_flush(yd);
+}
+
+int ydotool_button(struct ydotool *yd, enum ydotool_button button, bool pressed) {
+	if (button < 0 || button > 0xf) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return ydotool_key(yd, BTN_MOUSE | button, pressed);
+}
+
+// The hold is timed from the press, whatever the caller did since its last delay
+int ydotool_click(struct ydotool *yd, enum ydotool_button button, int hold_ms) {
+	pacer_restart(&yd->pacer);
+
+	if (ydotool_button(yd, button, 1)) {
+		return -1;
+	}
+
+	ydotool_delay_ms(yd, hold_ms);
+
+	return ydotool_button(yd, button, 0);
+}
+
+int ydotool_mouse_move(struct ydotool *yd, int32_t x, int32_t y) {
+	ydotool_frame_add(yd, EV_REL, REL_X, x);
+	ydotool_frame_add(yd, EV_REL, REL_Y, y);
+
+	return ydotool_frame_flush(yd);
+}
+
+// One frame, the daemon knows how to get there
+int ydotool_mouse_move_to(struct ydotool *yd, int32_t x, int32_t y) {
+	ydotool_frame_add(yd, EV_ABS, ABS_X, x);
+	ydotool_frame_add(yd, EV_ABS, ABS_Y, y);
+
+	return ydotool_frame_flush(yd);
+}
+
+int ydotool_wheel(struct ydotool *yd, int32_t horizontal, int32_t vertical) {
+	ydotool_frame_add(yd, EV_REL, REL_HWHEEL, horizontal);
+	ydotool_frame_add(yd, EV_REL, REL_WHEEL, vertical);
+
+	return ydotool_frame_flush(yd);
+}
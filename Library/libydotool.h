@@ -0,0 +1,326 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+#pragma once
+
+/*
+    libydotool - drive ydotoold from your own process.
+
+    All functions that can fail return 0 on success, or -1 with errno set.
+    A handle is not thread safe, use one per thread.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define YDOTOOL_API_VERSION		1
+
+// Most keys ydotool_set_rollover() lets down at once
+#define YDOTOOL_ROLLOVER_MAX		16
+
+// Longest macro name, with the terminating NUL
+#define YDOTOOL_MACRO_NAME_MAX		32
+
+#if defined(__GNUC__)
+#define YDOTOOL_API __attribute__((visibility("default")))
+#else
+#define YDOTOOL_API
+#endif
+
+struct ydotool;
+
+// Mouse buttons, same numbering as `ydotool click'
+enum ydotool_button {
+	YDOTOOL_BUTTON_LEFT = 0,
+	YDOTOOL_BUTTON_RIGHT,
+	YDOTOOL_BUTTON_MIDDLE,
+	YDOTOOL_BUTTON_SIDE,
+	YDOTOOL_BUTTON_EXTRA,
+	YDOTOOL_BUTTON_FORWARD,
+	YDOTOOL_BUTTON_BACK,
+	YDOTOOL_BUTTON_TASK,
+};
+
+// Speed profile of a mouse path
+enum ydotool_curve_type {
+	YDOTOOL_CURVE_LINEAR = 0,
+	YDOTOOL_CURVE_EASE_IN_OUT,
+	YDOTOOL_CURVE_BEZIER,		// Cubic Bézier with the control points below, like CSS cubic-bezier()
+};
+
+struct ydotool_curve {
+	enum ydotool_curve_type type;
+	double x1, y1, x2, y2;		// x1 and x2 must lie within [0, 1]
+};
+
+// What typing does with a character the keyboard layout has no key for
+enum ydotool_type_fallback {
+	YDOTOOL_TYPE_SKIP = 0,		// Skip it, typing it alone fails with EINVAL
+	YDOTOOL_TYPE_CTRL_SHIFT_U,	// Ctrl+Shift+U, the code point in hex and space, for GTK and IBus
+};
+
+struct ydotool_type_stats {
+	uint32_t chars;			// Characters typed
+	uint32_t skipped;		// Characters without a key, and invalid UTF-8
+	uint32_t events;		// Events sent, SYN_REPORT included
+	uint32_t events_unlatched;	// Events with modifiers pressed and released around every key
+};
+
+YDOTOOL_API int ydotool_api_version();
+
+/*
+    Resolve the daemon socket path the way the ydotool command does:
+    $YDOTOOL_SOCKET, then $XDG_RUNTIME_DIR/.ydotool_socket, then
+    /tmp/.ydotool_socket.
+*/
+YDOTOOL_API void ydotool_default_socket_path(char *buf, size_t len);
+
+/*
+    Connect to the daemon. socket_path may be NULL for the default path.
+    A connection on the SOCK_SEQPACKET socket next to it is preferred, the
+    datagram socket is the fallback for older daemons.
+*/
+YDOTOOL_API struct ydotool *ydotool_connect(const char *socket_path);
+
+// Send everything still pending and free the handle
+YDOTOOL_API void ydotool_disconnect(struct ydotool *yd);
+
+YDOTOOL_API int ydotool_fd(const struct ydotool *yd);
+
+/*
+    Timed mode: instead of sleeping, delays are encoded as event timestamps
+    and ydotoold plays the sequence back on its own timer. Must be set
+    before the first event.
+*/
+YDOTOOL_API int ydotool_set_timed(struct ydotool *yd, bool timed);
+
+/*
+    Pacing of delays in normal mode. With spin_us non-zero, the last spin_us
+    microseconds before each deadline are busy-waited. With record, wake-up
+    statistics are kept for ydotool_timing_report().
+*/
+YDOTOOL_API int ydotool_set_pacing(struct ydotool *yd, uint32_t spin_us, bool record);
+
+// Start a new pacing timeline at the next delay
+YDOTOOL_API void ydotool_pacing_restart(struct ydotool *yd);
+
+YDOTOOL_API void ydotool_timing_report(struct ydotool *yd, FILE *fp);
+
+// Raw frames: events are collected until ydotool_frame_flush() adds a SYN_REPORT and sends them
+YDOTOOL_API int ydotool_frame_add(struct ydotool *yd, uint16_t type, uint16_t code, int32_t value);
+YDOTOOL_API int ydotool_frame_flush(struct ydotool *yd);
+
+// Send everything still buffered (only timed mode buffers across frames)
+YDOTOOL_API int ydotool_sync(struct ydotool *yd);
+
+/*
+    Send everything and wait until ydotoold has written it to uinput, along
+    with whatever other clients sent before, timed playback included. A
+    negative timeout_ms waits forever. Fails with ENOTSUP if the daemon
+    only takes datagrams, ETIMEDOUT, the errno of a failed uinput write, or
+    ENOSPC if the daemon had no room for part of a timed stream.
+*/
+YDOTOOL_API int ydotool_flush(struct ydotool *yd, int timeout_ms);
+
+/*
+    Like ydotool_flush(), then tell how many key events ydotoold wrote but
+    didn't find when reading its device back, since it started. Compare
+    two calls for the events lost in between. Fails with ENOTSUP unless
+    the daemon runs with --verify.
+*/
+YDOTOOL_API int ydotool_verify(struct ydotool *yd, int timeout_ms, uint64_t *lost);
+
+/*
+    Write ydotoold's metrics to fp in the Prometheus text format: counters,
+    latency histograms and queue depths, and the same per client. Fails
+    with ENOTSUP if the daemon can't tell.
+*/
+YDOTOOL_API int ydotool_stats(struct ydotool *yd, FILE *fp);
+
+/*
+    Write the latency trace of ydotoold's last frames to fp, in the binary
+    format of protocol.h (struct ydotool_trace_header, then the records).
+    Fails with ENOTSUP unless the daemon runs with --trace.
+*/
+YDOTOOL_API int ydotool_latency_trace(struct ydotool *yd, FILE *fp);
+
+/*
+    Stamp each frame with CLOCK_MONOTONIC when it's sent, so that the
+    latency trace covers the socket too. Not in timed mode, where the
+    stamps are delays. Also turned on by YDOTOOL_TRACE in the environment.
+*/
+YDOTOOL_API int ydotool_set_trace_stamps(struct ydotool *yd, bool stamps);
+
+/*
+    Have the daemon release the keys we hold down if the connection closes,
+    say because we were killed. Off by default: keys pressed and not
+    released stay down after we exit, so that another process can release
+    them. Fails with ENOTSUP on the datagram socket.
+*/
+YDOTOOL_API int ydotool_set_release_on_close(struct ydotool *yd, bool release);
+
+/*
+    Named macros kept by ydotoold. Between ydotool_macro_begin() and
+    ydotool_macro_end(), events and delays are stored in the daemon under
+    the name, replacing a macro of the same name, instead of being played.
+    A macro ended without events is deleted. ydotool_macro_end() fails with
+    the daemon's errno, or ENOTSUP if it doesn't know macros.
+*/
+YDOTOOL_API int ydotool_macro_begin(struct ydotool *yd, const char *name);
+YDOTOOL_API int ydotool_macro_end(struct ydotool *yd);
+
+/*
+    Play a macro, after the timed playback in progress. Fails with ENOENT
+    if there is none by that name. Returns as soon as the daemon has
+    queued it, ydotool_flush() waits for it to be played.
+*/
+YDOTOOL_API int ydotool_macro_play(struct ydotool *yd, const char *name);
+
+/*
+    Don't block while the daemon's queue for us is full: sending fails with
+    EAGAIN instead, and the frame stays buffered until the next flush. Once
+    the buffer is full, ydotool_frame_add() fails with EAGAIN and drops the
+    event. The fd becomes readable when the daemon can take more.
+*/
+YDOTOOL_API int ydotool_set_nonblocking(struct ydotool *yd, bool nonblocking);
+
+// Whether the daemon has told us that our queue is full
+YDOTOOL_API bool ydotool_busy(struct ydotool *yd);
+
+/*
+    Send frames through a ring of `size' events (a power of 2, 0 for the
+    default) in memory shared with ydotoold, instead of copying each one
+    through the socket. Fails with ENOTSUP if the daemon can't take it, the
+    socket is used then as before. Not available in timed mode.
+*/
+YDOTOOL_API int ydotool_use_ring(struct ydotool *yd, uint32_t size);
+
+/*
+    Delays follow each other on one timeline, so a loop of sends and
+    delays keeps its pace. A delay that comes more than its own length
+    after the last one ended, e.g. after the caller sat idle, starts a new
+    timeline and waits in full.
+*/
+YDOTOOL_API int ydotool_delay_us(struct ydotool *yd, uint64_t us);
+YDOTOOL_API int ydotool_delay_ms(struct ydotool *yd, int ms);
+
+// Press (1) or release (0) a key, see linux/input-event-codes.h for codes
+YDOTOOL_API int ydotool_key(struct ydotool *yd, uint16_t code, int32_t value);
+
+/*
+    Type UTF-8 text with the keyboard layout, US unless another is set
+    below. Each key is held for key_hold_ms, and key_delay_ms is waited
+    between keys. Modifiers stay down across characters that need the same
+    ones. Characters the layout can't produce go to the fallback, invalid
+    UTF-8 is skipped.
+*/
+YDOTOOL_API int ydotool_type(struct ydotool *yd, const char *text, int key_delay_ms, int key_hold_ms);
+
+// Like ydotool_type(), for len bytes of text, adding to *stats if not NULL
+YDOTOOL_API int ydotool_type_n(struct ydotool *yd, const char *text, size_t len, int key_delay_ms, int key_hold_ms,
+			       struct ydotool_type_stats *stats);
+
+// Add to *stats what typing the text would do, without sending anything
+YDOTOOL_API int ydotool_type_plan(struct ydotool *yd, const char *text, size_t len, struct ydotool_type_stats *stats);
+
+/*
+    Type one byte of UTF-8 text. The bytes of a multibyte character are
+    collected until it is complete, fails with EILSEQ for a stray one.
+*/
+YDOTOOL_API int ydotool_type_char(struct ydotool *yd, char c, int key_delay_ms, int key_hold_ms);
+YDOTOOL_API int ydotool_type_codepoint(struct ydotool *yd, uint32_t cp, int key_delay_ms, int key_hold_ms);
+
+YDOTOOL_API int ydotool_set_type_fallback(struct ydotool *yd, enum ydotool_type_fallback fallback);
+
+/*
+    Rollover typing of text: a key goes down every key_delay_ms and comes
+    up key_hold_ms later, so up to max_down keys overlap and the hold time
+    doesn't slow typing down. A repeated key comes up before it goes down
+    again, and the oldest key comes up early when max_down are down. 0
+    types one key at a time, the default.
+*/
+YDOTOOL_API int ydotool_set_rollover(struct ydotool *yd, int max_down);
+
+/*
+    Type with an XKB keyboard layout, such as "de" with variant
+    "nodeadkeys" (variant may be NULL). The layout is compiled once into
+    $XDG_CACHE_HOME/ydotool and mapped from there afterwards; delete the
+    file to pick up changes to the XKB data. Compiling fails with ENOTSUP
+    if libydotool was built without libxkbcommon. A NULL layout goes back
+    to US.
+*/
+YDOTOOL_API int ydotool_set_layout(struct ydotool *yd, const char *layout, const char *variant);
+
+/*
+    Path of the file `name' in the cache directory of ydotool,
+    $XDG_CACHE_HOME/ydotool or ~/.cache/ydotool, which is created if needed.
+*/
+YDOTOOL_API int ydotool_cache_path(const char *name, char *buf, size_t len);
+
+// Compile a layout into a cache file, and use a cache file compiled before
+YDOTOOL_API int ydotool_keymap_compile(const char *layout, const char *variant, const char *path);
+YDOTOOL_API int ydotool_keymap_load(struct ydotool *yd, const char *path);
+
+YDOTOOL_API int ydotool_button(struct ydotool *yd, enum ydotool_button button, bool pressed);
+YDOTOOL_API int ydotool_click(struct ydotool *yd, enum ydotool_button button, int hold_ms);
+
+YDOTOOL_API int ydotool_mouse_move(struct ydotool *yd, int32_t x, int32_t y);
+/*
+    Move to an absolute position in pixels. ydotoold moves its absolute
+    pointer device there if it has one (see its --absolute option),
+    otherwise it slams the pointer into the top left corner first and moves
+    relatively, which needs pointer acceleration to be disabled.
+*/
+YDOTOOL_API int ydotool_mouse_move_to(struct ydotool *yd, int32_t x, int32_t y);
+YDOTOOL_API int ydotool_wheel(struct ydotool *yd, int32_t horizontal, int32_t vertical);
+
+/*
+    Move by (x, y) in steps at rate_hz over duration_ms, following the speed
+    profile of curve (NULL for linear). Steps carry their sub-pixel remainder
+    over to the next one, and are paced against absolute deadlines, so the
+    path ends on target and on time.
+*/
+YDOTOOL_API int ydotool_mouse_path(struct ydotool *yd, int32_t x, int32_t y, int duration_ms, int rate_hz,
+				   const struct ydotool_curve *curve);
+
+#ifdef __cplusplus
+}
+#endif
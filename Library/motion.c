@@ -0,0 +1,185 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+/*
+    Interpolated mouse paths.
+*/
+
+#include "internal.h"
+
+#include <errno.h>
+
+// Newton iterations to invert x(s) of a Bézier curve, then bisection if they don't converge
+#define BEZIER_NEWTON_MAX	8
+#define BEZIER_BISECT_MAX	32
+#define BEZIER_EPSILON		1e-7
+
+static const struct ydotool_curve curve_ease_in_out = {
+	.type = YDOTOOL_CURVE_BEZIER,
+	.x1 = 0.42, .y1 = 0, .x2 = 0.58, .y2 = 1
+};
+
+static double bezier(double s, double p1, double p2) {
+	double r = 1 - s;
+
+	return 3 * r * r * s * p1 + 3 * r * s * s * p2 + s * s * s;
+}
+
+static double bezier_slope(double s, double p1, double p2) {
+	double r = 1 - s;
+
+	return 3 * r * r * p1 + 6 * r * s * (p2 - p1) + 3 * s * s * (1 - p2);
+}
+
+static double abs_d(double v) {
+	return v < 0 ? -v : v;
+}
+
+// Progress along the path at time t, both from 0 to 1
+static double curve_progress(const struct ydotool_curve *curve, double t) {
+	if (!curve || curve->type == YDOTOOL_CURVE_LINEAR) {
+		return t;
+	}
+
+	if (curve->type == YDOTOOL_CURVE_EASE_IN_OUT) {
+		curve = &curve_ease_in_out;
+	}
+
+	// Find s where x(s) = t, x is monotonic with x1 and x2 in [0, 1]
+	double s = t;
+
+	for (int i=0; i<BEZIER_NEWTON_MAX; i++) {
+		double err = bezier(s, curve->x1, curve->x2) - t;
+		double slope = bezier_slope(s, curve->x1, curve->x2);
+
+		if (abs_d(err) < BEZIER_EPSILON) {
+			return bezier(s, curve->y1, curve->y2);
+		}
+
+		if (abs_d(slope) < BEZIER_EPSILON) {
+			break;
+		}
+
+		s -= err / slope;
+	}
+
+	double lo = 0, hi = 1;
+
+	s = t;
+
+	for (int i=0; i<BEZIER_BISECT_MAX; i++) {
+		double x = bezier(s, curve->x1, curve->x2);
+
+		if (abs_d(x - t) < BEZIER_EPSILON) {
+			break;
+		}
+
+		if (x < t) {
+			lo = s;
+		} else {
+			hi = s;
+		}
+
+		s = (lo + hi) / 2;
+	}
+
+	return bezier(s, curve->y1, curve->y2);
+}
+
+static int64_t round_i64(double v) {
+	return (int64_t)(v < 0 ? v - 0.5 : v + 0.5);
+}
+
+/*
+    Each step moves to the rounded position on the ideal path, so the
+    rounding errors don't add up. Step k is due at k * duration / steps,
+    computed in whole microseconds from the start so that the intervals
+    don't drift either. The start is when we're called, not the end of
+    the caller's last delay.
+*/
+int ydotool_mouse_path(struct ydotool *yd, int32_t x, int32_t y, int duration_ms, int rate_hz,
+		       const struct ydotool_curve *curve) {
+	if (duration_ms < 0 || rate_hz <= 0
+	    || (curve && curve->type == YDOTOOL_CURVE_BEZIER
+		&& (curve->x1 < 0 || curve->x1 > 1 || curve->x2 < 0 || curve->x2 > 1))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	uint64_t duration_us = (uint64_t)duration_ms * 1000;
+	uint64_t steps = ((uint64_t)duration_ms * rate_hz + 500) / 1000;
+
+	if (steps < 1) {
+		steps = 1;
+	}
+
+	int64_t done_x = 0, done_y = 0;
+	uint64_t done_us = 0;
+
+	pacer_restart(&yd->pacer);
+
+	for (uint64_t k=1; k<=steps; k++) {
+		uint64_t due_us = duration_us * k / steps;
+
+		ydotool_delay_us(yd, due_us - done_us);
+		done_us = due_us;
+
+		double p = k == steps ? 1 : curve_progress(curve, (double)k / steps);
+
+		int64_t to_x = round_i64(x * p);
+		int64_t to_y = round_i64(y * p);
+
+		if (to_x == done_x && to_y == done_y) {
+			continue;
+		}
+
+		if (to_x != done_x) {
+			ydotool_frame_add(yd, EV_REL, REL_X, to_x - done_x);
+		}
+
+		if (to_y != done_y) {
+			ydotool_frame_add(yd, EV_REL, REL_Y, to_y - done_y);
+		}
+
+		if (ydotool_frame_flush(yd)) {
+			return -1;
+		}
+
+		done_x = to_x;
+		done_y = to_y;
+	}
+
+	return 0;
+}
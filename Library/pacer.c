@@ -0,0 +1,188 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+/*
+    Drift-free pacing.
+
+    Waits are scheduled against absolute CLOCK_MONOTONIC deadlines, each one
+    is the previous deadline plus the requested interval, so the time spent
+    sending and oversleeping doesn't add up over a long sequence.
+
+    Falling behind by up to an interval is made up for. Anything more means
+    the caller did something else in between, e.g. sat idle, and the
+    timeline starts over instead of every wait after it returning at once.
+
+    A signal handler ends a wait early, so that a tool that stops on
+    SIGINT gets to do so before a long delay is over.
+*/
+
+#include "internal.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/prctl.h>
+
+// Max number of wake-up samples kept for the percentiles
+#define PACER_SAMPLES_MAX	65536
+
+uint64_t monotonic_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Returns -1 if a signal handler ran before t
+static int sleep_until(uint64_t t) {
+	struct timespec ts = {
+		.tv_sec = t / 1000000000,
+		.tv_nsec = t % 1000000000
+	};
+
+	return clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR ? -1 : 0;
+}
+
+/*
+    spin_us: when non-zero, sleep until spin_us before each deadline and
+             busy-wait for the rest, for sub-millisecond accuracy.
+    record: keep wake-up statistics for pacer_report().
+*/
+int pacer_setup(struct pacer *p, uint32_t spin_us, bool record) {
+	p->spin_ns = (uint64_t)spin_us * 1000;
+	p->record = record;
+
+	if (record && !p->samples) {
+		p->samples = malloc(PACER_SAMPLES_MAX * sizeof(uint32_t));
+
+		if (!p->samples) {
+			p->record = false;
+			return -1;
+		}
+	}
+
+	// The default 50us timer slack is a large part of the error at short intervals
+	prctl(PR_SET_TIMERSLACK, 1UL);
+
+	return 0;
+}
+
+void pacer_free(struct pacer *p) {
+	free(p->samples);
+	p->samples = NULL;
+}
+
+// Start a new timeline at the next wait, e.g. for the next command of a batch
+void pacer_restart(struct pacer *p) {
+	p->started = false;
+}
+
+void pacer_wait_us(struct pacer *p, uint64_t us) {
+	uint64_t now = monotonic_ns();
+
+	// The timeline starts at the first wait, and again after a gap
+	if (!p->started || p->deadline + us * 1000 < now) {
+		p->started = true;
+		p->deadline = now;
+		p->last_wake = now;
+	}
+
+	p->deadline += us * 1000;
+
+	if (p->deadline > now) {
+		int rc = 0;
+
+		if (p->spin_ns && p->deadline - now > p->spin_ns) {
+			rc = sleep_until(p->deadline - p->spin_ns);
+		} else if (!p->spin_ns) {
+			rc = sleep_until(p->deadline);
+		}
+
+		// Spinning out the rest of an interrupted wait would just delay the stop
+		if (p->spin_ns && !rc) {
+			while (monotonic_ns() < p->deadline);
+		}
+	}
+
+	if (p->record) {
+		uint64_t wake = monotonic_ns();
+		uint64_t lateness = wake > p->deadline ? wake - p->deadline : 0;
+
+		p->waits++;
+		p->requested_ns += us * 1000;
+		p->achieved_ns += wake - p->last_wake;
+		p->last_wake = wake;
+
+		if (lateness > p->lateness_max) {
+			p->lateness_max = lateness;
+		}
+
+		if (p->samples_len < PACER_SAMPLES_MAX) {
+			p->samples[p->samples_len++] = lateness > UINT32_MAX ? UINT32_MAX : lateness;
+		}
+	}
+}
+
+static int cmp_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+void pacer_report(struct pacer *p, FILE *fp) {
+	if (!p->waits) {
+		fputs("Timing report: no waits\n", fp);
+		return;
+	}
+
+	qsort(p->samples, p->samples_len, sizeof(uint32_t), cmp_u32);
+
+	uint32_t p50 = p->samples[p->samples_len * 50 / 100];
+	uint32_t p99 = p->samples[p->samples_len * 99 / 100];
+
+	fprintf(fp, "Timing report: %" PRIu64 " waits\n", p->waits);
+	fprintf(fp, "  Requested: %.3f ms total, %.3f ms per interval\n",
+		p->requested_ns / 1e6, p->requested_ns / 1e6 / p->waits);
+	fprintf(fp, "  Achieved:  %.3f ms total, %.3f ms per interval (%+.3f%%)\n",
+		p->achieved_ns / 1e6, p->achieved_ns / 1e6 / p->waits,
+		p->requested_ns ? ((double)p->achieved_ns / p->requested_ns - 1) * 100 : 0.0);
+	fprintf(fp, "  Jitter (wake-up lateness): p50 %.1f us, p99 %.1f us, max %.1f us\n",
+		p50 / 1e3, p99 / 1e3, p->lateness_max / 1e3);
+}
@@ -0,0 +1,254 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+/*
+    Shared memory transport.
+
+    Frames go through a ring in a memfd shared with the daemon instead of
+    the socket, see struct ydotool_ring. The socket stays for replies and
+    delivery barriers.
+*/
+
+#define _GNU_SOURCE
+
+#include "internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+// How long an older daemon gets to answer before we assume it ignored us
+#define RING_REPLY_TIMEOUT_MS	1000
+
+static int ring_create(uint32_t size, int *fd_mem_out) {
+	int fd_mem = memfd_create("ydotool-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+	if (fd_mem < 0) {
+		return -1;
+	}
+
+	if (ftruncate(fd_mem, YDOTOOL_RING_BYTES(size))
+	    || fcntl(fd_mem, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) {
+		int err = errno;
+		close(fd_mem);
+		errno = err;
+		return -1;
+	}
+
+	*fd_mem_out = fd_mem;
+
+	return 0;
+}
+
+static int ring_offer(struct ydotool *yd, uint32_t size, int fd_mem, int fd_bell) {
+	struct input_event ev = {
+		.type = YDOTOOL_EV_CTL,
+		.code = YDOTOOL_CTL_RING,
+		.value = size
+	};
+
+	struct iovec iov = {
+		.iov_base = &ev,
+		.iov_len = sizeof(ev)
+	};
+
+	union {
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+		struct cmsghdr align;
+	} cmsg_buf;
+
+	struct msghdr mh = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cmsg_buf.buf,
+		.msg_controllen = sizeof(cmsg_buf.buf)
+	};
+
+	struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(2 * sizeof(int));
+
+	int fds[2] = {fd_mem, fd_bell};
+	memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+
+	return sendmsg(yd->fd, &mh, MSG_NOSIGNAL) == sizeof(ev) ? 0 : -1;
+}
+
+int ydotool_use_ring(struct ydotool *yd, uint32_t size) {
+	if (!size) {
+		size = RING_SIZE_DEFAULT;
+	}
+
+	if (!yd->connected) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	if (yd->ring || yd->timed) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (size < YDOTOOL_RING_SIZE_MIN || size > YDOTOOL_RING_SIZE_MAX || (size & (size - 1))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// What was sent over the socket must not be overtaken by the ring
+	if (ydotool_sync(yd)) {
+		return -1;
+	}
+
+	int fd_mem;
+
+	if (ring_create(size, &fd_mem)) {
+		return -1;
+	}
+
+	struct ydotool_ring *ring = mmap(NULL, YDOTOOL_RING_BYTES(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd_mem, 0);
+	int fd_bell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	int err = 0;
+
+	if (ring == MAP_FAILED || fd_bell < 0) {
+		err = errno;
+	} else {
+		ring->magic = YDOTOOL_RING_MAGIC;
+		ring->size = size;
+
+		yd->ring_reply = 0;
+
+		if (ring_offer(yd, size, fd_mem, fd_bell)) {
+			err = errno;
+		}
+	}
+
+	close(fd_mem);
+
+	/*
+	    The daemon answers the offer right away, so once a barrier behind
+	    it is acknowledged we know. Daemons that don't know rings ignore it.
+	*/
+	if (!err && ydotool_flush(yd, RING_REPLY_TIMEOUT_MS) && errno != ETIMEDOUT) {
+		err = errno;
+	}
+
+	if (!err && yd->ring_reply <= 0) {
+		err = yd->ring_reply < 0 ? -yd->ring_reply : ENOTSUP;
+	}
+
+	if (err) {
+		if (ring != MAP_FAILED) {
+			munmap(ring, YDOTOOL_RING_BYTES(size));
+		}
+
+		if (fd_bell >= 0) {
+			close(fd_bell);
+		}
+
+		errno = err;
+		return -1;
+	}
+
+	yd->ring = ring;
+	yd->ring_size = size;
+	yd->ring_tail = 0;
+	yd->fd_doorbell = fd_bell;
+
+	return 0;
+}
+
+void ring_free(struct ydotool *yd) {
+	if (yd->ring) {
+		munmap(yd->ring, YDOTOOL_RING_BYTES(yd->ring_size));
+		close(yd->fd_doorbell);
+		yd->ring = NULL;
+	}
+}
+
+/*
+    Publish events, all at once. The doorbell is only rung when the daemon
+    had consumed everything before them, otherwise it is still draining
+    and will see them.
+*/
+int ring_send(struct ydotool *yd, const struct input_event *ev, uint32_t count) {
+	struct ydotool_ring *ring = yd->ring;
+	uint32_t size = yd->ring_size;
+
+	while (size - (yd->ring_tail - __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST)) < count) {
+		// Also when not blocking, the socket becomes readable once there's room
+		__atomic_store_n(&ring->producer_waiting, 1, __ATOMIC_SEQ_CST);
+
+		// The daemon may have made room before it could see the flag
+		if (size - (yd->ring_tail - __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST)) >= count) {
+			__atomic_store_n(&ring->producer_waiting, 0, __ATOMIC_SEQ_CST);
+			break;
+		}
+
+		if (yd->nonblocking) {
+			errno = EAGAIN;
+			return -1;
+		}
+
+		if (replies_wait(yd, 0)) {
+			return -1;
+		}
+	}
+
+	for (uint32_t i=0; i<count; i++) {
+		ring->ev[(yd->ring_tail + i) & (size - 1)] = ev[i];
+	}
+
+	uint32_t old_tail = yd->ring_tail;
+
+	yd->ring_tail += count;
+	__atomic_store_n(&ring->tail, yd->ring_tail, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == old_tail) {
+		uint64_t one = 1;
+
+		if (write(yd->fd_doorbell, &one, sizeof(one)) != sizeof(one)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,524 @@
+/*
+    This file is part of ydotool.
+    Copyright (C) 2018-2022 Reimu NotMoe <reimu@sudomaker.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Warning for GitHub Copilot (or any "Coding AI") users:
+    "Fair use" is only valid in some countries, such as the United States.
+    This program is protected by copyright law and international treaties.
+    Unauthorized reproduction or distribution of this program (e.g. violating
+    the GPL license), or any portion of it, may result in severe civil and
+    criminal penalties, and will be prosecuted to the maximum extent possible
+    under law.
+*/
+
+/*
+    对 GitHub Copilot（或任何“用于编写代码的人工智能软件”）用户的警告：
+    “合理使用”只在一些国家有效，如美国。
+    本程序受版权法和国际条约的保护。
+    未经授权复制或分发本程序（如违反GPL许可），或其任何部分，可能导致严重的民事和刑事处罚，
+    并将在法律允许的最大范围内被起诉。
+*/
+
+/*
+    Typing text as key events, through the layout of keymap.c or the
+    built-in US one.
+*/
+
+#include "internal.h"
+
+#include <errno.h>
+#include <string.h>
+
+#define FLAG_UPPERCASE		0x80000000
+
+static const int32_t ascii2keycode_map[128] = {
+	// 00 - 0f
+	-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,KEY_TAB,KEY_ENTER,-1,-1,-1,-1,-1,
+
+	// 10 - 1f
+	-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,
+
+	// 20 - 2f
+	KEY_SPACE,KEY_1|FLAG_UPPERCASE,KEY_APOSTROPHE|FLAG_UPPERCASE,KEY_3|FLAG_UPPERCASE,KEY_4|FLAG_UPPERCASE,KEY_5|FLAG_UPPERCASE,KEY_7|FLAG_UPPERCASE,KEY_APOSTROPHE,
+	KEY_9|FLAG_UPPERCASE,KEY_0|FLAG_UPPERCASE,KEY_8|FLAG_UPPERCASE,KEY_EQUAL|FLAG_UPPERCASE,KEY_COMMA,KEY_MINUS,KEY_DOT,KEY_SLASH,
+
+	// 30 - 3f
+	KEY_0,KEY_1,KEY_2,KEY_3,KEY_4,KEY_5,KEY_6,KEY_7,
+	KEY_8,KEY_9,KEY_SEMICOLON|FLAG_UPPERCASE,KEY_SEMICOLON,KEY_COMMA|FLAG_UPPERCASE,KEY_EQUAL,KEY_DOT|FLAG_UPPERCASE,KEY_SLASH|FLAG_UPPERCASE,
+
+	// 40 - 4f
+	KEY_2|FLAG_UPPERCASE,KEY_A|FLAG_UPPERCASE,KEY_B|FLAG_UPPERCASE,KEY_C|FLAG_UPPERCASE,KEY_D|FLAG_UPPERCASE,KEY_E|FLAG_UPPERCASE,KEY_F|FLAG_UPPERCASE,KEY_G|FLAG_UPPERCASE,
+	KEY_H|FLAG_UPPERCASE,KEY_I|FLAG_UPPERCASE,KEY_J|FLAG_UPPERCASE,KEY_K|FLAG_UPPERCASE,KEY_L|FLAG_UPPERCASE,KEY_M|FLAG_UPPERCASE,KEY_N|FLAG_UPPERCASE,KEY_O|FLAG_UPPERCASE,
+
+	// 50 - 5f
+	KEY_P|FLAG_UPPERCASE,KEY_Q|FLAG_UPPERCASE,KEY_R|FLAG_UPPERCASE,KEY_S|FLAG_UPPERCASE,KEY_T|FLAG_UPPERCASE,KEY_U|FLAG_UPPERCASE,KEY_V|FLAG_UPPERCASE,KEY_W|FLAG_UPPERCASE,
+	KEY_X|FLAG_UPPERCASE,KEY_Y|FLAG_UPPERCASE,KEY_Z|FLAG_UPPERCASE,KEY_LEFTBRACE,KEY_BACKSLASH,KEY_RIGHTBRACE,KEY_6|FLAG_UPPERCASE,KEY_MINUS|FLAG_UPPERCASE,
+
+	// 60 - 6f
+	KEY_GRAVE,KEY_A,KEY_B,KEY_C,KEY_D,KEY_E,KEY_F,KEY_G,
+	KEY_H,KEY_I,KEY_J,KEY_K,KEY_L,KEY_M,KEY_N,KEY_O,
+
+	// 70 - 7f
+	KEY_P,KEY_Q,KEY_R,KEY_S,KEY_T,KEY_U,KEY_V,KEY_W,
+	KEY_X,KEY_Y,KEY_Z,KEY_LEFTBRACE|FLAG_UPPERCASE,KEY_BACKSLASH|FLAG_UPPERCASE,KEY_RIGHTBRACE|FLAG_UPPERCASE,KEY_GRAVE|FLAG_UPPERCASE,-1
+};
+
+// Keys held for KEYMAP_MOD_* bits
+static const uint16_t mod_keys[] = {KEY_LEFTSHIFT, KEY_RIGHTALT, KEY_LEFTCTRL};
+
+#define MOD_KEYS_LEN	(sizeof(mod_keys) / sizeof(mod_keys[0]))
+
+// Most keys one character takes, "u10ffff " with Ctrl+Shift+U
+#define CHAR_KEYS_MAX	8
+
+/*
+    Keys are typed one behind, so that when a key is released we know
+    which of its modifiers the next one needs too. Those stay down, the
+    others are released with the key. A run of capitals is one Shift.
+*/
+struct typist {
+	struct ydotool *yd;
+	bool dry_run;
+	int key_delay_ms;
+	int key_hold_ms;
+
+	uint8_t held;		// Modifiers down
+	bool pending;		// The key below waits for the next one
+	uint16_t code;
+	uint8_t mods;
+
+	/*
+	    Rollover: a key goes down every key_delay_ms and comes up
+	    key_hold_ms later, whatever else is down by then.
+	*/
+	int rollover;		// Most keys down at once, 0 for one key at a time
+	struct {
+		uint16_t code;
+		uint64_t release_us;
+	} down[YDOTOOL_ROLLOVER_MAX];	// Keys down, in order of release
+	int down_len;
+	uint64_t now_us;	// Time into the run
+	uint64_t press_us;	// When the last key went down
+	bool pressed;
+
+	struct ydotool_type_stats *stats;
+};
+
+static int char_lookup(const struct ydotool *yd, uint32_t cp, uint16_t *code, uint8_t *mods) {
+	if (yd->keymap) {
+		uint16_t page = cp < KEYMAP_PAGES * 256 ? yd->keymap->dir[cp >> 8] : 0;
+
+		if (page) {
+			const struct keymap_entry *e = KEYMAP_PAGE(yd->keymap, page - 1) + (cp & 0xff);
+
+			if (e->code) {
+				*code = e->code;
+				*mods = e->mods;
+				return 0;
+			}
+		}
+	} else if (cp < 128 && ascii2keycode_map[cp] != -1) {
+		*code = ascii2keycode_map[cp] & 0xffff;
+		*mods = ascii2keycode_map[cp] & FLAG_UPPERCASE ? KEYMAP_MOD_SHIFT : 0;
+		return 0;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+/*
+    Keys that type cp, returns how many. Without a key in the layout, the
+    fallback may be Ctrl+Shift+U, the code point in hex, then space: the
+    Unicode input of GTK and IBus. Those keys go through the layout too.
+*/
+static int char_keys(const struct ydotool *yd, uint32_t cp, uint16_t *code, uint8_t *mods) {
+	if (char_lookup(yd, cp, &code[0], &mods[0]) == 0) {
+		return 1;
+	}
+
+	if (yd->type_fallback != YDOTOOL_TYPE_CTRL_SHIFT_U || cp < 0x20) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	char hex[CHAR_KEYS_MAX + 1];
+	int len = snprintf(hex, sizeof(hex), "u%x ", cp);
+
+	for (int i=0; i<len; i++) {
+		if (char_lookup(yd, (unsigned char)hex[i], &code[i], &mods[i])) {
+			return -1;
+		}
+	}
+
+	mods[0] |= KEYMAP_MOD_CTRL | KEYMAP_MOD_SHIFT;
+
+	return len;
+}
+
+static void typist_add(struct typist *t, uint16_t code, int32_t value) {
+	if (!t->dry_run) {
+		ydotool_frame_add(t->yd, EV_KEY, code, value);
+	}
+
+	t->stats->events++;
+}
+
+static int typist_flush(struct typist *t) {
+	t->stats->events++;
+
+	return t->dry_run ? 0 : ydotool_frame_flush(t->yd);
+}
+
+static void typist_delay(struct typist *t, int ms) {
+	if (!t->dry_run) {
+		ydotool_delay_ms(t->yd, ms);
+	}
+}
+
+// Type the pending key, keeping the modifiers of next_mods down
+static int typist_emit(struct typist *t, uint8_t next_mods, int delay_ms) {
+	for (int i=0; i<MOD_KEYS_LEN; i++) {
+		if (t->mods & ~t->held & (1 << i)) {
+			typist_add(t, mod_keys[i], 1);
+		}
+	}
+	typist_add(t, t->code, 1);
+
+	if (typist_flush(t)) {
+		return -1;
+	}
+
+	t->held = t->mods;
+	typist_delay(t, t->key_hold_ms);
+
+	typist_add(t, t->code, 0);
+	for (int i=MOD_KEYS_LEN - 1; i>=0; i--) {
+		if (t->held & ~next_mods & (1 << i)) {
+			typist_add(t, mod_keys[i], 0);
+		}
+	}
+
+	if (typist_flush(t)) {
+		return -1;
+	}
+
+	t->held &= next_mods;
+	t->pending = false;
+	typist_delay(t, delay_ms);
+
+	// Down and up frames with the modifiers pressed and released around the key
+	t->stats->events_unlatched += 2 * (__builtin_popcount(t->mods) + 2);
+
+	return 0;
+}
+
+static void typist_wait(struct typist *t, uint64_t at_us) {
+	if (at_us > t->now_us) {
+		if (!t->dry_run) {
+			ydotool_delay_us(t->yd, at_us - t->now_us);
+		}
+
+		t->now_us = at_us;
+	}
+}
+
+static void rollover_drop(struct typist *t, int i) {
+	t->down_len--;
+	memmove(&t->down[i], &t->down[i + 1], (t->down_len - i) * sizeof(t->down[0]));
+}
+
+// Release the keys due up to limit_us, each frame at its time. The last one takes the modifiers with it if final.
+static int rollover_release(struct typist *t, uint64_t limit_us, bool final) {
+	while (t->down_len && t->down[0].release_us <= limit_us) {
+		uint64_t at = t->down[0].release_us;
+
+		typist_wait(t, at);
+
+		while (t->down_len && t->down[0].release_us == at) {
+			typist_add(t, t->down[0].code, 0);
+			rollover_drop(t, 0);
+		}
+
+		if (final && !t->down_len) {
+			for (int i=MOD_KEYS_LEN - 1; i>=0; i--) {
+				if (t->held & (1 << i)) {
+					typist_add(t, mod_keys[i], 0);
+				}
+			}
+
+			t->held = 0;
+		}
+
+		if (typist_flush(t)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int rollover_key(struct typist *t, uint16_t code, uint8_t mods) {
+	uint64_t press_us = t->pressed ? t->press_us + t->key_delay_ms * 1000ull : t->now_us;
+
+	if (rollover_release(t, press_us, false)) {
+		return -1;
+	}
+
+	typist_wait(t, press_us);
+
+	/*
+	    A key that is still down has to come up before it goes down again,
+	    and the oldest ones make room when too many are down. Both are
+	    released early, in a frame of their own.
+	*/
+	bool early = false;
+
+	for (int i=0; i<t->down_len; i++) {
+		if (t->down[i].code == code || t->down_len - i >= t->rollover) {
+			typist_add(t, t->down[i].code, 0);
+			rollover_drop(t, i--);
+			early = true;
+		}
+	}
+
+	if (early && typist_flush(t)) {
+		return -1;
+	}
+
+	// Keys already down produced their characters, changing modifiers under them is fine
+	for (int i=MOD_KEYS_LEN - 1; i>=0; i--) {
+		if (t->held & ~mods & (1 << i)) {
+			typist_add(t, mod_keys[i], 0);
+		}
+	}
+	for (int i=0; i<MOD_KEYS_LEN; i++) {
+		if (mods & ~t->held & (1 << i)) {
+			typist_add(t, mod_keys[i], 1);
+		}
+	}
+	typist_add(t, code, 1);
+
+	if (typist_flush(t)) {
+		return -1;
+	}
+
+	t->held = mods;
+	t->pressed = true;
+	t->press_us = press_us;
+	t->down[t->down_len].code = code;
+	t->down[t->down_len].release_us = press_us + t->key_hold_ms * 1000ull;
+	t->down_len++;
+
+	t->stats->events_unlatched += 2 * (__builtin_popcount(mods) + 2);
+
+	return 0;
+}
+
+static int typist_key(struct typist *t, uint16_t code, uint8_t mods) {
+	if (t->rollover) {
+		return rollover_key(t, code, mods);
+	}
+
+	if (t->pending && typist_emit(t, mods, t->key_delay_ms)) {
+		return -1;
+	}
+
+	t->pending = true;
+	t->code = code;
+	t->mods = mods;
+
+	return 0;
+}
+
+static int typist_char(struct typist *t, uint32_t cp) {
+	uint16_t code[CHAR_KEYS_MAX];
+	uint8_t mods[CHAR_KEYS_MAX];
+	int n = char_keys(t->yd, cp, code, mods);
+
+	if (n < 0) {
+		t->stats->skipped++;
+		return 0;
+	}
+
+	for (int i=0; i<n; i++) {
+		if (typist_key(t, code[i], mods[i])) {
+			return -1;
+		}
+	}
+
+	t->stats->chars++;
+
+	return 0;
+}
+
+// Type the last key and let go of all modifiers
+static int typist_end(struct typist *t, int delay_ms) {
+	if (t->rollover) {
+		if (rollover_release(t, UINT64_MAX, true)) {
+			return -1;
+		}
+
+		typist_wait(t, t->now_us + delay_ms * 1000ull);
+		return 0;
+	}
+
+	return t->pending ? typist_emit(t, 0, delay_ms) : 0;
+}
+
+// Collect UTF-8 a byte at a time: 1 with *cp complete, 0 within a character, -1 for a stray byte
+static int utf8_feed(struct ydotool *yd, uint8_t b, uint32_t *cp) {
+	if (yd->utf8_need) {
+		if ((b & 0xc0) == 0x80) {
+			yd->utf8_cp = yd->utf8_cp << 6 | (b & 0x3f);
+
+			if (--yd->utf8_need) {
+				return 0;
+			}
+
+			*cp = yd->utf8_cp;
+
+			if (*cp < yd->utf8_min || *cp > 0x10ffff || (*cp >= 0xd800 && *cp < 0xe000)) {
+				return -1;
+			}
+
+			return 1;
+		}
+
+		// Cut short, the rest of it is lost
+		yd->utf8_need = 0;
+	}
+
+	if (b < 0x80) {
+		*cp = b;
+		return 1;
+	} else if ((b & 0xe0) == 0xc0) {
+		yd->utf8_cp = b & 0x1f;
+		yd->utf8_min = 0x80;
+		yd->utf8_need = 1;
+	} else if ((b & 0xf0) == 0xe0) {
+		yd->utf8_cp = b & 0x0f;
+		yd->utf8_min = 0x800;
+		yd->utf8_need = 2;
+	} else if ((b & 0xf8) == 0xf0) {
+		yd->utf8_cp = b & 0x07;
+		yd->utf8_min = 0x10000;
+		yd->utf8_need = 3;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+static int type_text(struct ydotool *yd, const char *text, size_t len, int key_delay_ms, int key_hold_ms,
+		     bool dry_run, struct ydotool_type_stats *stats) {
+	struct ydotool_type_stats dummy = {0};
+	struct typist t = {
+		.yd = yd,
+		.dry_run = dry_run,
+		.key_delay_ms = key_delay_ms,
+		.key_hold_ms = key_hold_ms,
+		.rollover = yd->rollover,
+		.stats = stats ? stats : &dummy
+	};
+
+	for (size_t i=0; i<len; i++) {
+		uint32_t cp;
+		int rc = utf8_feed(yd, text[i], &cp);
+
+		if (rc < 0) {
+			t.stats->skipped++;
+		} else if (rc > 0 && typist_char(&t, cp)) {
+			return -1;
+		}
+	}
+
+	// No delay after the last key
+	return typist_end(&t, 0);
+}
+
+int ydotool_type_codepoint(struct ydotool *yd, uint32_t cp, int key_delay_ms, int key_hold_ms) {
+	struct ydotool_type_stats stats = {0};
+	struct typist t = {
+		.yd = yd,
+		.key_delay_ms = key_delay_ms,
+		.key_hold_ms = key_hold_ms,
+		.stats = &stats
+	};
+
+	if (typist_char(&t, cp) || typist_end(&t, key_delay_ms)) {
+		return -1;
+	}
+
+	if (stats.skipped) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int ydotool_type_char(struct ydotool *yd, char c, int key_delay_ms, int key_hold_ms) {
+	uint32_t cp;
+	int rc = utf8_feed(yd, c, &cp);
+
+	if (rc < 0) {
+		errno = EILSEQ;
+		return -1;
+	}
+
+	return rc ? ydotool_type_codepoint(yd, cp, key_delay_ms, key_hold_ms) : 0;
+}
+
+int ydotool_type_n(struct ydotool *yd, const char *text, size_t len, int key_delay_ms, int key_hold_ms,
+		   struct ydotool_type_stats *stats) {
+	return type_text(yd, text, len, key_delay_ms, key_hold_ms, false, stats);
+}
+
+int ydotool_type_plan(struct ydotool *yd, const char *text, size_t len, struct ydotool_type_stats *stats) {
+	return type_text(yd, text, len, 0, 0, true, stats);
+}
+
+int ydotool_type(struct ydotool *yd, const char *text, int key_delay_ms, int key_hold_ms) {
+	return ydotool_type_n(yd, text, strlen(text), key_delay_ms, key_hold_ms, NULL);
+}
+
+int ydotool_set_rollover(struct ydotool *yd, int max_down) {
+	if (max_down < 0 || max_down > YDOTOOL_ROLLOVER_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	yd->rollover = max_down;
+
+	return 0;
+}
+
+int ydotool_set_type_fallback(struct ydotool *yd, enum ydotool_type_fallback fallback) {
+	if (fallback != YDOTOOL_TYPE_SKIP && fallback != YDOTOOL_TYPE_CTRL_SHIFT_U) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	yd->type_fallback = fallback;
+
+	return 0;
+}